@@ -0,0 +1,408 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+export module BVH;
+
+import Culling;
+
+export struct AABB
+{
+  glm::vec3 min{ std::numeric_limits<float>::max() };
+  glm::vec3 max{ std::numeric_limits<float>::lowest() };
+
+  void Grow(const AABB& other) { min = glm::min(min, other.min); max = glm::max(max, other.max); }
+  void Grow(glm::vec3 p) { min = glm::min(min, p); max = glm::max(max, p); }
+  glm::vec3 Center() const { return (min + max) * .5f; }
+  float SurfaceArea() const
+  {
+    const glm::vec3 d = glm::max(max - min, glm::vec3(0));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+};
+
+// bounding volume hierarchy over a set of boxes (e.g. one per draw), built with binned SAH.
+// Moving boxes are handled with Refit, which keeps the topology and only recomputes bounds,
+// so the tree slowly degrades. NeedsRebuild reports when that has gone too far.
+// Queries append the indices of the boxes they hit to out
+export class BVH
+{
+public:
+  void Build(const std::vector<AABB>& boxes);
+
+  // boxes must have the same size and order as in Build
+  void Refit(const std::vector<AABB>& boxes);
+
+  // true once refitting has made the tree noticeably worse than a fresh build
+  bool NeedsRebuild() const { return cost_ > builtCost_ * REBUILD_THRESHOLD; }
+
+  void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const;
+  void QueryRay(glm::vec3 origin, glm::vec3 dir, float maxT, std::vector<uint32_t>& out) const;
+  void QuerySphere(glm::vec3 center, float radius, std::vector<uint32_t>& out) const;
+
+  size_t NumItems() const { return boxes_.size(); }
+  size_t NumNodes() const { return nodes_.size(); }
+  float GetCost() const { return cost_; }
+
+private:
+  static constexpr uint32_t NUM_BINS = 16;
+  static constexpr uint32_t MAX_LEAF_SIZE = 4;
+  static constexpr float REBUILD_THRESHOLD = 1.5f;
+
+  struct Node
+  {
+    AABB bounds;
+    uint32_t leftFirst{}; // first child for internal nodes (the second is right after), first item for leaves
+    uint32_t count{}; // items in a leaf, 0 for internal nodes
+  };
+
+  void Subdivide(uint32_t nodeIndex, const std::vector<glm::vec3>& centroids);
+  void UpdateCost();
+  void CollectSubtree(uint32_t nodeIndex, std::vector<uint32_t>& out) const;
+
+  std::vector<Node> nodes_; // children always come after their parent
+  std::vector<uint32_t> items_; // box indices, leaves reference ranges of this
+  std::vector<AABB> boxes_;
+  float cost_{};
+  float builtCost_{};
+};
+
+namespace
+{
+  // signed distance of the box from the plane's inside, and its projected radius
+  glm::vec2 PlaneDistance(const glm::vec4& plane, const AABB& box)
+  {
+    const glm::vec3 normal(plane);
+    const glm::vec3 center = box.Center();
+    const glm::vec3 extent = (box.max - box.min) * .5f;
+    return { glm::dot(normal, center) + plane.w, glm::dot(glm::abs(normal), extent) };
+  }
+}
+
+void BVH::Build(const std::vector<AABB>& boxes)
+{
+  boxes_ = boxes;
+  nodes_.clear();
+  items_.resize(boxes.size());
+  std::vector<glm::vec3> centroids(boxes.size());
+  for (uint32_t i = 0; i < boxes.size(); i++)
+  {
+    items_[i] = i;
+    centroids[i] = boxes[i].Center();
+  }
+  if (boxes.empty())
+  {
+    cost_ = builtCost_ = 0;
+    return;
+  }
+
+  nodes_.reserve(boxes.size() * 2);
+  nodes_.push_back({ .leftFirst = 0, .count = static_cast<uint32_t>(boxes.size()) });
+  Subdivide(0, centroids);
+  UpdateCost();
+  builtCost_ = cost_;
+}
+
+void BVH::Subdivide(uint32_t nodeIndex, const std::vector<glm::vec3>& centroids)
+{
+  const uint32_t first = nodes_[nodeIndex].leftFirst;
+  const uint32_t count = nodes_[nodeIndex].count;
+  AABB bounds, centroidBounds;
+  for (uint32_t i = first; i < first + count; i++)
+  {
+    bounds.Grow(boxes_[items_[i]]);
+    centroidBounds.Grow(centroids[items_[i]]);
+  }
+  nodes_[nodeIndex].bounds = bounds;
+  if (count <= MAX_LEAF_SIZE)
+  {
+    return;
+  }
+
+  // cheapest split plane over all axes, cost is area * item count summed over both sides
+  int bestAxis = -1;
+  uint32_t bestSplit = 0;
+  float bestCost = std::numeric_limits<float>::max();
+  for (int axis = 0; axis < 3; axis++)
+  {
+    const float lo = centroidBounds.min[axis];
+    const float extent = centroidBounds.max[axis] - lo;
+    if (extent <= 0)
+    {
+      continue;
+    }
+
+    std::array<AABB, NUM_BINS> binBounds{};
+    std::array<uint32_t, NUM_BINS> binCounts{};
+    const float scale = NUM_BINS / extent;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+      const uint32_t bin = std::min(NUM_BINS - 1, static_cast<uint32_t>((centroids[items_[i]][axis] - lo) * scale));
+      binBounds[bin].Grow(boxes_[items_[i]]);
+      binCounts[bin]++;
+    }
+
+    // sweep from the right to get the cost of everything right of each plane, then from the left
+    std::array<float, NUM_BINS - 1> rightCost{};
+    AABB right;
+    uint32_t rightCount = 0;
+    for (uint32_t b = NUM_BINS - 1; b > 0; b--)
+    {
+      right.Grow(binBounds[b]);
+      rightCount += binCounts[b];
+      rightCost[b - 1] = rightCount ? right.SurfaceArea() * rightCount : 0.0f;
+    }
+    AABB left;
+    uint32_t leftCount = 0;
+    for (uint32_t b = 0; b < NUM_BINS - 1; b++)
+    {
+      left.Grow(binBounds[b]);
+      leftCount += binCounts[b];
+      const float cost = (leftCount ? left.SurfaceArea() * leftCount : 0.0f) + rightCost[b];
+      if (leftCount > 0 && leftCount < count && cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = b + 1;
+      }
+    }
+  }
+
+  // keep a leaf if no split beats intersecting every item (unless it's too big for one)
+  if (bestAxis < 0 || (bestCost >= bounds.SurfaceArea() * count && count <= MAX_LEAF_SIZE * 4))
+  {
+    return;
+  }
+
+  const float lo = centroidBounds.min[bestAxis];
+  const float scale = NUM_BINS / (centroidBounds.max[bestAxis] - lo);
+  const auto mid = std::partition(items_.begin() + first, items_.begin() + first + count, [&](uint32_t item)
+    {
+      return std::min(NUM_BINS - 1, static_cast<uint32_t>((centroids[item][bestAxis] - lo) * scale)) < bestSplit;
+    });
+  const uint32_t leftCount = static_cast<uint32_t>(mid - (items_.begin() + first));
+
+  const uint32_t leftChild = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back({ .leftFirst = first, .count = leftCount });
+  nodes_.push_back({ .leftFirst = first + leftCount, .count = count - leftCount });
+  nodes_[nodeIndex].leftFirst = leftChild;
+  nodes_[nodeIndex].count = 0;
+  Subdivide(leftChild, centroids);
+  Subdivide(leftChild + 1, centroids);
+}
+
+void BVH::Refit(const std::vector<AABB>& boxes)
+{
+  boxes_ = boxes;
+
+  // children come after their parents, so walking backwards visits them first
+  for (size_t n = nodes_.size(); n-- > 0;)
+  {
+    Node& node = nodes_[n];
+    AABB bounds;
+    if (node.count > 0)
+    {
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      {
+        bounds.Grow(boxes_[items_[i]]);
+      }
+    }
+    else
+    {
+      bounds = nodes_[node.leftFirst].bounds;
+      bounds.Grow(nodes_[node.leftFirst + 1].bounds);
+    }
+    node.bounds = bounds;
+  }
+  UpdateCost();
+}
+
+void BVH::UpdateCost()
+{
+  // SAH cost of the whole tree, relative to the root
+  float cost = 0;
+  for (const auto& node : nodes_)
+  {
+    cost += node.bounds.SurfaceArea() * (node.count > 0 ? node.count : 1);
+  }
+  const float rootArea = nodes_.empty() ? 0.0f : nodes_[0].bounds.SurfaceArea();
+  cost_ = rootArea > 0 ? cost / rootArea : 0.0f;
+}
+
+void BVH::CollectSubtree(uint32_t nodeIndex, std::vector<uint32_t>& out) const
+{
+  // a subtree's items are contiguous, from its leftmost leaf to its rightmost one
+  uint32_t leftmost = nodeIndex;
+  uint32_t rightmost = nodeIndex;
+  while (nodes_[leftmost].count == 0)
+  {
+    leftmost = nodes_[leftmost].leftFirst;
+  }
+  while (nodes_[rightmost].count == 0)
+  {
+    rightmost = nodes_[rightmost].leftFirst + 1;
+  }
+  out.insert(out.end(), items_.begin() + nodes_[leftmost].leftFirst,
+    items_.begin() + nodes_[rightmost].leftFirst + nodes_[rightmost].count);
+}
+
+void BVH::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const
+{
+  if (nodes_.empty())
+  {
+    return;
+  }
+
+  // planes the node is entirely inside of don't need to be tested again for its children
+  struct Entry
+  {
+    uint32_t node;
+    uint32_t planeMask;
+  };
+  std::vector<Entry> stack = { { 0, 0b111111 } };
+  while (!stack.empty())
+  {
+    const auto [nodeIndex, parentMask] = stack.back();
+    stack.pop_back();
+    const Node& node = nodes_[nodeIndex];
+
+    uint32_t planeMask = parentMask;
+    bool outside = false;
+    for (uint32_t p = 0; p < 6 && !outside; p++)
+    {
+      if (planeMask & (1u << p))
+      {
+        const glm::vec2 d = PlaneDistance(frustum.planes[p], node.bounds);
+        outside = d.x + d.y < 0;
+        planeMask &= d.x - d.y >= 0 ? ~(1u << p) : ~0u;
+      }
+    }
+    if (outside)
+    {
+      continue;
+    }
+    if (planeMask == 0)
+    {
+      CollectSubtree(nodeIndex, out);
+      continue;
+    }
+
+    if (node.count > 0)
+    {
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      {
+        bool inside = true;
+        for (uint32_t p = 0; p < 6 && inside; p++)
+        {
+          if (planeMask & (1u << p))
+          {
+            const glm::vec2 d = PlaneDistance(frustum.planes[p], boxes_[items_[i]]);
+            inside = d.x + d.y >= 0;
+          }
+        }
+        if (inside)
+        {
+          out.push_back(items_[i]);
+        }
+      }
+    }
+    else
+    {
+      stack.push_back({ node.leftFirst, planeMask });
+      stack.push_back({ node.leftFirst + 1, planeMask });
+    }
+  }
+}
+
+void BVH::QueryRay(glm::vec3 origin, glm::vec3 dir, float maxT, std::vector<uint32_t>& out) const
+{
+  if (nodes_.empty())
+  {
+    return;
+  }
+
+  const glm::vec3 invDir = 1.0f / dir;
+  const auto hits = [&](const AABB& box)
+  {
+    const glm::vec3 t0 = (box.min - origin) * invDir;
+    const glm::vec3 t1 = (box.max - origin) * invDir;
+    const glm::vec3 tMin = glm::min(t0, t1);
+    const glm::vec3 tMax = glm::max(t0, t1);
+    const float enter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+    const float exit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxT));
+    return enter <= exit;
+  };
+
+  std::vector<uint32_t> stack = { 0 };
+  while (!stack.empty())
+  {
+    const Node& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!hits(node.bounds))
+    {
+      continue;
+    }
+    if (node.count > 0)
+    {
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      {
+        if (hits(boxes_[items_[i]]))
+        {
+          out.push_back(items_[i]);
+        }
+      }
+    }
+    else
+    {
+      stack.push_back(node.leftFirst);
+      stack.push_back(node.leftFirst + 1);
+    }
+  }
+}
+
+void BVH::QuerySphere(glm::vec3 center, float radius, std::vector<uint32_t>& out) const
+{
+  if (nodes_.empty())
+  {
+    return;
+  }
+
+  const auto overlaps = [&](const AABB& box)
+  {
+    const glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    const glm::vec3 d = closest - center;
+    return glm::dot(d, d) <= radius * radius;
+  };
+
+  std::vector<uint32_t> stack = { 0 };
+  while (!stack.empty())
+  {
+    const Node& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!overlaps(node.bounds))
+    {
+      continue;
+    }
+    if (node.count > 0)
+    {
+      for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+      {
+        if (overlaps(boxes_[items_[i]]))
+        {
+          out.push_back(items_[i]);
+        }
+      }
+    }
+    else
+    {
+      stack.push_back(node.leftFirst);
+      stack.push_back(node.leftFirst + 1);
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,272 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <emmintrin.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+export module Culling;
+
+import Utilities;
+
+// planes are (normal, d) with the normal pointing inwards, so a point p is inside when dot(normal, p) + d >= 0
+export struct Frustum
+{
+  std::array<glm::vec4, 6> planes; // left, right, bottom, top, near, far
+};
+
+// extracts the frustum planes of a (GL, -w <= z <= w) view-projection matrix
+export Frustum MakeFrustum(const glm::mat4& viewProj);
+
+// volume of the shadow casters that can shadow something the camera sees, for an orthographic light.
+// Its sides are the light's, shrunk to the camera frustum's footprint in light space. There is no near
+// plane, so casters between the light and its near plane are kept (draw them with depth clamping),
+// and the far plane is moved up to the farthest visible point, as nothing behind it can cast onto the view
+export Frustum MakeShadowCasterFrustum(const glm::mat4& lightViewProj, const glm::mat4& cameraViewProj);
+
+// world space boxes as centers and half extents, one array per component so four boxes
+// can be loaded into SSE registers at a time. Arrays are padded to a multiple of 4
+export class BoundsSoA
+{
+public:
+  void Clear();
+  void Add(glm::vec3 center, glm::vec3 extent);
+
+  // the box min/max transformed by model and re-fitted around the result
+  void Add(const glm::mat4& model, glm::vec3 boundsMin, glm::vec3 boundsMax);
+
+  size_t Size() const { return size_; }
+  size_t PaddedSize() const { return center_[0].size(); }
+  const float* Centers(int axis) const { return center_[axis].data(); }
+  const float* Extents(int axis) const { return extent_[axis].data(); }
+
+private:
+
+  std::array<std::vector<float>, 3> center_;
+  std::array<std::vector<float>, 3> extent_;
+  size_t size_{};
+};
+
+// writes 1 to visible[i * stride] if box i intersects the frustum and 0 otherwise. With a stride of
+// sizeof(DrawElementsIndirectCommand) / 4 this writes straight into the commands' instanceCount.
+// Conservative: boxes near a frustum corner may pass although they're outside
+export void CullBoxes(const Frustum& frustum, const BoundsSoA& bounds, uint32_t* visible, size_t stride = 1);
+
+// reference version of CullBoxes
+export void CullBoxesScalar(const Frustum& frustum, const BoundsSoA& bounds, uint32_t* visible, size_t stride = 1);
+
+export struct CullingBenchmark
+{
+  size_t numBoxes{};
+  size_t numVisible{};
+  double simdTime{}; // seconds, best of several runs
+  double scalarTime{};
+};
+
+// culls numBoxes random boxes scattered around a 90 degree camera with both versions
+export CullingBenchmark BenchmarkCulling(size_t numBoxes);
+
+Frustum MakeFrustum(const glm::mat4& viewProj)
+{
+  // rows of the matrix (glm is column major)
+  const glm::mat4 m = glm::transpose(viewProj);
+  Frustum frustum
+  {
+    .planes =
+    {
+      m[3] + m[0],
+      m[3] - m[0],
+      m[3] + m[1],
+      m[3] - m[1],
+      m[3] + m[2],
+      m[3] - m[2],
+    }
+  };
+  for (auto& plane : frustum.planes)
+  {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
+Frustum MakeShadowCasterFrustum(const glm::mat4& lightViewProj, const glm::mat4& cameraViewProj)
+{
+  // camera frustum corners in the light's NDC (w is 1 for an orthographic light)
+  const glm::mat4 cameraToLight = lightViewProj * glm::inverse(cameraViewProj);
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(std::numeric_limits<float>::lowest());
+  for (int c = 0; c < 8; c++)
+  {
+    const glm::vec4 ndc((c & 1) ? 1.0f : -1.0f, (c & 2) ? 1.0f : -1.0f, (c & 4) ? 1.0f : -1.0f, 1.0f);
+    const glm::vec4 clip = cameraToLight * ndc;
+    const glm::vec3 corner = glm::vec3(clip) / clip.w;
+    lo = glm::min(lo, corner);
+    hi = glm::max(hi, corner);
+  }
+  lo = glm::max(lo, glm::vec3(-1.0f));
+  hi = glm::min(hi, glm::vec3(1.0f));
+
+  // x >= lo.x is dot(row0 - lo.x * row3, p) >= 0, and so on
+  const glm::mat4 m = glm::transpose(lightViewProj);
+  Frustum frustum
+  {
+    .planes =
+    {
+      m[0] - lo.x * m[3],
+      hi.x * m[3] - m[0],
+      m[1] - lo.y * m[3],
+      hi.y * m[3] - m[1],
+      glm::vec4(0, 0, 0, 1), // never rejects
+      hi.z * m[3] - m[2],
+    }
+  };
+  for (auto& plane : frustum.planes)
+  {
+    if (const float length = glm::length(glm::vec3(plane)); length > 0)
+    {
+      plane /= length;
+    }
+  }
+  return frustum;
+}
+
+void BoundsSoA::Clear()
+{
+  for (size_t c = 0; c < 3; c++)
+  {
+    center_[c].clear();
+    extent_[c].clear();
+  }
+  size_ = 0;
+}
+
+void BoundsSoA::Add(glm::vec3 center, glm::vec3 extent)
+{
+  // padding is tested along with the last real boxes, but its result is never written
+  if (size_ % 4 == 0)
+  {
+    for (size_t c = 0; c < 3; c++)
+    {
+      center_[c].resize(size_ + 4, 0.0f);
+      extent_[c].resize(size_ + 4, 0.0f);
+    }
+  }
+  for (int c = 0; c < 3; c++)
+  {
+    center_[c][size_] = center[c];
+    extent_[c][size_] = extent[c];
+  }
+  size_++;
+}
+
+void BoundsSoA::Add(const glm::mat4& model, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+  // extent of the transformed box is |M| * extent (Arvo)
+  const glm::vec3 center = model * glm::vec4((boundsMin + boundsMax) * .5f, 1.0f);
+  const glm::mat3 absModel(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+  Add(center, absModel * ((boundsMax - boundsMin) * .5f));
+}
+
+void CullBoxes(const Frustum& frustum, const BoundsSoA& bounds, uint32_t* visible, size_t stride)
+{
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  std::array<std::array<__m128, 4>, 6> planes; // normal xyz, d
+  std::array<std::array<__m128, 3>, 6> absNormals;
+  for (size_t p = 0; p < 6; p++)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      planes[p][c] = _mm_set1_ps(frustum.planes[p][c]);
+    }
+    for (int c = 0; c < 3; c++)
+    {
+      absNormals[p][c] = _mm_andnot_ps(signMask, planes[p][c]);
+    }
+  }
+
+  const size_t padded = bounds.PaddedSize();
+  for (size_t i = 0; i < padded; i += 4)
+  {
+    const __m128 cx = _mm_loadu_ps(bounds.Centers(0) + i);
+    const __m128 cy = _mm_loadu_ps(bounds.Centers(1) + i);
+    const __m128 cz = _mm_loadu_ps(bounds.Centers(2) + i);
+    const __m128 ex = _mm_loadu_ps(bounds.Extents(0) + i);
+    const __m128 ey = _mm_loadu_ps(bounds.Extents(1) + i);
+    const __m128 ez = _mm_loadu_ps(bounds.Extents(2) + i);
+
+    // a box is outside a plane if its center is further behind it than its projected radius
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (size_t p = 0; p < 6; p++)
+    {
+      const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, planes[p][0]), _mm_mul_ps(cy, planes[p][1])),
+        _mm_add_ps(_mm_mul_ps(cz, planes[p][2]), planes[p][3]));
+      const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, absNormals[p][0]), _mm_mul_ps(ey, absNormals[p][1])),
+        _mm_mul_ps(ez, absNormals[p][2]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), _mm_setzero_ps()));
+    }
+
+    const int mask = _mm_movemask_ps(inside);
+    const size_t count = std::min<size_t>(4, bounds.Size() - i);
+    for (size_t k = 0; k < count; k++)
+    {
+      visible[(i + k) * stride] = (mask >> k) & 1;
+    }
+  }
+}
+
+void CullBoxesScalar(const Frustum& frustum, const BoundsSoA& bounds, uint32_t* visible, size_t stride)
+{
+  for (size_t i = 0; i < bounds.Size(); i++)
+  {
+    const glm::vec3 center(bounds.Centers(0)[i], bounds.Centers(1)[i], bounds.Centers(2)[i]);
+    const glm::vec3 extent(bounds.Extents(0)[i], bounds.Extents(1)[i], bounds.Extents(2)[i]);
+    bool inside = true;
+    for (const auto& plane : frustum.planes)
+    {
+      const glm::vec3 normal(plane);
+      inside &= glm::dot(normal, center) + plane.w + glm::dot(glm::abs(normal), extent) >= 0.0f;
+    }
+    visible[i * stride] = inside;
+  }
+}
+
+CullingBenchmark BenchmarkCulling(size_t numBoxes)
+{
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+  BoundsSoA bounds;
+  for (size_t i = 0; i < numBoxes; i++)
+  {
+    bounds.Add({ position(rng), position(rng), position(rng) }, { size(rng), size(rng), size(rng) });
+  }
+
+  const glm::mat4 view = glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+  const glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.3f, 300.0f);
+  const Frustum frustum = MakeFrustum(proj * view);
+
+  CullingBenchmark result{ .numBoxes = numBoxes, .simdTime = std::numeric_limits<double>::max(), .scalarTime = std::numeric_limits<double>::max() };
+  std::vector<uint32_t> visible(numBoxes);
+  for (int run = 0; run < 10; run++)
+  {
+    Timer timer;
+    CullBoxesScalar(frustum, bounds, visible.data());
+    result.scalarTime = std::min(result.scalarTime, timer.elapsed());
+
+    timer.reset();
+    CullBoxes(frustum, bounds, visible.data());
+    result.simdTime = std::min(result.simdTime, timer.elapsed());
+  }
+
+  for (uint32_t v : visible)
+  {
+    result.numVisible += v;
+  }
+  return result;
+}
\ No newline at end of file
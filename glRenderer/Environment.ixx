@@ -0,0 +1,185 @@
+module;
+
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+export module Environment;
+
+import GPU.Texture;
+import GPU.StaticBuffer;
+import SphericalHarmonics;
+import Utilities;
+
+// image based lighting from one HDRI. The equirectangular image is converted to a cubemap on
+// load and then dropped. The skybox samples the cubemap directly, diffuse lighting uses its
+// SH9 irradiance and specular lighting a GGX prefiltered copy (split sum)
+export class Environment
+{
+public:
+  static constexpr int PREFILTERED_LEVELS = 6; // roughness 0, .2, ..., 1
+  static constexpr GLint MAX_CUBE_SIZE = 1024;
+
+  // projectSHOnGPU picks between the compute and the (SIMD, multithreaded) CPU projection
+  Environment(const std::string& path, bool projectSHOnGPU);
+  ~Environment();
+
+  Environment(const Environment&) = delete;
+  Environment& operator=(const Environment&) = delete;
+
+  GLuint GetCubemap() const { return cubemap_; }
+  GLuint GetPrefiltered() const { return prefiltered_; }
+  StaticBuffer& GetIrradianceSH() { return *irradianceSH_; } // 9 vec4s, irradiance / pi
+  double GetSHProjectionTime() const { return shProjectionTime_; } // seconds
+
+private:
+  GLuint cubemap_{};
+  GLuint prefiltered_{};
+  std::unique_ptr<StaticBuffer> irradianceSH_;
+  double shProjectionTime_{};
+};
+
+namespace
+{
+  GLuint CreateCubemap(GLint faceSize, GLint levels)
+  {
+    GLuint tex{};
+    glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &tex);
+    glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(tex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(tex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(tex, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTextureStorage2D(tex, levels, GL_RGBA16F, faceSize, faceSize);
+    return tex;
+  }
+
+  void ConvertEquirectToCube(GLuint equirect, GLuint cube, GLint faceSize)
+  {
+    auto& shader = Shader::shaders["equirect_to_cube"];
+    shader->Bind();
+    shader->SetInt("u_equirect", 0);
+    shader->SetInt("u_outCube", 0);
+    glBindTextureUnit(0, equirect);
+    glBindImageTexture(0, cube, 0, true, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute((faceSize + 7) / 8, (faceSize + 7) / 8, 6);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+  }
+
+  // writes SH9 irradiance (see RadianceToIrradianceSH9) to outBuffer. Low frequencies are all
+  // that's kept, so a mip with faces of at most 128 texels is projected instead of the full cubemap
+  void ProjectIrradianceSH9(GLuint cube, GLint faceSize, GLint levels, GLuint outBuffer)
+  {
+    GLint lod = 0;
+    while ((faceSize >> lod) > 128 && lod + 1 < levels)
+    {
+      lod++;
+    }
+    const GLint lodSize = std::max(faceSize >> lod, 1);
+
+    const int X_SIZE = 8;
+    const int Y_SIZE = 8;
+    const int xgroups = (lodSize + X_SIZE - 1) / X_SIZE;
+    const int ygroups = (lodSize + Y_SIZE - 1) / Y_SIZE;
+    const GLuint numPartials = xgroups * ygroups * 6;
+
+    GLuint partials{};
+    glCreateBuffers(1, &partials);
+    glNamedBufferStorage(partials, numPartials * sizeof(SH9), nullptr, 0);
+
+    auto& project = Shader::shaders["sh_project"];
+    project->Bind();
+    project->SetInt("u_environment", 0);
+    project->SetInt("u_lod", lod);
+    glBindTextureUnit(0, cube);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, partials);
+    glDispatchCompute(xgroups, ygroups, 6);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    auto& reduce = Shader::shaders["sh_reduce"];
+    reduce->Bind();
+    reduce->SetUInt("u_numPartials", numPartials);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, outBuffer);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glDeleteBuffers(1, &partials);
+  }
+
+  // mip i of prefiltered holds the environment convolved with a GGX lobe of roughness i / (levels - 1)
+  void PrefilterEnvironment(GLuint cube, GLuint prefiltered, GLint faceSize, GLint levels, GLuint samples)
+  {
+    auto& shader = Shader::shaders["prefilter_env"];
+    shader->Bind();
+    shader->SetInt("u_environment", 0);
+    shader->SetUInt("u_samples", samples);
+    shader->SetInt("u_outTex", 0);
+    glBindTextureUnit(0, cube);
+
+    for (GLint i = 0; i < levels; i++)
+    {
+      const GLint levelSize = std::max(faceSize >> i, 1);
+      shader->SetFloat("u_roughness", levels > 1 ? float(i) / (levels - 1) : 0.0f);
+      glBindImageTexture(0, prefiltered, i, true, 0, GL_WRITE_ONLY, GL_RGBA16F);
+      glDispatchCompute((levelSize + 7) / 8, (levelSize + 7) / 8, 6);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
+}
+
+Environment::Environment(const std::string& path, bool projectSHOnGPU)
+{
+  TextureCreateInfo info
+  {
+    .path = path,
+    .sRGB = false,
+    .generateMips = false,
+    .HDR = true,
+    .minFilter = GL_LINEAR,
+    .magFilter = GL_LINEAR,
+  };
+  auto data = LoadTextureDataAsync(info).get();
+
+  Timer shTimer;
+  irradianceSH_ = std::make_unique<StaticBuffer>(nullptr, sizeof(SH9), GL_DYNAMIC_STORAGE_BIT);
+  if (!projectSHOnGPU)
+  {
+    const SH9 sh = RadianceToIrradianceSH9(ProjectEquirectSH9(reinterpret_cast<const float*>(data.pixels.data()), data.dim));
+    irradianceSH_->SubData(sh.data(), sizeof(SH9), 0);
+  }
+  double shTime = shTimer.elapsed();
+
+  // a quarter of the equirect's width keeps about the same texel density at the equator
+  const GLint faceSize = std::clamp(data.dim.x / 4, 1, MAX_CUBE_SIZE);
+  const GLint levels = static_cast<GLint>(std::floor(std::log2(static_cast<float>(faceSize)))) + 1;
+  {
+    Texture2D equirect(info, std::move(data));
+    cubemap_ = CreateCubemap(faceSize, levels);
+    ConvertEquirectToCube(equirect.GetID(), cubemap_, faceSize);
+    glGenerateTextureMipmap(cubemap_);
+  }
+
+  if (projectSHOnGPU)
+  {
+    shTimer.reset();
+    ProjectIrradianceSH9(cubemap_, faceSize, levels, irradianceSH_->ID());
+    glFinish(); // only for the timing below, this happens once per load
+    shTime = shTimer.elapsed();
+  }
+  shProjectionTime_ = shTime;
+
+  // the roughest level still needs a few texels per face
+  const GLint prefilteredSize = std::max(std::min(faceSize, 512), 1 << (PREFILTERED_LEVELS - 1));
+  prefiltered_ = CreateCubemap(prefilteredSize, PREFILTERED_LEVELS);
+  PrefilterEnvironment(cubemap_, prefiltered_, prefilteredSize, PREFILTERED_LEVELS, 256);
+}
+
+Environment::~Environment()
+{
+  glDeleteTextures(1, &cubemap_);
+  glDeleteTextures(1, &prefiltered_);
+}
\ No newline at end of file
@@ -1,5 +1,8 @@
 module;
 
+#include <array>
+#include <cstdint>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -50,4 +53,61 @@ export glm::mat4 MakeLightMatrix(const DirLight& light, glm::vec3 eye, glm::vec2
     -dim.x / 2, dim.x / 2, -dim.y / 2, dim.y / 2,
     depthRange.x, depthRange.y);
   return lightProj * lightView;
+}
+
+export constexpr int MAX_SHADOW_CASCADES = 4;
+
+// far distance of each of count slices of [near, far]. lambda blends logarithmic (1) and uniform (0)
+// splits, pure logarithmic splits make the first slices too thin to be useful
+export std::array<float, MAX_SHADOW_CASCADES> SplitCascades(float near, float far, int count, float lambda)
+{
+  std::array<float, MAX_SHADOW_CASCADES> splits{};
+  for (int i = 0; i < count; i++)
+  {
+    const float t = float(i + 1) / count;
+    const float logSplit = near * std::pow(far / near, t);
+    const float uniformSplit = near + (far - near) * t;
+    splits[i] = lambda * logSplit + (1 - lambda) * uniformSplit;
+  }
+  return splits;
+}
+
+// orthographic light matrix covering a sphere. The center is snapped to whole shadow texels so
+// edges don't shimmer as it moves. Depth only spans the sphere, casters in front of it are expected
+// to be drawn with depth clamping
+export glm::mat4 MakeCascadeMatrix(const DirLight& light, glm::vec3 center, float radius, uint32_t resolution)
+{
+  const glm::vec3 up = glm::abs(light.direction.y) > .99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+  const glm::mat4 lightRotation = glm::lookAt(glm::vec3(0), light.direction, up);
+  const float texelSize = 2 * radius / resolution;
+  glm::vec3 lightCenter = lightRotation * glm::vec4(center, 1.0f);
+  lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+  lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+  center = glm::inverse(lightRotation) * glm::vec4(lightCenter, 1.0f);
+
+  const glm::mat4 lightView = glm::lookAt(center - light.direction * radius, center, up);
+  const glm::mat4 lightProj = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2 * radius);
+  return lightProj * lightView;
+}
+
+// orthographic light matrix covering the frustum of sliceViewProj (a slice of the camera frustum).
+// The box is fit to the slice's bounding sphere, so it keeps its size as the camera turns
+export glm::mat4 MakeCascadeMatrix(const DirLight& light, const glm::mat4& sliceViewProj, uint32_t resolution)
+{
+  const glm::mat4 invViewProj = glm::inverse(sliceViewProj);
+  std::array<glm::vec3, 8> corners;
+  glm::vec3 center(0);
+  for (int c = 0; c < 8; c++)
+  {
+    const glm::vec4 world = invViewProj * glm::vec4((c & 1) ? 1.0f : -1.0f, (c & 2) ? 1.0f : -1.0f, (c & 4) ? 1.0f : -1.0f, 1.0f);
+    corners[c] = glm::vec3(world) / world.w;
+    center += corners[c] / 8.0f;
+  }
+  float radius = 0;
+  for (const auto& corner : corners)
+  {
+    radius = glm::max(radius, glm::distance(corner, center));
+  }
+  radius = std::ceil(radius * 16.0f) / 16.0f;
+  return MakeCascadeMatrix(light, center, radius, resolution);
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+module;
+
+#include <array>
+#include <vector>
+#include <span>
+#include <future>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <bit>
+#include <xmmintrin.h>
+#include <glm/glm.hpp>
+
+export module LightClusters;
+
+import ThreadPool;
+
+// froxel grid for clustered shading: screen tiles times depth slices spaced exponentially between
+// the camera's near and far planes. Matches clusters.h
+export constexpr int CLUSTER_TILES_X = 16;
+export constexpr int CLUSTER_TILES_Y = 9;
+export constexpr int CLUSTER_SLICES = 24;
+export constexpr int NUM_CLUSTERS = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+export constexpr uint32_t MAX_CLUSTER_LIGHT_INDICES = 1 << 26; // the index buffer grows up to this, entries past it are dropped
+
+export constexpr int ClusterIndex(int x, int y, int slice) { return x + CLUSTER_TILES_X * (y + CLUSTER_TILES_Y * slice); }
+
+// the lights of cluster c are indices[ranges[c].x, ranges[c].x + ranges[c].y), as built by cluster_lights.cs
+export struct LightClusterLists
+{
+  std::vector<glm::uvec2> ranges; // offset, count
+  std::vector<uint32_t> indices;
+  uint32_t dropped{}; // entries past MAX_CLUSTER_LIGHT_INDICES
+};
+
+// bins lights (world space position, radius) into the froxels of a symmetric perspective camera.
+// Lights are split across the thread pool, each light's froxels are found by testing its sphere
+// against the view space boxes of four tiles at a time
+export void BuildLightClusters(std::span<const glm::vec4> spheres, const glm::mat4& view, const glm::mat4& proj,
+  float near, float far, LightClusterLists& out);
+
+namespace
+{
+  int SliceOfDepth(float depth, float near, float far)
+  {
+    const int slice = static_cast<int>(std::floor(std::log(depth / near) / std::log(far / near) * CLUSTER_SLICES));
+    return std::clamp(slice, 0, CLUSTER_SLICES - 1);
+  }
+
+  // view space boxes of the froxels. Tile edges are planes through the eye, so a tile's x range within
+  // a slice is spanned by its edges at the slice's near and far depth
+  struct FroxelBounds
+  {
+    std::array<float, CLUSTER_SLICES + 1> sliceDepth; // positive
+    alignas(16) std::array<std::array<float, CLUSTER_TILES_X>, CLUSTER_SLICES> minX, maxX;
+    std::array<std::array<float, CLUSTER_TILES_Y>, CLUSTER_SLICES> minY, maxY;
+  };
+
+  static_assert(CLUSTER_TILES_X % 4 == 0);
+
+  FroxelBounds MakeFroxelBounds(const glm::mat4& proj, float near, float far)
+  {
+    FroxelBounds bounds;
+    for (int s = 0; s <= CLUSTER_SLICES; s++)
+    {
+      bounds.sliceDepth[s] = near * std::pow(far / near, float(s) / CLUSTER_SLICES);
+    }
+    for (int s = 0; s < CLUSTER_SLICES; s++)
+    {
+      const float d0 = bounds.sliceDepth[s];
+      const float d1 = bounds.sliceDepth[s + 1];
+      for (int x = 0; x < CLUSTER_TILES_X; x++)
+      {
+        const float ndc0 = float(x) / CLUSTER_TILES_X * 2 - 1;
+        const float ndc1 = float(x + 1) / CLUSTER_TILES_X * 2 - 1;
+        bounds.minX[s][x] = std::min(ndc0 * d0, ndc0 * d1) / proj[0][0];
+        bounds.maxX[s][x] = std::max(ndc1 * d0, ndc1 * d1) / proj[0][0];
+      }
+      for (int y = 0; y < CLUSTER_TILES_Y; y++)
+      {
+        const float ndc0 = float(y) / CLUSTER_TILES_Y * 2 - 1;
+        const float ndc1 = float(y + 1) / CLUSTER_TILES_Y * 2 - 1;
+        bounds.minY[s][y] = std::min(ndc0 * d0, ndc0 * d1) / proj[1][1];
+        bounds.maxY[s][y] = std::max(ndc1 * d0, ndc1 * d1) / proj[1][1];
+      }
+    }
+    return bounds;
+  }
+
+  // appends (cluster, light) for every froxel light touches
+  void BinLight(glm::vec3 center, float radius, uint32_t light, const FroxelBounds& bounds, const glm::mat4& proj,
+    float near, float far, std::vector<std::pair<uint32_t, uint32_t>>& entries)
+  {
+    // positive depths of the sphere's front and back
+    const float front = std::max(-center.z - radius, near);
+    const float back = std::min(-center.z + radius, far);
+    if (front > back)
+    {
+      return;
+    }
+
+    // screen rect of the sphere's view space box, x / depth is extreme at the box's corners
+    auto tileRange = [&](float c, float scale, int tiles, int& first, int& last)
+    {
+      const float lo = std::min((c - radius) / front, (c - radius) / back) * scale;
+      const float hi = std::max((c + radius) / front, (c + radius) / back) * scale;
+      first = std::clamp(static_cast<int>(std::floor((lo * .5f + .5f) * tiles)), 0, tiles - 1);
+      last = std::clamp(static_cast<int>(std::floor((hi * .5f + .5f) * tiles)), 0, tiles - 1);
+      return lo <= 1.0f && hi >= -1.0f;
+    };
+    int x0, x1, y0, y1;
+    if (!tileRange(center.x, proj[0][0], CLUSTER_TILES_X, x0, x1) || !tileRange(center.y, proj[1][1], CLUSTER_TILES_Y, y0, y1))
+    {
+      return;
+    }
+
+    const __m128 cx = _mm_set1_ps(center.x);
+    const __m128 r2 = _mm_set1_ps(radius * radius);
+    const __m128 zero = _mm_setzero_ps();
+    for (int s = SliceOfDepth(front, near, far); s <= SliceOfDepth(back, near, far); s++)
+    {
+      const float dz = std::max({ bounds.sliceDepth[s] + center.z, -center.z - bounds.sliceDepth[s + 1], 0.0f });
+      for (int y = y0; y <= y1; y++)
+      {
+        const float dy = std::max({ bounds.minY[s][y] - center.y, center.y - bounds.maxY[s][y], 0.0f });
+        const __m128 dyz2 = _mm_set1_ps(dy * dy + dz * dz);
+        for (int x = x0 & ~3; x <= x1; x += 4)
+        {
+          // squared distance from the sphere's center to four tiles' boxes
+          const __m128 below = _mm_sub_ps(_mm_load_ps(&bounds.minX[s][x]), cx);
+          const __m128 above = _mm_sub_ps(cx, _mm_load_ps(&bounds.maxX[s][x]));
+          const __m128 dx = _mm_max_ps(_mm_max_ps(below, above), zero);
+          const __m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), dyz2);
+          int mask = _mm_movemask_ps(_mm_cmple_ps(dist2, r2));
+          while (mask)
+          {
+            const int lane = std::countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+            if (x + lane >= x0 && x + lane <= x1)
+            {
+              entries.push_back({ static_cast<uint32_t>(ClusterIndex(x + lane, y, s)), light });
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void BuildLightClusters(std::span<const glm::vec4> spheres, const glm::mat4& view, const glm::mat4& proj,
+  float near, float far, LightClusterLists& out)
+{
+  const FroxelBounds bounds = MakeFroxelBounds(proj, near, far);
+
+  using Entries = std::vector<std::pair<uint32_t, uint32_t>>;
+  auto& pool = ThreadPool::Get();
+  const size_t numJobs = std::clamp<size_t>(spheres.size() / 1024, 1, pool.NumThreads() * 4);
+  std::vector<std::future<Entries>> jobs;
+  for (size_t job = 0; job < numJobs; job++)
+  {
+    const size_t first = spheres.size() * job / numJobs;
+    const size_t last = spheres.size() * (job + 1) / numJobs;
+    jobs.push_back(pool.Submit([=, &bounds, &view, &proj]
+      {
+        Entries entries;
+        for (size_t i = first; i < last; i++)
+        {
+          const glm::vec3 center = view * glm::vec4(glm::vec3(spheres[i]), 1.0f);
+          BinLight(center, spheres[i].w, static_cast<uint32_t>(i), bounds, proj, near, far, entries);
+        }
+        return entries;
+      }));
+  }
+  std::vector<Entries> results;
+  for (auto& job : jobs)
+  {
+    results.push_back(job.get());
+  }
+
+  // counting sort by cluster, lights stay in index order within a cluster
+  out.ranges.assign(NUM_CLUSTERS, glm::uvec2(0));
+  for (const auto& entries : results)
+  {
+    for (const auto& [cluster, light] : entries)
+    {
+      out.ranges[cluster].y++;
+    }
+  }
+  uint32_t offset = 0;
+  for (auto& range : out.ranges)
+  {
+    range.x = offset;
+    offset += range.y;
+    range.y = 0;
+  }
+  out.indices.resize(std::min(offset, MAX_CLUSTER_LIGHT_INDICES));
+  out.dropped = offset - static_cast<uint32_t>(out.indices.size());
+  for (const auto& entries : results)
+  {
+    for (const auto& [cluster, light] : entries)
+    {
+      const uint32_t index = out.ranges[cluster].x + out.ranges[cluster].y++;
+      if (index < MAX_CLUSTER_LIGHT_INDICES)
+      {
+        out.indices[index] = light;
+      }
+    }
+  }
+}
\ No newline at end of file
@@ -3,27 +3,29 @@ module;
 #include <unordered_map>
 #include <optional>
 #include <string>
+#include <vector>
+#include <memory>
 #include <glad/glad.h>
 
 export module Material;
 
 import GPU.Texture;
+import TextureCache;
 
 export struct Material
 {
-  Texture2D* albedoTex{};
-  Texture2D* roughnessTex{};
-  Texture2D* metalnessTex{};
-  Texture2D* normalTex{};
-  Texture2D* ambientOcclusionTex{};
+  // textures are shared between materials, null if the material doesn't have one
+  std::shared_ptr<Texture2D> albedoTex;
+  std::shared_ptr<Texture2D> roughnessMetalnessTex; // R = roughness, G = metalness
+  std::shared_ptr<Texture2D> normalTex;
+  std::shared_ptr<Texture2D> ambientOcclusionTex;
 };
 
 // sent to GPU
 export struct BindlessMaterial
 {
   uint64_t albedoHandle{};
-  uint64_t roughnessHandle{};
-  uint64_t metalnessHandle{};
+  uint64_t roughnessMetalnessHandle{};
   uint64_t normalHandle{};
   uint64_t ambientOcclusionHandle{};
 };
@@ -32,75 +34,129 @@ export class MaterialManager
 {
 public:
   MaterialManager() {}
-  ~MaterialManager();
   std::optional<Material> GetMaterial(const std::string& mat);
-  Material& MakeMaterial(std::string name,
+  std::optional<uint32_t> GetMaterialIndex(const std::string& mat) const;
+
+  // textures are decoded on the thread pool, the material's textures are
+  // empty until ResolvePendingMaterials or PollPendingMaterials uploads them.
+  // Only their low mips are uploaded at first, the rest are streamed in by the ResidencyManager.
+  // Roughness and metalness are baked into one two-channel texture.
+  // Returns the material's index, which stays valid until Clear
+  uint32_t MakeMaterial(std::string name,
     std::string albedoTexName,
     std::string roughnessTexName,
     std::string metalnessTexName,
     std::string normalTexName,
     std::string ambientOcclusionTexName);
-  std::vector<std::pair<std::string, Material>> GetLinearMaterials()
-  {
-    return { materials.begin(), materials.end() };
-  }
+
+  // waits for all outstanding decodes and uploads them (GL thread only)
+  void ResolvePendingMaterials();
+
+  // uploads textures that have finished decoding without blocking (GL thread only)
+  void PollPendingMaterials();
+  bool HasPendingTextures() const { return textureCache.NumPending() != 0; }
+
+  // drops all materials, textures are freed once nothing else references them. Texture files that
+  // were missing are looked for again
+  void Clear();
+
+  // materials in index order, new ones are always appended
+  const std::vector<Material>& GetMaterials() const { return materials; }
 
 private:
-  std::unordered_map<std::string, Material> materials;
+  std::vector<Material> materials;
+  std::unordered_map<std::string, uint32_t> materialIndices;
+  TextureCache textureCache;
+  TextureCreateInfo materialTexInfo
+  {
+    .sRGB = false,
+    .generateMips = true,
+    .HDR = false,
+    .minFilter = GL_LINEAR_MIPMAP_LINEAR,
+    .magFilter = GL_LINEAR,
+    .streamMips = true,
+  };
 };
 
-MaterialManager::~MaterialManager()
+std::optional<Material> MaterialManager::GetMaterial(const std::string& mat)
 {
-  for (auto& p : materials)
+  auto index = GetMaterialIndex(mat);
+  if (!index)
   {
-    delete p.second.albedoTex;
-    delete p.second.roughnessTex;
-    delete p.second.metalnessTex;
-    delete p.second.normalTex;
-    delete p.second.ambientOcclusionTex;
+    return std::optional<Material>();
   }
+  return materials[*index];
 }
 
-std::optional<Material> MaterialManager::GetMaterial(const std::string& mat)
+std::optional<uint32_t> MaterialManager::GetMaterialIndex(const std::string& mat) const
 {
-  auto it = materials.find(mat);
-  if (it == materials.end())
+  auto it = materialIndices.find(mat);
+  if (it == materialIndices.end())
   {
-    return std::optional<Material>();
+    return std::nullopt;
   }
   return it->second;
 }
 
-Material& MaterialManager::MakeMaterial(std::string name,
+uint32_t MaterialManager::MakeMaterial(std::string name,
   std::string albedoTexName,
   std::string roughnessTexName,
   std::string metalnessTexName,
   std::string normalTexName,
   std::string ambientOcclusionTexName)
 {
-  if (auto it = materials.find(name); it != materials.end())
+  if (auto it = materialIndices.find(name); it != materialIndices.end())
   {
     return it->second;
   }
 
-  TextureCreateInfo info;
-  info.generateMips = true;
-  info.HDR = false;
-  info.minFilter = GL_LINEAR_MIPMAP_LINEAR;
-  info.magFilter = GL_LINEAR;
-  info.sRGB = false;
-
-  Material material;
-  info.path = albedoTexName;
-  material.albedoTex = new Texture2D(info);
-  info.path = roughnessTexName;
-  material.roughnessTex = new Texture2D(info);
-  info.path = metalnessTexName;
-  material.metalnessTex = new Texture2D(info);
-  info.path = normalTexName;
-  material.normalTex = new Texture2D(info);
-  info.path = ambientOcclusionTexName;
-  material.ambientOcclusionTex = new Texture2D(info);
-  auto p = materials.insert({ name, material });
-  return p.first->second;
+  auto acquire = [this](std::string path, TextureCompression compression)
+  {
+    TextureCreateInfo info = materialTexInfo;
+    info.path = std::move(path);
+    info.compression = compression;
+    info.normalMap = compression == TextureCompression::BC5;
+    return textureCache.Acquire(info);
+  };
+
+  // each map contributes its red channel, a missing map gets the same default the shader
+  // uses when there's no texture at all. BC5 keeps the two channels independent, a three
+  // channel BC1 would make them share endpoints and bleed into each other
+  TextureCreateInfo roughnessMetalnessInfo = materialTexInfo;
+  roughnessMetalnessInfo.compression = TextureCompression::BC5;
+  ChannelPackInfo roughnessMetalnessPack
+  {
+    .paths = { std::move(roughnessTexName), std::move(metalnessTexName), "" },
+    .fallback = { 255, 0, 0 },
+  };
+
+  // the shader only reads the normal's xy and AO's red channel
+  Material material
+  {
+    .albedoTex = acquire(std::move(albedoTexName), TextureCompression::BC1),
+    .roughnessMetalnessTex = textureCache.AcquirePacked(roughnessMetalnessInfo, roughnessMetalnessPack),
+    .normalTex = acquire(std::move(normalTexName), TextureCompression::BC5),
+    .ambientOcclusionTex = acquire(std::move(ambientOcclusionTexName), TextureCompression::BC4),
+  };
+  const uint32_t index = static_cast<uint32_t>(materials.size());
+  materials.push_back(std::move(material));
+  materialIndices.emplace(std::move(name), index);
+  return index;
+}
+
+void MaterialManager::ResolvePendingMaterials()
+{
+  textureCache.ResolvePending();
+}
+
+void MaterialManager::PollPendingMaterials()
+{
+  textureCache.PollPending();
+}
+
+void MaterialManager::Clear()
+{
+  materials.clear();
+  materialIndices.clear();
+  textureCache.ForgetMissingPaths();
 }
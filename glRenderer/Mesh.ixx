@@ -100,6 +100,8 @@ export struct MeshInfo
   uint64_t indicesAllocHandle{};
   std::string materialName{};
   uint32_t materialIndex{};
+  glm::vec3 boundsMin{}; // object space AABB
+  glm::vec3 boundsMax{};
 };
 
 export struct MeshDescriptor
@@ -107,6 +109,7 @@ export struct MeshDescriptor
   std::vector<std::vector<Vertex>> vertices;
   std::vector<std::vector<uint32_t>> indices;
   std::vector<std::string> materials;
+  std::vector<uint32_t> materialIndices; // into the MaterialManager that loaded it
 };
 
 MeshDescriptor LoadObjBase(const std::string& path,
@@ -260,7 +263,7 @@ MeshDescriptor LoadObjBase(const std::string& path,
 
 
         //std::cout << "Creating material: " << prevName << std::endl;
-        materialManager.MakeMaterial(prevName, albedoName,
+        const uint32_t materialIndex = materialManager.MakeMaterial(prevName, albedoName,
           roughnessName, metalnessName, normalName, ambientOcclusionName);
 
         uint32_t currentVertexIndex = 0;
@@ -287,6 +290,7 @@ MeshDescriptor LoadObjBase(const std::string& path,
         meshDescriptor.vertices.emplace_back(std::move(vertices2));
         meshDescriptor.indices.emplace_back(std::move(indices));
         meshDescriptor.materials.emplace_back(std::move(prevName));
+        meshDescriptor.materialIndices.push_back(materialIndex);
 
         vertices.clear();
       }
@@ -305,16 +309,19 @@ export std::vector<Mesh> LoadObjMesh(const std::string& path,
   std::vector<Mesh> meshes;
 
   auto meshDesc = LoadObjBase(path, materialManager);
+  materialManager.ResolvePendingMaterials(); // meshes copy their materials
   for (size_t i = 0; i < meshDesc.materials.size(); i++)
   {
     meshes.emplace_back(meshDesc.vertices[i],
       meshDesc.indices[i],
-      *materialManager.GetMaterial(meshDesc.materials[i]));
+      materialManager.GetMaterials()[meshDesc.materialIndices[i]]);
   }
 
   return meshes;
 }
 
+// material textures are still decoding when this returns, they're uploaded
+// by MaterialManager::ResolvePendingMaterials or PollPendingMaterials
 export std::vector<MeshInfo> LoadObjBatch(const std::string& path,
   MaterialManager& materialManager,
   DynamicBuffer& vertexBuffer,
@@ -329,6 +336,13 @@ export std::vector<MeshInfo> LoadObjBatch(const std::string& path,
     info.verticesAllocHandle = vertexBuffer.Allocate(meshDesc.vertices[i].data(), sizeof(Vertex) * meshDesc.vertices[i].size());
     info.indicesAllocHandle = indexBuffer.Allocate(meshDesc.indices[i].data(), sizeof(uint32_t) * meshDesc.indices[i].size());
     info.materialName = meshDesc.materials[i];
+    info.materialIndex = meshDesc.materialIndices[i];
+    info.boundsMin = info.boundsMax = meshDesc.vertices[i].empty() ? glm::vec3(0) : meshDesc.vertices[i][0].position;
+    for (const auto& vertex : meshDesc.vertices[i])
+    {
+      info.boundsMin = glm::min(info.boundsMin, vertex.position);
+      info.boundsMax = glm::max(info.boundsMax, vertex.position);
+    }
     meshes.push_back(info);
   }
 
@@ -39,6 +39,7 @@ export struct ObjectBatched
 {
   Transform transform;
   std::vector<MeshInfo> meshes;
+  bool isStatic{ true }; // static objects never move, so their shadows can be cached
 };
 
 #pragma warning(disable : 4324; suppress : 4324)
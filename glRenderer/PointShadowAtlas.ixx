@@ -0,0 +1,247 @@
+module;
+
+#include <array>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+export module PointShadowAtlas;
+
+// view rotation of cube face i (+X, -X, +Y, -Y, +Z, -Z), looking down -z like any GL camera
+export glm::mat4 CubeFaceView(int face)
+{
+  static const std::array<glm::vec3, 6> dirs = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+  static const std::array<glm::vec3, 6> ups = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+  return glm::lookAt(glm::vec3(0), dirs[face], ups[face]);
+}
+
+// packs cube shadow maps of the most important point lights into one depth texture. The atlas is
+// split into NUM_SIZE_CLASSES bands of equal height, each with slots of one face size (halving from
+// LARGEST_FACE), and a slot holds the 6 faces as 3 x 2. The highest ranked lights get the largest
+// faces. A slot keeps its depth until its light or something within its radius moves, and
+// TakeUpdates hands out at most a budget of slots to redraw per frame. Ranking has hysteresis so
+// lights of similar importance don't trade slots, and the redraws that come with them, every frame
+export class PointShadowAtlas
+{
+public:
+  static constexpr int WIDTH = 3072;
+  static constexpr int HEIGHT = 4096;
+  static constexpr int NUM_SIZE_CLASSES = 4;
+  static constexpr int LARGEST_FACE = 512;
+  // a light holding a slot ranks as if this much more important per size class it is above no slot
+  static constexpr float HYSTERESIS = .25f;
+
+  struct Slot
+  {
+    glm::ivec2 origin{}; // texels, lower left of face 0
+    int faceSize{};
+    int sizeClass{};
+    int32_t light = -1;
+    glm::vec4 sphere{}; // light's position and radius
+    float importance{};
+    bool drawn = false; // holds the light's depth, possibly out of date
+    bool stale = true; // needs a redraw
+  };
+
+  PointShadowAtlas();
+
+  // gives slots to the maxLights lights of highest importance, lights of importance 0 never get one.
+  // spheres are (position, radius) of every light. Lights keep their slot while their size class stays,
+  // which takes another light HYSTERESIS more important to change
+  void Assign(std::span<const glm::vec4> spheres, std::span<const float> importance, int maxLights);
+
+  // marks the slots of lights whose sphere touches the box stale
+  void InvalidateBox(glm::vec3 boxMin, glm::vec3 boxMax);
+  void InvalidateAll();
+
+  // at most budget stale slots to redraw now, those never drawn first, then by importance.
+  // They count as drawn and up to date afterwards
+  std::vector<int> TakeUpdates(int budget);
+
+  // slot to sample for the light, -1 if it has none with its depth yet
+  int32_t SlotOfLight(uint32_t light) const;
+
+  const std::vector<Slot>& GetSlots() const { return slots_; }
+  size_t NumSlots() const { return slots_.size(); }
+  static glm::ivec2 FaceOrigin(const Slot& slot, int face) { return slot.origin + glm::ivec2(face % 3, face / 3) * slot.faceSize; }
+
+private:
+  void Release(int slot);
+
+  std::vector<Slot> slots_; // largest faces first
+  std::vector<int32_t> lightSlots_; // slot of each light, -1 if none
+};
+
+namespace
+{
+  bool SphereIntersectsBox(glm::vec4 sphere, glm::vec3 boxMin, glm::vec3 boxMax)
+  {
+    const glm::vec3 closest = glm::clamp(glm::vec3(sphere), boxMin, boxMax);
+    const glm::vec3 d = closest - glm::vec3(sphere);
+    return glm::dot(d, d) <= sphere.w * sphere.w;
+  }
+}
+
+PointShadowAtlas::PointShadowAtlas()
+{
+  const int bandHeight = HEIGHT / NUM_SIZE_CLASSES;
+  for (int sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; sizeClass++)
+  {
+    const int faceSize = LARGEST_FACE >> sizeClass;
+    for (int y = 0; y + 2 * faceSize <= bandHeight; y += 2 * faceSize)
+    {
+      for (int x = 0; x + 3 * faceSize <= WIDTH; x += 3 * faceSize)
+      {
+        slots_.push_back({ .origin = { x, sizeClass * bandHeight + y }, .faceSize = faceSize, .sizeClass = sizeClass });
+      }
+    }
+  }
+}
+
+void PointShadowAtlas::Release(int slot)
+{
+  if (slots_[slot].light >= 0)
+  {
+    lightSlots_[slots_[slot].light] = -1;
+  }
+  slots_[slot].light = -1;
+  slots_[slot].drawn = false;
+  slots_[slot].stale = true;
+}
+
+void PointShadowAtlas::Assign(std::span<const glm::vec4> spheres, std::span<const float> importance, int maxLights)
+{
+  // a different light list (e.g. a new scene) invalidates every assignment
+  if (lightSlots_.size() != spheres.size())
+  {
+    for (auto& slot : slots_)
+    {
+      slot.light = -1;
+      slot.drawn = false;
+      slot.stale = true;
+    }
+    lightSlots_.assign(spheres.size(), -1);
+  }
+
+  // the boost grows by a factor per size class, so moving up a class takes beating the lights
+  // holding it by HYSTERESIS
+  std::vector<uint32_t> ranked;
+  std::vector<float> score(importance.size());
+  for (uint32_t i = 0; i < importance.size(); i++)
+  {
+    if (importance[i] > 0)
+    {
+      ranked.push_back(i);
+      const int held = lightSlots_[i] >= 0 ? NUM_SIZE_CLASSES - slots_[lightSlots_[i]].sizeClass : 0;
+      score[i] = importance[i] * std::pow(1.0f + HYSTERESIS, float(held));
+    }
+  }
+  const size_t count = std::min({ ranked.size(), size_t(std::max(maxLights, 0)), slots_.size() });
+  std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(),
+    [&](uint32_t a, uint32_t b) { return score[a] > score[b]; });
+  ranked.resize(count);
+
+  // slots are ordered by size class, so the light of rank r wants the class of slot r
+  std::vector<int> wantedClass(spheres.size(), -1);
+  for (size_t rank = 0; rank < count; rank++)
+  {
+    wantedClass[ranked[rank]] = slots_[rank].sizeClass;
+  }
+
+  std::array<std::vector<int>, NUM_SIZE_CLASSES> freeSlots;
+  for (int s = 0; s < int(slots_.size()); s++)
+  {
+    auto& slot = slots_[s];
+    if (slot.light >= 0 && wantedClass[slot.light] != slot.sizeClass)
+    {
+      Release(s);
+    }
+    if (slot.light < 0)
+    {
+      freeSlots[slot.sizeClass].push_back(s);
+    }
+  }
+
+  for (uint32_t light : ranked)
+  {
+    if (lightSlots_[light] < 0)
+    {
+      auto& candidates = freeSlots[wantedClass[light]];
+      const int s = candidates.back();
+      candidates.pop_back();
+      slots_[s].light = light;
+      slots_[s].sphere = spheres[light];
+      lightSlots_[light] = s;
+    }
+
+    auto& slot = slots_[lightSlots_[light]];
+    if (slot.sphere != spheres[light])
+    {
+      slot.sphere = spheres[light];
+      slot.stale = true;
+    }
+    slot.importance = importance[light];
+  }
+}
+
+void PointShadowAtlas::InvalidateBox(glm::vec3 boxMin, glm::vec3 boxMax)
+{
+  for (auto& slot : slots_)
+  {
+    if (slot.light >= 0 && SphereIntersectsBox(slot.sphere, boxMin, boxMax))
+    {
+      slot.stale = true;
+    }
+  }
+}
+
+void PointShadowAtlas::InvalidateAll()
+{
+  for (auto& slot : slots_)
+  {
+    slot.stale = true;
+  }
+}
+
+std::vector<int> PointShadowAtlas::TakeUpdates(int budget)
+{
+  std::vector<int> updates;
+  for (int s = 0; s < int(slots_.size()); s++)
+  {
+    if (slots_[s].light >= 0 && slots_[s].stale)
+    {
+      updates.push_back(s);
+    }
+  }
+  const size_t count = std::min(updates.size(), size_t(std::max(budget, 0)));
+  std::partial_sort(updates.begin(), updates.begin() + count, updates.end(), [this](int a, int b)
+    {
+      if (slots_[a].drawn != slots_[b].drawn)
+      {
+        return !slots_[a].drawn;
+      }
+      return slots_[a].importance > slots_[b].importance;
+    });
+  updates.resize(count);
+
+  for (int s : updates)
+  {
+    slots_[s].drawn = true;
+    slots_[s].stale = false;
+  }
+  return updates;
+}
+
+int32_t PointShadowAtlas::SlotOfLight(uint32_t light) const
+{
+  if (light >= lightSlots_.size())
+  {
+    return -1;
+  }
+  const int32_t s = lightSlots_[light];
+  return s >= 0 && slots_[s].drawn ? s : -1;
+}
\ No newline at end of file
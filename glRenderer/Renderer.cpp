@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <algorithm>
+#include <bit>
 
 namespace fss = std::filesystem;
 
@@ -55,6 +56,7 @@ void Renderer::InitGL()
   glDebugMessageCallback(GLerrorCB, nullptr);
 
   glEnable(GL_MULTISAMPLE); // for shadows
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // environment cubemaps are filtered across faces
 
   glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &deviceAnisotropy);
 }
@@ -81,6 +83,7 @@ void Renderer::MainLoop()
     .magFilter = GL_LINEAR,
   };
   bluenoiseTex = std::make_unique<Texture2D>(createInfo);
+  textureResidency = std::make_unique<ResidencyManager>(size_t(textureBudgetMB) << 20);
   vertexBuffer = std::make_unique<DynamicBuffer>(sizeof(Vertex) * max_vertices, sizeof(Vertex));
   indexBuffer = std::make_unique<DynamicBuffer>(sizeof(uint32_t) * max_vertices, sizeof(uint32_t));
 
@@ -143,11 +146,15 @@ void Renderer::MainLoop()
       globalLight.direction = glm::normalize(globalLight.direction);
     }
 
-    for (int i = 1; i < batchedObjects.size(); i++)
+    for (auto& obj : batchedObjects)
     {
-      glm::vec3& tr = batchedObjects[i].transform.translation;
+      if (obj.isStatic)
+      {
+        continue;
+      }
+      glm::vec3& tr = obj.transform.translation;
       tr = glm::vec3(glm::rotate(glm::mat4(1), glm::radians(-30.0f) * dt, glm::vec3(0, 1, 0)) * glm::vec4(tr, 1.0f));
-      batchedObjects[i].transform.rotation = glm::rotate(batchedObjects[i].transform.rotation, glm::radians(45.f) * dt, glm::vec3(0, 1, 0));
+      obj.transform.rotation = glm::rotate(obj.transform.rotation, glm::radians(45.f) * dt, glm::vec3(0, 1, 0));
     }
 
     glBindVertexArray(vao);
@@ -160,33 +167,226 @@ void Renderer::MainLoop()
     glCullFace(GL_BACK);
     glDepthFunc(GL_LEQUAL);
 
-    const glm::vec3 sunPos = -glm::normalize(globalLight.direction) * 200.f + glm::vec3(0, 30, 0);
-    const glm::mat4& lightMat = MakeLightMatrix(
-      globalLight, sunPos, glm::vec2(120), glm::vec2(1.0f, 350.0f));
+    // one shadow cascade per slice of the view frustum (up to shadowDistance). Each gets its own
+    // ortho box and caster volume, so casters are culled per cascade
+    std::array<glm::mat4, MAX_SHADOW_CASCADES> cascadeMatrices{};
+    std::array<Frustum, MAX_SHADOW_CASCADES> casterFrusta{};
+    {
+      const float aspect = cam.GetProj()[1][1] / cam.GetProj()[0][0];
+      const float shadowFar = glm::min(shadowDistance, cam.GetFar());
+      const auto splits = SplitCascades(cam.GetNear(), shadowFar, numCascades, cascadeSplitLambda);
+      const float tanHalfFovY = glm::tan(glm::radians(cam.GetFov()) * .5f);
+      const float cornerScale = glm::sqrt(1.0f + tanHalfFovY * tanHalfFovY * (1.0f + aspect * aspect)); // far corner distance / far
+      for (int c = 0; c < numCascades; c++)
+      {
+        const float sliceNear = c == 0 ? cam.GetNear() : splits[c - 1];
+        const glm::mat4 sliceViewProj = glm::perspective(glm::radians(cam.GetFov()), aspect, sliceNear, splits[c]) * cam.GetView();
+        if (cacheStaticShadows)
+        {
+          // cached cascades cover a sphere around an anchor rather than the slice, so turning never moves
+          // them. The sphere holds every direction of the slice from anywhere within the slack of the
+          // anchor, and is only re-centered once the camera has moved farther than that
+          const float reach = std::ceil(splits[c] * cornerScale * 16.0f) / 16.0f;
+          const float slack = reach * CASCADE_ANCHOR_SLACK;
+          if (reach != cascadeReach[c] || glm::distance(cam.GetPos(), cascadeAnchors[c]) > slack)
+          {
+            cascadeReach[c] = reach;
+            cascadeAnchors[c] = cam.GetPos();
+          }
+          cascadeMatrices[c] = MakeCascadeMatrix(globalLight, cascadeAnchors[c], reach + slack, SHADOW_WIDTH);
+          casterFrusta[c] = MakeShadowCasterFrustum(cascadeMatrices[c], cascadeMatrices[c]); // the whole box
+        }
+        else
+        {
+          cascadeMatrices[c] = MakeCascadeMatrix(globalLight, sliceViewProj, SHADOW_WIDTH);
+          casterFrusta[c] = MakeShadowCasterFrustum(cascadeMatrices[c], sliceViewProj);
+        }
+      }
+    }
+
+    // per-draw uniforms and world bounds, shared by culling and the G-buffer pass
+    std::vector<ObjectUniforms> objectUniforms;
+    meshBounds.Clear();
+    for (const auto& obj : batchedObjects)
+    {
+      const glm::mat4 model = obj.transform.GetModelMatrix();
+      for (const auto& mesh : obj.meshes)
+      {
+        meshBounds.Add(model, mesh.boundsMin, mesh.boundsMax);
+        ObjectUniforms uniform
+        {
+          .modelMatrix = model,
+          //.normalMatrix = obj.transform.GetNormalMatrix(),
+          .materialIndex = mesh.materialIndex
+        };
+        objectUniforms.push_back(uniform);
+      }
+    }
+    StaticBuffer objectUniformsBuffer(objectUniforms.data(), sizeof(ObjectUniforms) * objectUniforms.size(), 0);
 
-    // create shadow map pass
+    meshWorldBounds.resize(meshBounds.Size());
+    for (size_t i = 0; i < meshWorldBounds.size(); i++)
     {
-      glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-      glBindFramebuffer(GL_FRAMEBUFFER, shadowFbo);
-      glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+      const glm::vec3 center(meshBounds.Centers(0)[i], meshBounds.Centers(1)[i], meshBounds.Centers(2)[i]);
+      const glm::vec3 extent(meshBounds.Extents(0)[i], meshBounds.Extents(1)[i], meshBounds.Extents(2)[i]);
+      meshWorldBounds[i] = { center - extent, center + extent };
+    }
+    FindMovedDraws(objectUniforms);
 
-      std::vector<glm::mat4> uniforms;
-      for (const auto& obj : batchedObjects)
+    // the bunnies move every frame, so the BVH is refit and only rebuilt once that makes it too loose
+    if (cullingMethod == CULLING_METHOD_CPU && cullWithBVH)
+    {
+      if (sceneBVH.NumItems() != meshWorldBounds.size() || sceneBVH.NeedsRebuild())
       {
-        for (const auto& mesh : obj.meshes)
+        sceneBVH.Build(meshWorldBounds);
+        bvhRebuilds++;
+      }
+      else
+      {
+        sceneBVH.Refit(meshWorldBounds);
+      }
+    }
+
+    // summed-area tables are fixed point, scaled so that the widest region the lighting pass reads (the
+    // filter's width, a partial texel at each end and one for rounding) sums to under 2^32
+    const float satWindow = glm::ceil(2.0f * maxShadowFilterRadius) + 3.0f;
+    const float satScale = glm::floor(4294967295.0f / (satWindow * satWindow));
+
+    // static casters are only redrawn into a cascade when something they depend on changed. While caching,
+    // a cascade's matrix only changes with the light direction or when its anchor moves
+    const StaticShadowState shadowState{ globalLight.direction, shadow_method, BLUR_PASSES, BLUR_STRENGTH, eConstant, shadow_gen_mips,
+      useSummedAreaTables, useSummedAreaTables ? satScale : 0.0f };
+    const bool allCascadesStale = !cacheStaticShadows || staticShadowsDirty || shadowState != staticShadowState;
+    std::array<bool, MAX_SHADOW_CASCADES> cascadeStale{};
+    cascadesRedrawn = 0;
+    for (int c = 0; c < numCascades; c++)
+    {
+      cascadeStale[c] = allCascadesStale || cascadeMatrices[c] != cachedCascadeMatrices[c];
+      cachedCascadeMatrices[c] = cascadeMatrices[c];
+      cascadesRedrawn += cascadeStale[c];
+    }
+    staticShadowState = shadowState;
+    staticShadowsDirty = false;
+
+    const size_t numDraws = objectUniforms.size();
+    if (cullingMethod == CULLING_METHOD_GPU)
+    {
+      glClearNamedBufferData(gpuDrawCounts->ID(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+      for (int c = 0; c < numCascades; c++)
+      {
+        if (cascadeStale[c])
+        {
+          CullDrawsGPU(cascadeMatrices[c], casterFrusta[c], objectUniformsBuffer, *gpuShadowCommands[c], DRAW_COUNT_SHADOW + c,
+            CULL_PASS_FRUSTUM, CULL_CASTERS_STATIC);
+        }
+        CullDrawsGPU(cascadeMatrices[c], casterFrusta[c], objectUniformsBuffer, *gpuShadowCommands[MAX_SHADOW_CASCADES + c], DRAW_COUNT_DYNAMIC_SHADOW + c,
+          CULL_PASS_FRUSTUM, CULL_CASTERS_DYNAMIC);
+      }
+      CullDrawsGPU(cam.GetViewProj(), MakeFrustum(cam.GetViewProj()), objectUniformsBuffer, *gpuCameraCommands, DRAW_COUNT_CAMERA,
+        occlusionCulling ? CULL_PASS_EARLY : CULL_PASS_CAMERA);
+      glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    }
+    else if (numDraws > 0)
+    {
+      // the static casters of cascade c start at c * numDraws, its dynamic casters at (MAX_SHADOW_CASCADES + c) * numDraws.
+      // Without CPU culling every caster is kept
+      numShadowCasters = 0;
+      for (int c = 0; c < numCascades; c++)
+      {
+        DrawElementsIndirectCommand* staticCommands = &shadowDrawCommands[c * numDraws];
+        DrawElementsIndirectCommand* dynamicCommands = &shadowDrawCommands[(MAX_SHADOW_CASCADES + c) * numDraws];
+        if (cullingMethod == CULLING_METHOD_CPU && cullWithBVH)
+        {
+          for (size_t i = 0; i < numDraws; i++)
+          {
+            staticCommands[i].instanceCount = 0;
+          }
+          bvhResults.clear();
+          sceneBVH.QueryFrustum(casterFrusta[c], bvhResults);
+          for (uint32_t i : bvhResults)
+          {
+            staticCommands[i].instanceCount = 1;
+          }
+        }
+        else if (cullingMethod == CULLING_METHOD_CPU)
+        {
+          CullBoxes(casterFrusta[c], meshBounds, &staticCommands[0].instanceCount,
+            sizeof(DrawElementsIndirectCommand) / sizeof(GLuint));
+        }
+        else
+        {
+          for (size_t i = 0; i < numDraws; i++)
+          {
+            staticCommands[i].instanceCount = 1;
+          }
+        }
+
+        for (size_t i = 0; i < numDraws; i++)
         {
-          uniforms.emplace_back(lightMat * obj.transform.GetModelMatrix());
+          dynamicCommands[i].instanceCount = staticCommands[i].instanceCount & drawIsDynamic[i];
+          staticCommands[i].instanceCount &= drawIsDynamic[i] ^ 1;
+          numShadowCasters += (cascadeStale[c] ? staticCommands[i].instanceCount : 0) + dynamicCommands[i].instanceCount;
         }
       }
-      StaticBuffer uniformBuffer(uniforms.data(), uniforms.size() * sizeof(glm::mat4), 0);
+      shadowDrawIndirectBuffer->SubData(shadowDrawCommands.data(), sizeof(DrawElementsIndirectCommand) * shadowDrawCommands.size(), 0);
+    }
+
+    // create shadow map pass. Stale cascades get one culled multi-draw of their static casters, and
+    // every cascade gets one of its dynamic casters into the overlay
+    {
+      // casters in front of a cascade's near plane are flattened onto it instead of being clipped
+      glEnable(GL_DEPTH_CLAMP);
+
       auto& shadowBindlessShader = Shader::shaders["shadowBindless"];
       shadowBindlessShader->Bind();
-      glBindBuffer(GL_SHADER_STORAGE_BUFFER, uniformBuffer.ID());
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, uniformBuffer.ID());
-      drawIndirectBuffer->Bind(GL_DRAW_INDIRECT_BUFFER);
+      objectUniformsBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
       glVertexArrayVertexBuffer(vao, 0, vertexBuffer->GetBufferHandle(), 0, sizeof(Vertex));
       glVertexArrayElementBuffer(vao, indexBuffer->GetBufferHandle());
-      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, static_cast<GLsizei>(uniforms.size()), sizeof(DrawElementsIndirectCommand));
+
+      // set is c for the static casters of cascade c, and MAX_SHADOW_CASCADES + c for its dynamic casters
+      auto drawCasters = [&](int set)
+      {
+        if (cullingMethod == CULLING_METHOD_GPU)
+        {
+          gpuShadowCommands[set]->Bind(GL_DRAW_INDIRECT_BUFFER);
+          gpuDrawCounts->Bind(GL_PARAMETER_BUFFER);
+          glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (DRAW_COUNT_SHADOW + set) * sizeof(GLuint),
+            static_cast<GLsizei>(numDraws), sizeof(DrawElementsIndirectCommand));
+        }
+        else
+        {
+          shadowDrawIndirectBuffer->Bind(GL_DRAW_INDIRECT_BUFFER);
+          glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(set * numDraws * sizeof(DrawElementsIndirectCommand)),
+            static_cast<GLsizei>(numDraws), sizeof(DrawElementsIndirectCommand));
+        }
+      };
+
+      glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+      for (int c = 0; c < numCascades; c++)
+      {
+        if (cascadeStale[c])
+        {
+          glBindFramebuffer(GL_FRAMEBUFFER, shadowFbos[c]);
+          glClear(GL_DEPTH_BUFFER_BIT);
+          shadowBindlessShader->SetMat4("u_lightMatrix", cascadeMatrices[c]);
+          drawCasters(c);
+        }
+      }
+
+      // the overlay is compared directly instead of through filtered moments, so it needs a slope bias against acne
+      glViewport(0, 0, DYNAMIC_SHADOW_SIZE, DYNAMIC_SHADOW_SIZE);
+      glEnable(GL_POLYGON_OFFSET_FILL);
+      glPolygonOffset(2.0f, 4.0f);
+      for (int c = 0; c < numCascades; c++)
+      {
+        glBindFramebuffer(GL_FRAMEBUFFER, dynamicShadowFbos[c]);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        shadowBindlessShader->SetMat4("u_lightMatrix", cascadeMatrices[c]);
+        drawCasters(MAX_SHADOW_CASCADES + c);
+      }
+      glDisable(GL_POLYGON_OFFSET_FILL);
+      glDisable(GL_DEPTH_CLAMP);
+      glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
     }
 
     GLuint filteredTex{};
@@ -197,47 +397,76 @@ void Renderer::MainLoop()
     case SHADOW_METHOD_MSM: filteredTex = msmShadowMoments; break;
     }
 
-    // copy transformed shadow depth to another texture
-    if (shadow_method == SHADOW_METHOD_ESM || shadow_method == SHADOW_METHOD_VSM || shadow_method == SHADOW_METHOD_MSM)
+    // copy transformed shadow depth to another texture, for the cascades that were redrawn
+    if ((shadow_method == SHADOW_METHOD_ESM || shadow_method == SHADOW_METHOD_VSM || shadow_method == SHADOW_METHOD_MSM) && cascadesRedrawn > 0)
     {
-      glBindTextureUnit(0, shadowDepth);
-
       const char* shaderName = "none";
-      GLuint fbo{};
       switch (shadow_method)
       {
-      case SHADOW_METHOD_VSM: shaderName = "vsm_copy"; fbo = vshadowGoodFormatFbo; break;
-      case SHADOW_METHOD_ESM: shaderName = "esm_copy"; fbo = eShadowFbo; break;
-      case SHADOW_METHOD_MSM: shaderName = "msm_copy"; fbo = msmShadowFbo; break;
+      case SHADOW_METHOD_VSM: shaderName = "vsm_copy"; break;
+      case SHADOW_METHOD_ESM: shaderName = "esm_copy"; break;
+      case SHADOW_METHOD_MSM: shaderName = "msm_copy"; break;
       }
 
       auto& copyShader = Shader::shaders[shaderName];
-      copyShader->Bind();
-      if (shadow_method == SHADOW_METHOD_ESM)
+      for (int c = 0; c < numCascades; c++)
       {
-        copyShader->SetFloat("u_C", eConstant);
-      }
-      glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-      glDrawArrays(GL_TRIANGLES, 0, 3);
-      if (shadow_method == SHADOW_METHOD_VSM)
-      {
-        blurTextureRG32f(vshadowDepthGoodFormat, vshadowMomentBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
-      }
-      else if (shadow_method == SHADOW_METHOD_ESM)
-      {
-        blurTextureR32f(eExpShadowDepth, eShadowDepthBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
-      }
-      else if (shadow_method == SHADOW_METHOD_MSM)
-      {
-        blurTextureRGBA32f(msmShadowMoments, msmShadowMomentsBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
+        if (!cascadeStale[c])
+        {
+          continue;
+        }
+        copyShader->Bind();
+        if (shadow_method == SHADOW_METHOD_ESM)
+        {
+          copyShader->SetFloat("u_C", eConstant);
+        }
+        glBindTextureUnit(0, shadowDepthViews[c]);
+        if (shadow_method == SHADOW_METHOD_VSM)
+        {
+          glBindFramebuffer(GL_FRAMEBUFFER, vshadowGoodFormatFbos[c]);
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+          if (useSummedAreaTables)
+          {
+            summedAreaTable(vshadowDepthGoodFormatViews[c], vshadowMomentBlur, SHADOW_WIDTH, SHADOW_HEIGHT, GL_RG32F, satScale);
+          }
+          else
+          {
+            blurTextureRG32f(vshadowDepthGoodFormatViews[c], vshadowMomentBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
+          }
+        }
+        else if (shadow_method == SHADOW_METHOD_ESM)
+        {
+          glBindFramebuffer(GL_FRAMEBUFFER, eShadowFbos[c]);
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+          blurTextureR32f(eExpShadowDepthViews[c], eShadowDepthBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
+        }
+        else if (shadow_method == SHADOW_METHOD_MSM)
+        {
+          glBindFramebuffer(GL_FRAMEBUFFER, msmShadowFbos[c]);
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+          if (useSummedAreaTables)
+          {
+            summedAreaTable(msmShadowMomentsViews[c], msmShadowMomentsBlur, SHADOW_WIDTH, SHADOW_HEIGHT, GL_RGBA32F, satScale);
+          }
+          else
+          {
+            blurTextureRGBA32f(msmShadowMomentsViews[c], msmShadowMomentsBlur, SHADOW_WIDTH, SHADOW_HEIGHT, BLUR_PASSES, BLUR_STRENGTH);
+          }
+        }
       }
 
-      if (shadow_gen_mips)
+      // summed-area tables are always read from the base level
+      if (shadow_gen_mips && !(useSummedAreaTables && shadow_method != SHADOW_METHOD_ESM))
       {
         glGenerateTextureMipmap(filteredTex);
       }
     }
 
+    if (pointShadows)
+    {
+      UpdatePointShadows(objectUniforms, objectUniformsBuffer);
+    }
+
     glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
     // populate gbuffer pass
@@ -245,22 +474,115 @@ void Renderer::MainLoop()
       glBindFramebuffer(GL_FRAMEBUFFER, gfbo);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-      // draw batched objects
-      std::vector<ObjectUniforms> uniforms;
+      // frustum cull batched objects on the CPU. Culled meshes keep their command (and uniforms), but draw 0 instances
+      if (cullingMethod != CULLING_METHOD_GPU)
+      {
+        Timer cullTimer;
+        if (cullingMethod == CULLING_METHOD_CPU && !cameraDrawCommands.empty())
+        {
+          const Frustum frustum = MakeFrustum(cam.GetViewProj());
+          if (cullWithBVH)
+          {
+            for (auto& cmd : cameraDrawCommands)
+            {
+              cmd.instanceCount = 0;
+            }
+            bvhResults.clear();
+            sceneBVH.QueryFrustum(frustum, bvhResults);
+            for (uint32_t i : bvhResults)
+            {
+              cameraDrawCommands[i].instanceCount = 1;
+            }
+          }
+          else
+          {
+            CullBoxes(frustum, meshBounds, &cameraDrawCommands[0].instanceCount,
+              sizeof(DrawElementsIndirectCommand) / sizeof(GLuint));
+          }
+          if (softwareOcclusionCulling)
+          {
+            Timer occlusionTimer;
+            if (occludersAwaitTextures && !materialManager.HasPendingTextures())
+            {
+              SelectOccluders();
+            }
+            softwareOcclusion->BeginFrame(cam.GetViewProj());
+            for (const auto& occluder : occluders)
+            {
+              softwareOcclusion->AddOccluder(batchedObjects[occluder.objectIndex].transform.GetModelMatrix(), occluder.positions, occluder.indices);
+            }
+            softwareOcclusion->Rasterize();
+            for (size_t i = 0; i < cameraDrawCommands.size(); i++)
+            {
+              if (cameraDrawCommands[i].instanceCount != 0)
+              {
+                const glm::vec3 center(meshBounds.Centers(0)[i], meshBounds.Centers(1)[i], meshBounds.Centers(2)[i]);
+                const glm::vec3 extent(meshBounds.Extents(0)[i], meshBounds.Extents(1)[i], meshBounds.Extents(2)[i]);
+                cameraDrawCommands[i].instanceCount = softwareOcclusion->IsVisible(center, extent);
+              }
+            }
+            softwareOcclusionTime = occlusionTimer.elapsed();
+
+            if (uiViewBuffer == static_cast<GLint>(softwareOcclusionTex))
+            {
+              std::vector<uint8_t> coverage(softwareOcclusion->GetDepth().size());
+              std::transform(softwareOcclusion->GetDepth().begin(), softwareOcclusion->GetDepth().end(), coverage.begin(),
+                [](float depth) { return depth < 1.0f ? uint8_t(255) : uint8_t(0); });
+              glTextureSubImage2D(softwareOcclusionTex, 0, 0, 0, softwareOcclusion->GetWidth(), softwareOcclusion->GetHeight(), GL_RED, GL_UNSIGNED_BYTE, coverage.data());
+            }
+          }
+        }
+        else
+        {
+          for (auto& cmd : cameraDrawCommands)
+          {
+            cmd.instanceCount = 1;
+          }
+        }
+        cameraDrawIndirectBuffer->SubData(cameraDrawCommands.data(), sizeof(DrawElementsIndirectCommand) * cameraDrawCommands.size(), 0);
+        cullTime = cullTimer.elapsed();
+      }
+
+      // GPU culling results arrive VISIBILITY_READBACK_FRAMES frames late, the wait is only a formality.
+      // Until the first one does every mesh counts as used
+      const int visibilityReadback = visibilityReadbackIndex;
+      if (cullingMethod == CULLING_METHOD_GPU && visibilityReadbackFences[visibilityReadback])
+      {
+        glClientWaitSync(visibilityReadbackFences[visibilityReadback], GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+        glDeleteSync(visibilityReadbackFences[visibilityReadback]);
+        visibilityReadbackFences[visibilityReadback] = nullptr;
+        const uint32_t* visible = visibilityReadbackData[visibilityReadback];
+        gpuDrawVisible.assign(visible, visible + cameraDrawCommands.size());
+      }
+      materialManager.PollPendingMaterials();
+      const float tanHalfFov = glm::tan(glm::radians(cam.GetFov()) * .5f);
+      size_t drawIndex = 0;
+      numVisibleMeshes = 0;
       for (const auto& obj : batchedObjects)
       {
+        const glm::mat4 model = obj.transform.GetModelMatrix();
+        const float maxScale = glm::max(obj.transform.scale.x, glm::max(obj.transform.scale.y, obj.transform.scale.z));
         for (const auto& mesh : obj.meshes)
         {
-          ObjectUniforms uniform
+          const size_t draw = drawIndex++;
+          const bool culled = cullingMethod == CULLING_METHOD_GPU
+            ? !gpuDrawVisible.empty() && gpuDrawVisible[draw] == 0
+            : cameraDrawCommands[draw].instanceCount == 0;
+          if (culled)
           {
-            .modelMatrix = obj.transform.GetModelMatrix(),
-            //.normalMatrix = obj.transform.GetNormalMatrix(),
-            .materialIndex = mesh.materialIndex
-          };
-          uniforms.push_back(uniform);
+            continue;
+          }
+          numVisibleMeshes++;
+
+          // projected size of the bounding sphere, for prioritizing mip streaming
+          const glm::vec3 center = model * glm::vec4((mesh.boundsMin + mesh.boundsMax) * .5f, 1.0f);
+          const float radius = glm::length(mesh.boundsMax - mesh.boundsMin) * .5f * maxScale;
+          const float distance = glm::distance(center, cam.GetPos());
+          const float screenSize = distance > radius ? radius / (distance * tanHalfFov) : 1.0f;
+          textureResidency->MarkUsed(mesh.materialIndex, screenSize);
         }
       }
-      StaticBuffer uniformBuffer(uniforms.data(), sizeof(ObjectUniforms) * uniforms.size(), 0);
+      textureResidency->Update();
 
       auto& gbufBindless = Shader::shaders["gBufferBindless"];
       gbufBindless->Bind();
@@ -271,17 +593,55 @@ void Renderer::MainLoop()
       gbufBindless->SetFloat("u_metalnessOverride", metalnessOverride);
       gbufBindless->SetFloat("u_AOoverride", AOoverride);
       gbufBindless->SetFloat("u_ambientOcclusionOverride", ambientOcclusionOverride);
-      uniformBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
-      materialsBuffer->BindBase(GL_SHADER_STORAGE_BUFFER, 1);
-      drawIndirectBuffer->Bind(GL_DRAW_INDIRECT_BUFFER);
+      objectUniformsBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+      textureResidency->GetMaterialsBuffer().BindBase(GL_SHADER_STORAGE_BUFFER, 1);
       glVertexArrayVertexBuffer(vao, 0, vertexBuffer->GetBufferHandle(), 0, sizeof(Vertex));
       glVertexArrayElementBuffer(vao, indexBuffer->GetBufferHandle());
-      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, uniforms.size(), sizeof(DrawElementsIndirectCommand));
+      if (cullingMethod == CULLING_METHOD_GPU)
+      {
+        gpuCameraCommands->Bind(GL_DRAW_INDIRECT_BUFFER);
+        gpuDrawCounts->Bind(GL_PARAMETER_BUFFER);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, DRAW_COUNT_CAMERA * sizeof(GLuint), static_cast<GLsizei>(objectUniforms.size()), sizeof(DrawElementsIndirectCommand));
+
+        // test what wasn't drawn above against the depth it produced
+        if (occlusionCulling)
+        {
+          BuildHiZ();
+          CullDrawsGPU(cam.GetViewProj(), MakeFrustum(cam.GetViewProj()), objectUniformsBuffer, *gpuCameraLateCommands, DRAW_COUNT_CAMERA_LATE, CULL_PASS_LATE);
+          glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+          gbufBindless->Bind();
+          objectUniformsBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+          textureResidency->GetMaterialsBuffer().BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+          gpuCameraLateCommands->Bind(GL_DRAW_INDIRECT_BUFFER);
+          gpuDrawCounts->Bind(GL_PARAMETER_BUFFER);
+          glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, DRAW_COUNT_CAMERA_LATE * sizeof(GLuint), static_cast<GLsizei>(objectUniforms.size()), sizeof(DrawElementsIndirectCommand));
+        }
+
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glCopyNamedBufferSubData(drawVisibility->ID(), visibilityReadbackBuffers[visibilityReadback], 0, 0, sizeof(GLuint) * objectUniforms.size());
+        visibilityReadbackFences[visibilityReadback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        visibilityReadbackIndex = (visibilityReadback + 1) % VISIBILITY_READBACK_FRAMES;
+      }
+      else
+      {
+        cameraDrawIndirectBuffer->Bind(GL_DRAW_INDIRECT_BUFFER);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, static_cast<GLsizei>(objectUniforms.size()), sizeof(DrawElementsIndirectCommand));
+      }
       
       if (drawPbrSphereGridQuestionMark)
       {
         DrawPbrSphereGrid();
       }
+
+      // the complete depth buffer, for next frame's culling and for screen-space effects
+      BuildHiZ();
+    }
+
+    if (virtualShadows)
+    {
+      UpdateVirtualShadows(objectUniformsBuffer);
+      glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, ssao.fbo);
@@ -347,8 +707,13 @@ void Renderer::MainLoop()
     glBindTextureUnit(3, gDepth);
     glBindTextureUnit(4, ssao.texture);
     glBindTextureUnit(5, filteredTex);
-    glBindTextureUnit(6, irradianceMap);
-    glBindTextureUnit(7, envMap_hdri->GetID());
+    glBindTextureUnit(6, brdfLUT);
+    glBindTextureUnit(7, environment->GetPrefiltered());
+    glBindTextureUnit(8, dynamicShadowDepth);
+    glBindTextureUnit(9, vsmPool);
+    glBindTextureUnit(10, shadow_method == SHADOW_METHOD_MSM ? msmShadowMomentsSAT : vshadowMomentsSAT);
+    environment->GetIrradianceSH().BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+    vsmPageTable->BindBase(GL_SHADER_STORAGE_BUFFER, 3);
 
     // global light pass (and apply shadow)
     {
@@ -359,38 +724,124 @@ void Renderer::MainLoop()
       gPhongGlobal->SetFloat("u_C", eConstant);
       gPhongGlobal->SetVec3("u_viewPos", cam.GetPos());
       gPhongGlobal->SetIVec2("u_screenSize", WINDOW_WIDTH, WINDOW_HEIGHT);
-      gPhongGlobal->SetUInt("u_samples", numEnvSamples);
+      gPhongGlobal->SetFloat("u_prefilteredMaxLod", Environment::PREFILTERED_LEVELS - 1.0f);
       gPhongGlobal->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
       //gPhongGlobal->SetVec3("u_globalLight_ambient", globalLight.ambient);
       gPhongGlobal->SetVec3("u_globalLight_diffuse", globalLight.diffuse);
       //gPhongGlobal->SetVec3("u_globalLight_specular", globalLight.specular);
       gPhongGlobal->SetVec3("u_globalLight_direction", globalLight.direction);
-      gPhongGlobal->SetMat4("u_lightMatrix", lightMat);
+      gPhongGlobal->SetMat4Array("u_lightMatrices[0]", cascadeMatrices);
+      gPhongGlobal->SetInt("u_numCascades", numCascades);
+      gPhongGlobal->SetBool("u_showCascades", showCascades);
       gPhongGlobal->SetFloat("u_lightBleedFix", vlightBleedFix);
+      gPhongGlobal->SetBool("u_summedAreaTables", useSummedAreaTables);
+      gPhongGlobal->SetFloat("u_satScale", satScale);
+      gPhongGlobal->SetFloat("u_lightSize", lightSize);
+      gPhongGlobal->SetFloat("u_maxFilterRadius", maxShadowFilterRadius);
+      gPhongGlobal->SetBool("u_virtualShadows", virtualShadows);
+      gPhongGlobal->SetMat4("u_vsmMatrix", vsmMatrix);
+      gPhongGlobal->SetFloat("u_vsmTexelSize", vsmTexelSize);
       glDrawArrays(GL_TRIANGLES, 0, 3);
     }
 
     // local lights pass
     {
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_ONE, GL_ONE);
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_FRONT);
-      //glDepthMask(GL_FALSE);
-      auto& gPhongLocal = Shader::shaders["gPhongManyLocal"];
-      gPhongLocal->Bind();
-      gPhongLocal->SetMat4("u_viewProj", cam.GetViewProj());
-      gPhongLocal->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
-      gPhongLocal->SetVec3("u_viewPos", cam.GetPos());
-      gPhongLocal->SetInt("gNormal", 0);
-      gPhongLocal->SetInt("gAlbedo", 1);
-      gPhongLocal->SetInt("gRMA", 2);
-      gPhongLocal->SetInt("gDepth", 3);
+      // point shadow inputs of local_light.h, shared by both paths
+      std::array<glm::mat4, 6> faceViews;
+      for (int face = 0; face < 6; face++)
+      {
+        faceViews[face] = CubeFaceView(face);
+      }
+      auto setPointShadowUniforms = [&](auto& shader)
+      {
+        shader->SetInt("u_pointShadowAtlas", 9);
+        shader->SetBool("u_pointShadows", pointShadows);
+        shader->SetMat4Array("u_cubeFaceViews[0]", faceViews);
+      };
+      glBindTextureUnit(9, pointShadowAtlasTex);
       lightSSBO->BindBase(GL_SHADER_STORAGE_BUFFER, 0);
-      glVertexArrayVertexBuffer(vao, 0, sphere.GetVBOID(), 0, sizeof(Vertex));
-      glVertexArrayElementBuffer(vao, sphere.GetEBOID());
-      glDrawElementsInstanced(GL_TRIANGLES, sphere.GetVertexCount(), GL_UNSIGNED_INT, nullptr, localLights.size());
-      glCullFace(GL_BACK);
+      lightShadowSlotsBuffer->BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+      shadowSlotsBuffer->BindBase(GL_SHADER_STORAGE_BUFFER, 3);
+
+      if (localLightsMethod == LOCAL_LIGHTS_VOLUMES)
+      {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        //glDepthMask(GL_FALSE);
+        auto& gPhongLocal = Shader::shaders["gPhongManyLocal"];
+        gPhongLocal->Bind();
+        gPhongLocal->SetMat4("u_viewProj", cam.GetViewProj());
+        gPhongLocal->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
+        gPhongLocal->SetVec3("u_viewPos", cam.GetPos());
+        gPhongLocal->SetInt("gNormal", 0);
+        gPhongLocal->SetInt("gAlbedo", 1);
+        gPhongLocal->SetInt("gRMA", 2);
+        gPhongLocal->SetInt("gDepth", 3);
+        setPointShadowUniforms(gPhongLocal);
+        glVertexArrayVertexBuffer(vao, 0, sphere.GetVBOID(), 0, sizeof(Vertex));
+        glVertexArrayElementBuffer(vao, sphere.GetEBOID());
+        glDrawElementsInstanced(GL_TRIANGLES, sphere.GetVertexCount(), GL_UNSIGNED_INT, nullptr, localLights.size());
+        glCullFace(GL_BACK);
+      }
+      else
+      {
+        // timed on the GPU, the result is read CLUSTER_READBACK_FRAMES frames later
+        const int clusterFrame = clusterReadbackIndex;
+        if (clusterTimerPending[clusterFrame])
+        {
+          GLuint64 elapsed{};
+          glGetQueryObjectui64v(clusterTimerQueries[clusterFrame], GL_QUERY_RESULT, &elapsed);
+          clusterGpuTime = elapsed / 1e9;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, clusterTimerQueries[clusterFrame]);
+
+        if (localLightsMethod == LOCAL_LIGHTS_CLUSTERED_CPU)
+        {
+          Timer buildTimer;
+          std::vector<glm::vec4> spheres(localLights.size());
+          for (size_t i = 0; i < localLights.size(); i++)
+          {
+            spheres[i] = glm::vec4(glm::vec3(localLights[i].position), glm::sqrt(localLights[i].radiusSquared));
+          }
+          BuildLightClusters(spheres, cam.GetView(), cam.GetProj(), cam.GetNear(), cam.GetFar(), cpuLightClusters);
+          clusterIndicesDropped = cpuLightClusters.dropped;
+          clusterIndicesNeeded = static_cast<uint32_t>(cpuLightClusters.indices.size()) + cpuLightClusters.dropped;
+          GrowClusterIndices(static_cast<uint32_t>(cpuLightClusters.indices.size()));
+          clusterRanges->SubData(cpuLightClusters.ranges.data(), sizeof(glm::uvec2) * cpuLightClusters.ranges.size(), 0);
+          clusterIndices->SubData(cpuLightClusters.indices.data(), sizeof(uint32_t) * cpuLightClusters.indices.size(), 0);
+          clusterBuildTime = buildTimer.elapsed();
+        }
+        else
+        {
+          BuildLightClustersGPU();
+        }
+
+        auto& shading = Shader::shaders["cluster_shading"];
+        shading->Bind();
+        shading->SetInt("gNormal", 0);
+        shading->SetInt("gAlbedo", 1);
+        shading->SetInt("gRMA", 2);
+        shading->SetInt("gDepth", 3);
+        shading->SetInt("u_outColor", 0);
+        shading->SetVec3("u_viewPos", cam.GetPos());
+        shading->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
+        shading->SetMat4("u_view", cam.GetView());
+        shading->SetFloat("u_near", cam.GetNear());
+        shading->SetFloat("u_far", cam.GetFar());
+        shading->SetUInt("u_indexCapacity", clusterIndexCapacity);
+        setPointShadowUniforms(shading);
+        lightSSBO->BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+        clusterRanges->BindBase(GL_SHADER_STORAGE_BUFFER, 4);
+        clusterIndices->BindBase(GL_SHADER_STORAGE_BUFFER, 5);
+        glBindImageTexture(0, hdr.colorTex, 0, false, 0, GL_READ_WRITE, GL_RGBA16F);
+        glDispatchCompute((WINDOW_WIDTH + 7) / 8, (WINDOW_HEIGHT + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glEndQuery(GL_TIME_ELAPSED);
+        clusterTimerPending[clusterFrame] = true;
+        clusterReadbackIndex = (clusterFrame + 1) % CLUSTER_READBACK_FRAMES;
+      }
     }
 
     // skybox pass
@@ -409,7 +860,7 @@ void Renderer::MainLoop()
       hdriShader->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
       hdriShader->SetIVec2("u_screenSize", WINDOW_WIDTH, WINDOW_HEIGHT);
       hdriShader->SetVec3("u_camPos", cam.GetPos());
-      envMap_hdri->Bind(0);
+      glBindTextureUnit(0, environment->GetCubemap());
       //envMap_irradiance->Bind(0);
       glDrawArrays(GL_TRIANGLES, 0, 3);
     }
@@ -427,10 +878,12 @@ void Renderer::MainLoop()
       glBindTextureUnit(1, gDepth);
       glBindTextureUnit(2, shadowDepth);
       glBindTextureUnit(3, bluenoiseTex->GetID());
+      glBindTextureUnit(4, dynamicShadowDepth);
       auto& volumetric = Shader::shaders["volumetric"];
       volumetric->Bind();
       volumetric->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
-      volumetric->SetMat4("u_lightMatrix", lightMat);
+      volumetric->SetMat4Array("u_lightMatrices[0]", cascadeMatrices);
+      volumetric->SetInt("u_numCascades", numCascades);
       volumetric->SetIVec2("u_screenSize", volumetrics.framebuffer_width, volumetrics.framebuffer_height);
       volumetric->SetInt("NUM_STEPS", volumetrics.steps);
       volumetric->SetFloat("intensity", volumetrics.intensity);
@@ -582,7 +1035,7 @@ void Renderer::MainLoop()
     }
     if (Input::IsKeyDown(GLFW_KEY_5))
     {
-      drawFSTexture(shadowDepth);
+      drawFSTexture(shadowDepthViews[0]);
     }
     if (Input::IsKeyDown(GLFW_KEY_6))
     {
@@ -598,19 +1051,11 @@ void Renderer::MainLoop()
     }
     if (Input::IsKeyDown(GLFW_KEY_9))
     {
-      drawFSTexture(msmShadowMoments);
+      drawFSTexture(msmShadowMomentsViews[0]);
     }
     if (Input::IsKeyDown(GLFW_KEY_0))
     {
-      drawFSTexture(vshadowDepthGoodFormat);
-    }
-    if (Input::IsKeyDown(GLFW_KEY_P))
-    {
-      drawFSTexture(envMap_hdri->GetID());
-    }
-    if (Input::IsKeyDown(GLFW_KEY_O))
-    {
-      drawFSTexture(irradianceMap);
+      drawFSTexture(vshadowDepthGoodFormatViews[0]);
     }
     if (Input::IsKeyDown(GLFW_KEY_I))
     {
@@ -772,23 +1217,120 @@ void Renderer::CreateFramebuffers()
   hdr.histogramBuffer = std::make_unique<StaticBuffer>(zeros.data(), zeros.size() * sizeof(int), 0);
 
   const GLfloat txzeros[] = { 0, 0, 0, 0 };
-  glCreateTextures(GL_TEXTURE_2D, 1, &shadowDepth);
-  glTextureStorage2D(shadowDepth, 1, GL_DEPTH_COMPONENT32, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &shadowDepth);
+  glTextureStorage3D(shadowDepth, 1, GL_DEPTH_COMPONENT32, SHADOW_WIDTH, SHADOW_HEIGHT, MAX_SHADOW_CASCADES);
   glTextureParameterfv(shadowDepth, GL_TEXTURE_BORDER_COLOR, txzeros);
   glTextureParameteri(shadowDepth, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   glTextureParameteri(shadowDepth, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  glCreateFramebuffers(1, &shadowFbo);
-  glNamedFramebufferTexture(shadowFbo, GL_DEPTH_ATTACHMENT, shadowDepth, 0);
-  glNamedFramebufferDrawBuffer(shadowFbo, GL_NONE);
-  if (GLenum status = glCheckNamedFramebufferStatus(shadowFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  for (int c = 0; c < MAX_SHADOW_CASCADES; c++)
   {
-    throw std::runtime_error("Failed to create shadow framebuffer");
+    glGenTextures(1, &shadowDepthViews[c]);
+    glTextureView(shadowDepthViews[c], GL_TEXTURE_2D, shadowDepth, GL_DEPTH_COMPONENT32, 0, 1, c, 1);
+    glCreateFramebuffers(1, &shadowFbos[c]);
+    glNamedFramebufferTextureLayer(shadowFbos[c], GL_DEPTH_ATTACHMENT, shadowDepth, 0, c);
+    glNamedFramebufferDrawBuffer(shadowFbos[c], GL_NONE);
+    if (GLenum status = glCheckNamedFramebufferStatus(shadowFbos[c], GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+    {
+      throw std::runtime_error("Failed to create shadow framebuffer");
+    }
   }
 
-  // VSM textures + fbo
-  glCreateTextures(GL_TEXTURE_2D, 1, &vshadowDepthGoodFormat);
+  // dynamic caster overlay, sampled with hardware PCF
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &dynamicShadowDepth);
+  glTextureStorage3D(dynamicShadowDepth, 1, GL_DEPTH_COMPONENT32, DYNAMIC_SHADOW_SIZE, DYNAMIC_SHADOW_SIZE, MAX_SHADOW_CASCADES);
+  const GLfloat txones[] = { 1, 1, 1, 1 };
+  glTextureParameterfv(dynamicShadowDepth, GL_TEXTURE_BORDER_COLOR, txones);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(dynamicShadowDepth, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  for (int c = 0; c < MAX_SHADOW_CASCADES; c++)
+  {
+    glCreateFramebuffers(1, &dynamicShadowFbos[c]);
+    glNamedFramebufferTextureLayer(dynamicShadowFbos[c], GL_DEPTH_ATTACHMENT, dynamicShadowDepth, 0, c);
+    glNamedFramebufferDrawBuffer(dynamicShadowFbos[c], GL_NONE);
+    if (GLenum status = glCheckNamedFramebufferStatus(dynamicShadowFbos[c], GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+    {
+      throw std::runtime_error("Failed to create dynamic shadow framebuffer");
+    }
+  }
+  staticShadowsDirty = true;
+
+  // point light shadow atlas, sampled with hardware PCF
+  glCreateTextures(GL_TEXTURE_2D, 1, &pointShadowAtlasTex);
+  glTextureStorage2D(pointShadowAtlasTex, 1, GL_DEPTH_COMPONENT32F, PointShadowAtlas::WIDTH, PointShadowAtlas::HEIGHT);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(pointShadowAtlasTex, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glCreateFramebuffers(1, &pointShadowFbo);
+  glNamedFramebufferTexture(pointShadowFbo, GL_DEPTH_ATTACHMENT, pointShadowAtlasTex, 0);
+  glNamedFramebufferDrawBuffer(pointShadowFbo, GL_NONE);
+  if (GLenum status = glCheckNamedFramebufferStatus(pointShadowFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    throw std::runtime_error("Failed to create point shadow atlas framebuffer");
+  }
+  // slots are sampled before their first draw covers them, empty texels have to read as unshadowed
+  const float farDepth = 1.0f;
+  glClearTexImage(pointShadowAtlasTex, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+  pointShadowAtlas.InvalidateAll();
+  std::vector<glm::vec4> slotRects;
+  for (const auto& slot : pointShadowAtlas.GetSlots())
+  {
+    const glm::vec2 atlasSize(PointShadowAtlas::WIDTH, PointShadowAtlas::HEIGHT);
+    slotRects.push_back(glm::vec4(glm::vec2(slot.origin) / atlasSize, glm::vec2(slot.faceSize) / atlasSize));
+  }
+  shadowSlotsBuffer = std::make_unique<StaticBuffer>(slotRects.data(), sizeof(glm::vec4) * slotRects.size(), 0);
+
+  // virtual shadow map page pool, page table and request readback
+  glCreateTextures(GL_TEXTURE_2D, 1, &vsmPool);
+  glTextureStorage2D(vsmPool, 1, GL_DEPTH_COMPONENT32F, VirtualShadowPages::POOL_SIZE, VirtualShadowPages::POOL_SIZE);
+  glTextureParameteri(vsmPool, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(vsmPool, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(vsmPool, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(vsmPool, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(vsmPool, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(vsmPool, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glCreateFramebuffers(1, &vsmPoolFbo);
+  glNamedFramebufferTexture(vsmPoolFbo, GL_DEPTH_ATTACHMENT, vsmPool, 0);
+  glNamedFramebufferDrawBuffer(vsmPoolFbo, GL_NONE);
+  if (GLenum status = glCheckNamedFramebufferStatus(vsmPoolFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    throw std::runtime_error("Failed to create virtual shadow map framebuffer");
+  }
+  vsmPages.Clear();
+  vsmPageTable = std::make_unique<StaticBuffer>(vsmPages.GetPageTable().data(), sizeof(int32_t) * vsmPages.GetPageTable().size(), GL_DYNAMIC_STORAGE_BIT);
+  vsmPageTableVersion = vsmPages.PageTableVersion();
+  const GLsizeiptr requestSize = sizeof(uint32_t) * VirtualShadowPages::NumRequestWords();
+  vsmPageRequests = std::make_unique<StaticBuffer>(nullptr, requestSize, 0);
+  const GLbitfield readbackFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  for (int i = 0; i < VSM_READBACK_FRAMES; i++)
+  {
+    glCreateBuffers(1, &vsmReadbackBuffers[i]);
+    glNamedBufferStorage(vsmReadbackBuffers[i], requestSize, nullptr, readbackFlags);
+    vsmReadbackData[i] = static_cast<const uint32_t*>(glMapNamedBufferRange(vsmReadbackBuffers[i], 0, requestSize, readbackFlags));
+  }
+
+  // light lists of clustered shading
+  clusterRanges = std::make_unique<StaticBuffer>(nullptr, sizeof(glm::uvec2) * NUM_CLUSTERS, GL_DYNAMIC_STORAGE_BIT);
+  clusterIndices = std::make_unique<StaticBuffer>(nullptr, sizeof(uint32_t) * clusterIndexCapacity, GL_DYNAMIC_STORAGE_BIT);
+  clusterIndexCounts = std::make_unique<StaticBuffer>(nullptr, sizeof(uint32_t) * 2, 0);
+  for (int i = 0; i < CLUSTER_READBACK_FRAMES; i++)
+  {
+    glCreateBuffers(1, &clusterReadbackBuffers[i]);
+    glNamedBufferStorage(clusterReadbackBuffers[i], sizeof(uint32_t) * 2, nullptr, readbackFlags);
+    clusterReadbackData[i] = static_cast<const uint32_t*>(glMapNamedBufferRange(clusterReadbackBuffers[i], 0, sizeof(uint32_t) * 2, readbackFlags));
+  }
+  glCreateQueries(GL_TIME_ELAPSED, CLUSTER_READBACK_FRAMES, clusterTimerQueries.data());
+
+  // VSM textures + fbos
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &vshadowDepthGoodFormat);
   glCreateTextures(GL_TEXTURE_2D, 1, &vshadowMomentBlur);
-  glTextureStorage2D(vshadowDepthGoodFormat, SHADOW_LEVELS, GL_RG32F, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glTextureStorage3D(vshadowDepthGoodFormat, SHADOW_LEVELS, GL_RG32F, SHADOW_WIDTH, SHADOW_HEIGHT, MAX_SHADOW_CASCADES);
   glTextureStorage2D(vshadowMomentBlur, 1, GL_RG32F, SHADOW_WIDTH, SHADOW_HEIGHT);
   glTextureParameterfv(vshadowDepthGoodFormat, GL_TEXTURE_BORDER_COLOR, txzeros);
   glTextureParameteri(vshadowDepthGoodFormat, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -796,18 +1338,28 @@ void Renderer::CreateFramebuffers()
   glTextureParameteri(vshadowDepthGoodFormat, GL_TEXTURE_MIN_FILTER, shadow_gen_mips ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTextureParameteri(vshadowDepthGoodFormat, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTextureParameterf(vshadowDepthGoodFormat, GL_TEXTURE_MAX_ANISOTROPY, deviceAnisotropy);
-  glCreateFramebuffers(1, &vshadowGoodFormatFbo);
-  glNamedFramebufferTexture(vshadowGoodFormatFbo, GL_COLOR_ATTACHMENT0, vshadowDepthGoodFormat, 0);
-  glNamedFramebufferDrawBuffer(vshadowGoodFormatFbo, GL_COLOR_ATTACHMENT0);
-  if (GLenum status = glCheckNamedFramebufferStatus(vshadowGoodFormatFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  for (int c = 0; c < MAX_SHADOW_CASCADES; c++)
   {
-    throw std::runtime_error("Failed to create VSM framebuffer");
+    glGenTextures(1, &vshadowDepthGoodFormatViews[c]);
+    glTextureView(vshadowDepthGoodFormatViews[c], GL_TEXTURE_2D, vshadowDepthGoodFormat, GL_RG32F, 0, SHADOW_LEVELS, c, 1);
+    glCreateFramebuffers(1, &vshadowGoodFormatFbos[c]);
+    glNamedFramebufferTextureLayer(vshadowGoodFormatFbos[c], GL_COLOR_ATTACHMENT0, vshadowDepthGoodFormat, 0, c);
+    glNamedFramebufferDrawBuffer(vshadowGoodFormatFbos[c], GL_COLOR_ATTACHMENT0);
+    if (GLenum status = glCheckNamedFramebufferStatus(vshadowGoodFormatFbos[c], GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+    {
+      throw std::runtime_error("Failed to create VSM framebuffer");
+    }
   }
-
-  // ESM textures + fbo
-  glCreateTextures(GL_TEXTURE_2D, 1, &eExpShadowDepth);
+  // integer textures are only complete with nearest filtering
+  glGenTextures(1, &vshadowMomentsSAT);
+  glTextureView(vshadowMomentsSAT, GL_TEXTURE_2D_ARRAY, vshadowDepthGoodFormat, GL_RG32UI, 0, 1, 0, MAX_SHADOW_CASCADES);
+  glTextureParameteri(vshadowMomentsSAT, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(vshadowMomentsSAT, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  // ESM textures + fbos
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &eExpShadowDepth);
   glCreateTextures(GL_TEXTURE_2D, 1, &eShadowDepthBlur);
-  glTextureStorage2D(eExpShadowDepth, SHADOW_LEVELS, GL_R32F, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glTextureStorage3D(eExpShadowDepth, SHADOW_LEVELS, GL_R32F, SHADOW_WIDTH, SHADOW_HEIGHT, MAX_SHADOW_CASCADES);
   glTextureStorage2D(eShadowDepthBlur, 1, GL_R32F, SHADOW_WIDTH, SHADOW_HEIGHT);
   glTextureParameterfv(eExpShadowDepth, GL_TEXTURE_BORDER_COLOR, txzeros);
   glTextureParameteri(eExpShadowDepth, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -815,18 +1367,23 @@ void Renderer::CreateFramebuffers()
   glTextureParameteri(eExpShadowDepth, GL_TEXTURE_MIN_FILTER, shadow_gen_mips ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTextureParameteri(eExpShadowDepth, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTextureParameterf(eExpShadowDepth, GL_TEXTURE_MAX_ANISOTROPY, deviceAnisotropy);
-  glCreateFramebuffers(1, &eShadowFbo);
-  glNamedFramebufferTexture(eShadowFbo, GL_COLOR_ATTACHMENT0, eExpShadowDepth, 0);
-  glNamedFramebufferDrawBuffer(eShadowFbo, GL_COLOR_ATTACHMENT0);
-  if (GLenum status = glCheckNamedFramebufferStatus(eShadowFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  for (int c = 0; c < MAX_SHADOW_CASCADES; c++)
   {
-    throw std::runtime_error("Failed to create ESM framebuffer");
+    glGenTextures(1, &eExpShadowDepthViews[c]);
+    glTextureView(eExpShadowDepthViews[c], GL_TEXTURE_2D, eExpShadowDepth, GL_R32F, 0, SHADOW_LEVELS, c, 1);
+    glCreateFramebuffers(1, &eShadowFbos[c]);
+    glNamedFramebufferTextureLayer(eShadowFbos[c], GL_COLOR_ATTACHMENT0, eExpShadowDepth, 0, c);
+    glNamedFramebufferDrawBuffer(eShadowFbos[c], GL_COLOR_ATTACHMENT0);
+    if (GLenum status = glCheckNamedFramebufferStatus(eShadowFbos[c], GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+    {
+      throw std::runtime_error("Failed to create ESM framebuffer");
+    }
   }
 
-  // MSM textures + fbo
-  glCreateTextures(GL_TEXTURE_2D, 1, &msmShadowMoments);
+  // MSM textures + fbos
+  glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &msmShadowMoments);
   glCreateTextures(GL_TEXTURE_2D, 1, &msmShadowMomentsBlur);
-  glTextureStorage2D(msmShadowMoments, SHADOW_LEVELS, GL_RGBA32F, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glTextureStorage3D(msmShadowMoments, SHADOW_LEVELS, GL_RGBA32F, SHADOW_WIDTH, SHADOW_HEIGHT, MAX_SHADOW_CASCADES);
   glTextureStorage2D(msmShadowMomentsBlur, 1, GL_RGBA32F, SHADOW_WIDTH, SHADOW_HEIGHT);
   glTextureParameterfv(msmShadowMoments, GL_TEXTURE_BORDER_COLOR, txzeros);
   glTextureParameteri(msmShadowMoments, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -834,13 +1391,22 @@ void Renderer::CreateFramebuffers()
   glTextureParameteri(msmShadowMoments, GL_TEXTURE_MIN_FILTER, shadow_gen_mips ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
   glTextureParameteri(msmShadowMoments, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTextureParameterf(msmShadowMoments, GL_TEXTURE_MAX_ANISOTROPY, deviceAnisotropy);
-  glCreateFramebuffers(1, &msmShadowFbo);
-  glNamedFramebufferTexture(msmShadowFbo, GL_COLOR_ATTACHMENT0, msmShadowMoments, 0);
-  glNamedFramebufferDrawBuffer(msmShadowFbo, GL_COLOR_ATTACHMENT0);
-  if (GLenum status = glCheckNamedFramebufferStatus(msmShadowFbo, GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+  for (int c = 0; c < MAX_SHADOW_CASCADES; c++)
   {
-    throw std::runtime_error("Failed to create MSM framebuffer");
+    glGenTextures(1, &msmShadowMomentsViews[c]);
+    glTextureView(msmShadowMomentsViews[c], GL_TEXTURE_2D, msmShadowMoments, GL_RGBA32F, 0, SHADOW_LEVELS, c, 1);
+    glCreateFramebuffers(1, &msmShadowFbos[c]);
+    glNamedFramebufferTextureLayer(msmShadowFbos[c], GL_COLOR_ATTACHMENT0, msmShadowMoments, 0, c);
+    glNamedFramebufferDrawBuffer(msmShadowFbos[c], GL_COLOR_ATTACHMENT0);
+    if (GLenum status = glCheckNamedFramebufferStatus(msmShadowFbos[c], GL_FRAMEBUFFER); status != GL_FRAMEBUFFER_COMPLETE)
+    {
+      throw std::runtime_error("Failed to create MSM framebuffer");
+    }
   }
+  glGenTextures(1, &msmShadowMomentsSAT);
+  glTextureView(msmShadowMomentsSAT, GL_TEXTURE_2D_ARRAY, msmShadowMoments, GL_RGBA32UI, 0, 1, 0, MAX_SHADOW_CASCADES);
+  glTextureParameteri(msmShadowMomentsSAT, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTextureParameteri(msmShadowMomentsSAT, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
   // create texture attachments for gBuffer FBO
   glCreateTextures(GL_TEXTURE_2D, 1, &gAlbedo);
@@ -868,6 +1434,20 @@ void Renderer::CreateFramebuffers()
     throw std::runtime_error("Failed to create gbuffer framebuffer");
   }
 
+  // power of two sizes, so every level halves exactly
+  hiZSize = { static_cast<int>(std::bit_floor(unsigned(WINDOW_WIDTH))), static_cast<int>(std::bit_floor(unsigned(WINDOW_HEIGHT))) };
+  hiZLevels = static_cast<int>(std::bit_width(unsigned(glm::max(hiZSize.x, hiZSize.y))));
+  glCreateTextures(GL_TEXTURE_2D, 1, &hiZ);
+  glTextureStorage2D(hiZ, hiZLevels, GL_RG32F, hiZSize.x, hiZSize.y);
+  glTextureParameteri(hiZ, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTextureParameteri(hiZ, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTextureParameteri(hiZ, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(hiZ, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  softwareOcclusion = std::make_unique<SoftwareOcclusion>(320, 180);
+  glCreateTextures(GL_TEXTURE_2D, 1, &softwareOcclusionTex);
+  glTextureStorage2D(softwareOcclusionTex, 1, GL_R8, softwareOcclusion->GetWidth(), softwareOcclusion->GetHeight());
+
   // create postprocess (HDR) framebuffer
   glCreateTextures(GL_TEXTURE_2D, 1, &postprocessColor);
   glTextureStorage2D(postprocessColor, 1, GL_RGBA16F, WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -927,6 +1507,9 @@ void Renderer::Cleanup()
 
   glDeleteVertexArrays(1, &vao);
 
+  textureResidency.reset();
+  materialManager.Clear();
+
   // do not gaze at it too closely
   glDeleteTextures(1, &volumetrics.tex);
   glDeleteTextures(1, &volumetrics.texBlur);
@@ -939,6 +1522,8 @@ void Renderer::Cleanup()
   glDeleteTextures(1, &gNormal);
   glDeleteTextures(1, &gDepth);
   glDeleteTextures(1, &gRMA);
+  glDeleteTextures(1, &hiZ);
+  glDeleteTextures(1, &softwareOcclusionTex);
   glDeleteFramebuffers(1, &gfbo);
 
   glDeleteTextures(1, &postprocessColor);
@@ -948,20 +1533,48 @@ void Renderer::Cleanup()
   glDeleteTextures(1, &ssr.texBlur);
   glDeleteFramebuffers(1, &ssr.fbo);
 
+  glDeleteTextures(MAX_SHADOW_CASCADES, shadowDepthViews.data());
   glDeleteTextures(1, &shadowDepth);
-  glDeleteFramebuffers(1, &shadowFbo);
+  glDeleteFramebuffers(MAX_SHADOW_CASCADES, shadowFbos.data());
+  glDeleteTextures(1, &dynamicShadowDepth);
+  glDeleteTextures(1, &pointShadowAtlasTex);
+  glDeleteFramebuffers(1, &pointShadowFbo);
+  glDeleteTextures(1, &vsmPool);
+  glDeleteFramebuffers(1, &vsmPoolFbo);
+  for (int i = 0; i < VSM_READBACK_FRAMES; i++)
+  {
+    glDeleteSync(vsmReadbackFences[i]);
+    glDeleteBuffers(1, &vsmReadbackBuffers[i]);
+  }
+  for (int i = 0; i < CLUSTER_READBACK_FRAMES; i++)
+  {
+    glDeleteSync(clusterReadbackFences[i]);
+    glDeleteBuffers(1, &clusterReadbackBuffers[i]);
+  }
+  glDeleteQueries(CLUSTER_READBACK_FRAMES, clusterTimerQueries.data());
+  for (int i = 0; i < VISIBILITY_READBACK_FRAMES; i++)
+  {
+    glDeleteSync(visibilityReadbackFences[i]);
+    glDeleteBuffers(1, &visibilityReadbackBuffers[i]);
+  }
+  glDeleteFramebuffers(MAX_SHADOW_CASCADES, dynamicShadowFbos.data());
 
+  glDeleteTextures(MAX_SHADOW_CASCADES, vshadowDepthGoodFormatViews.data());
   glDeleteTextures(1, &vshadowDepthGoodFormat);
   glDeleteTextures(1, &vshadowMomentBlur);
-  glDeleteFramebuffers(1, &vshadowGoodFormatFbo);
+  glDeleteTextures(1, &vshadowMomentsSAT);
+  glDeleteFramebuffers(MAX_SHADOW_CASCADES, vshadowGoodFormatFbos.data());
 
+  glDeleteTextures(MAX_SHADOW_CASCADES, eExpShadowDepthViews.data());
   glDeleteTextures(1, &eExpShadowDepth);
   glDeleteTextures(1, &eShadowDepthBlur);
-  glDeleteFramebuffers(1, &eShadowFbo);
+  glDeleteFramebuffers(MAX_SHADOW_CASCADES, eShadowFbos.data());
 
+  glDeleteTextures(MAX_SHADOW_CASCADES, msmShadowMomentsViews.data());
   glDeleteTextures(1, &msmShadowMoments);
   glDeleteTextures(1, &msmShadowMomentsBlur);
-  glDeleteFramebuffers(1, &msmShadowFbo);
+  glDeleteTextures(1, &msmShadowMomentsSAT);
+  glDeleteFramebuffers(MAX_SHADOW_CASCADES, msmShadowFbos.data());
 
   glDeleteTextures(1, &hdr.colorTex);
   glDeleteTextures(1, &hdr.depthTex);
@@ -971,7 +1584,8 @@ void Renderer::Cleanup()
   glDeleteTextures(1, &ssao.texture);
   glDeleteTextures(1, &ssao.textureBlurred);
 
-  glDeleteTextures(1, &irradianceMap);
+  environment.reset();
+  glDeleteTextures(1, &brdfLUT);
 
   glfwDestroyWindow(window);
   glfwTerminate();
@@ -1019,7 +1633,6 @@ void Renderer::DrawUI(float dt)
       ImGui::Checkbox("Material Override", &materialOverride);
       ImGui::Checkbox("Override AO", &AOoverride);
       ImGui::Checkbox("Draw PBR Grid", &drawPbrSphereGridQuestionMark);
-      ImGui::SliderInt("Num Env Samples", &numEnvSamples, 1, 100);
       ImGui::ColorEdit3("Albedo Override", &albedoOverride[0]);
       ImGui::SliderFloat("Roughness Override", &roughnessOverride, 0.0f, 1.0f);
       ImGui::SliderFloat("Metalness Override", &metalnessOverride, 0.0f, 1.0f);
@@ -1030,7 +1643,26 @@ void Renderer::DrawUI(float dt)
 
   if (ImGui::TreeNode("Scene-Data"))
   {
-    ImGui::SliderInt("Local lights", &numLights, 0, 40000);
+    ImGui::SliderInt("Local lights", &numLights, 0, 100000);
+    ImGui::Text("Local Light Shading");
+    ImGui::RadioButton("Light Volumes", &localLightsMethod, LOCAL_LIGHTS_VOLUMES);
+    ImGui::SameLine();
+    ImGui::RadioButton("Clustered (GPU)", &localLightsMethod, LOCAL_LIGHTS_CLUSTERED_GPU);
+    ImGui::SameLine();
+    ImGui::RadioButton("Clustered (CPU)", &localLightsMethod, LOCAL_LIGHTS_CLUSTERED_CPU);
+    if (localLightsMethod == LOCAL_LIGHTS_CLUSTERED_CPU)
+    {
+      ImGui::Text("Cluster build: %.3f ms, %zu light indices", clusterBuildTime * 1000.0, cpuLightClusters.indices.size());
+    }
+    if (localLightsMethod != LOCAL_LIGHTS_VOLUMES)
+    {
+      ImGui::Text("Clusters GPU: %.3f ms", clusterGpuTime * 1000.0);
+      ImGui::Text("Light indices: %u needed, %u allocated", clusterIndicesNeeded, clusterIndexCapacity);
+      if (clusterIndicesDropped > 0)
+      {
+        ImGui::TextColored(ImVec4(1, .3f, .3f, 1), "%u light indices dropped, some clusters are missing lights", clusterIndicesDropped);
+      }
+    }
     ImGui::SliderFloat("Light Cutoff", &lightVolumeThreshold, 0.001f, 0.1f);
     if (ImGui::SliderFloat2("Light Falloff", glm::value_ptr(lightFalloff), 0.01f, 10.0f, "%.3f", 2.0f))
     {
@@ -1040,6 +1672,57 @@ void Renderer::DrawUI(float dt)
       }
     }
 
+    ImGui::Text("Scene load time: %.0f ms", sceneLoadTime * 1000);
+    ImGui::Text("Frustum Culling");
+    ImGui::RadioButton("None", &cullingMethod, CULLING_METHOD_NONE);
+    ImGui::SameLine();
+    ImGui::RadioButton("CPU (SSE)", &cullingMethod, CULLING_METHOD_CPU);
+    ImGui::SameLine();
+    ImGui::RadioButton("GPU", &cullingMethod, CULLING_METHOD_GPU);
+    if (cullingMethod == CULLING_METHOD_CPU)
+    {
+      ImGui::Checkbox("Use BVH", &cullWithBVH);
+      if (cullWithBVH)
+      {
+        ImGui::SameLine();
+        ImGui::Text("%zu nodes, SAH cost %.1f, %d rebuilds", sceneBVH.NumNodes(), sceneBVH.GetCost(), bvhRebuilds);
+      }
+      ImGui::Checkbox("Occlusion Culling (software)", &softwareOcclusionCulling);
+      ImGui::Text("Visible meshes: %zu / %zu (%.3f ms)", numVisibleMeshes, meshBounds.Size(), cullTime * 1000.0);
+      ImGui::Text("Shadow casters drawn: %zu", numShadowCasters);
+      if (softwareOcclusionCulling)
+      {
+        ImGui::Text("Occluders: %zu meshes, %zu triangles (%.3f ms)", occluders.size(), softwareOcclusion->NumTriangles(), softwareOcclusionTime * 1000.0);
+      }
+    }
+    if (cullingMethod == CULLING_METHOD_GPU)
+    {
+      ImGui::Checkbox("Occlusion Culling (Hi-Z)", &occlusionCulling);
+    }
+    if (ImGui::Button("Benchmark Culling (100k boxes)"))
+    {
+      cullingBenchmark = BenchmarkCulling(100'000);
+    }
+    if (cullingBenchmark.numBoxes > 0)
+    {
+      ImGui::Text("SSE: %.3f ms, scalar: %.3f ms (%zu visible)",
+        cullingBenchmark.simdTime * 1000.0, cullingBenchmark.scalarTime * 1000.0, cullingBenchmark.numVisible);
+    }
+    if (ImGui::Button("Benchmark Software Occlusion"))
+    {
+      softwareOcclusionBenchmark = BenchmarkSoftwareOcclusion(100'000, 10'000);
+    }
+    if (softwareOcclusionBenchmark.numTriangles > 0)
+    {
+      ImGui::Text("Raster: %.0f triangles/ms, test: %.0f boxes/ms",
+        softwareOcclusionBenchmark.numTriangles / (softwareOcclusionBenchmark.rasterTime * 1000.0),
+        softwareOcclusionBenchmark.numBoxes / (softwareOcclusionBenchmark.testTime * 1000.0));
+    }
+    ImGui::Text("Resident textures: %.0f / %.0f MB", textureResidency->GetResidentBytes() / 1048576.0, textureResidency->GetTotalBytes() / 1048576.0);
+    if (ImGui::SliderInt("Texture Budget (MB)", &textureBudgetMB, 1, 4096))
+    {
+      textureResidency->SetBudget(size_t(textureBudgetMB) << 20);
+    }
     if (ImGui::Button("Load Scene 1"))
     {
       LoadScene1();
@@ -1066,6 +1749,8 @@ void Renderer::DrawUI(float dt)
 
   if (ImGui::TreeNode("Environment Map"))
   {
+    ImGui::Checkbox("Project SH on GPU", &projectSHOnGPU);
+    ImGui::Text("SH projection: %.2f ms", environment->GetSHProjectionTime() * 1000.0);
     for (auto& p : fss::directory_iterator("Resources/IBL"))
     {
       std::string str = p.path().string();
@@ -1085,9 +1770,15 @@ void Renderer::DrawUI(float dt)
     ImGui::RadioButton("gNormal", &uiViewBuffer, gNormal);
     ImGui::RadioButton("gDepth", &uiViewBuffer, gDepth);
     ImGui::RadioButton("gRMA", &uiViewBuffer, gRMA);
+    ImGui::RadioButton("hiZ", &uiViewBuffer, hiZ);
+    ImGui::RadioButton("softwareOcclusionTex", &uiViewBuffer, softwareOcclusionTex);
     ImGui::RadioButton("hdr.colorTex", &uiViewBuffer, hdr.colorTex);
     ImGui::RadioButton("hdr.depthTex", &uiViewBuffer, hdr.depthTex);
-    ImGui::RadioButton("shadowDepthGoodFormat", &uiViewBuffer, vshadowDepthGoodFormat);
+    for (int c = 0; c < numCascades; c++)
+    {
+      ImGui::RadioButton(("shadowDepth[" + std::to_string(c) + "]").c_str(), &uiViewBuffer, shadowDepthViews[c]);
+    }
+    ImGui::RadioButton("shadowDepthGoodFormat", &uiViewBuffer, vshadowDepthGoodFormatViews[0]);
     ImGui::RadioButton("volumetrics.atrousTex", &uiViewBuffer, volumetrics.atrousTex);
     ImGui::RadioButton("volumetrics.tex", &uiViewBuffer, volumetrics.tex);
     ImGui::RadioButton("postprocessColor", &uiViewBuffer, postprocessColor);
@@ -1215,8 +1906,33 @@ void Renderer::DrawUI(float dt)
     ImGui::RadioButton("MSM", &shadow_method, SHADOW_METHOD_MSM);
     ImGui::Separator();
 
+    ImGui::SliderInt("Cascades", &numCascades, 1, MAX_SHADOW_CASCADES);
+    ImGui::SliderFloat("Shadow Distance", &shadowDistance, 10.0f, 300.0f);
+    ImGui::SliderFloat("Split Lambda", &cascadeSplitLambda, 0.0f, 1.0f, "%.2f");
+    ImGui::Checkbox("Show Cascades", &showCascades);
+    ImGui::Checkbox("Cache Static Shadows", &cacheStaticShadows);
+    ImGui::Text("Cascades redrawn this frame: %d", cascadesRedrawn);
+    ImGui::Separator();
+
+    ImGui::Checkbox("Summed-Area Tables (VSM, MSM)", &useSummedAreaTables);
+    if (useSummedAreaTables)
+    {
+      ImGui::SliderFloat("Light Size", &lightSize, 0.0f, 0.1f, "%.3f");
+      ImGui::SliderFloat("Max Filter Radius", &maxShadowFilterRadius, 1.0f, 64.0f, "%.0f texels");
+    }
     ImGui::SliderInt("Blur Passes", &BLUR_PASSES, 0, 5);
     ImGui::SliderInt("Blur Width", &BLUR_STRENGTH, 0, 6);
+    if (ImGui::Button("Benchmark Blur"))
+    {
+      blurBenchmarks = { BenchmarkBlur(1024, BLUR_PASSES, BLUR_STRENGTH), BenchmarkBlur(4096, BLUR_PASSES, BLUR_STRENGTH) };
+    }
+    for (const auto& benchmark : blurBenchmarks)
+    {
+      if (benchmark.size > 0)
+      {
+        ImGui::Text("%d^2: shared %.3f ms, per tap %.3f ms", benchmark.size, benchmark.sharedTime * 1000.0, benchmark.referenceTime * 1000.0);
+      }
+    }
     ImGui::SliderFloat("(VSM) Hardness", &vlightBleedFix, 0.0f, 1.0f, "%.3f");
     ImGui::SliderFloat("(ESM) C", &eConstant, 60, 90);
     if (ImGui::Checkbox("Generate Mips", &shadow_gen_mips))
@@ -1232,6 +1948,27 @@ void Renderer::DrawUI(float dt)
         glTextureParameteri(eExpShadowDepth, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
       }
     }
+    ImGui::Separator();
+
+    ImGui::Checkbox("Virtual Shadow Map", &virtualShadows);
+    if (virtualShadows)
+    {
+      ImGui::TextUnformatted("Hardware PCF, replaces the cascades' filter where mapped");
+      ImGui::SliderInt("Pages Per Frame", &vsmPagesPerFrame, 1, 256);
+      const float pageMB = VirtualShadowPages::PAGE_SIZE * VirtualShadowPages::PAGE_SIZE * sizeof(float) / (1024.0f * 1024.0f);
+      ImGui::Text("Mapped pages: %d / %d (%.0f MB), drawn this frame: %d", vsmPages.NumMapped(), VirtualShadowPages::NUM_PHYSICAL_PAGES,
+        vsmPages.NumMapped() * pageMB, vsmPagesUpdated);
+    }
+    ImGui::Separator();
+
+    ImGui::Checkbox("Point Light Shadows", &pointShadows);
+    if (pointShadows)
+    {
+      ImGui::SliderInt("Max Shadowed Lights", &maxShadowedLights, 0, static_cast<int>(pointShadowAtlas.NumSlots()));
+      ImGui::SliderInt("Updates Per Frame", &pointShadowUpdatesPerFrame, 1, 32);
+      const auto shadowed = std::count_if(lightShadowSlots.begin(), lightShadowSlots.end(), [](int32_t s) { return s >= 0; });
+      ImGui::Text("Shadowed lights: %d, updated this frame: %d", static_cast<int>(shadowed), pointShadowsUpdated);
+    }
 
     ImGui::TreePop();
   }
@@ -1340,6 +2077,9 @@ void Renderer::Scene1Lights()
   }
   lightSSBO = std::make_unique<StaticBuffer>(localLights.data(), glm::max(size_t(1),
     localLights.size() * sizeof(PointLight)), GL_DYNAMIC_STORAGE_BIT);
+  lightShadowSlots.assign(localLights.size(), -1);
+  lightShadowSlotsBuffer = std::make_unique<StaticBuffer>(lightShadowSlots.data(), glm::max(size_t(1),
+    lightShadowSlots.size() * sizeof(int32_t)), GL_DYNAMIC_STORAGE_BIT);
 }
 
 void Renderer::Scene2Lights()
@@ -1358,10 +2098,14 @@ void Renderer::Scene2Lights()
 
   lightSSBO = std::make_unique<StaticBuffer>(localLights.data(), glm::max(size_t(1),
     localLights.size() * sizeof(PointLight)), GL_DYNAMIC_STORAGE_BIT);
+  lightShadowSlots.assign(localLights.size(), -1);
+  lightShadowSlotsBuffer = std::make_unique<StaticBuffer>(lightShadowSlots.data(), glm::max(size_t(1),
+    lightShadowSlots.size() * sizeof(int32_t)), GL_DYNAMIC_STORAGE_BIT);
 }
 
 void Renderer::LoadScene1()
 {
+  Timer loadTimer;
   cam.SetPos({ 59.4801331f, 5.45370150f, -6.37605810f });
   cam.SetPitch(-2.98514581f);
   cam.SetYaw(175.706055f);
@@ -1370,6 +2114,8 @@ void Renderer::LoadScene1()
   vertexBuffer->Clear();
   indexBuffer->Clear();
   batchedObjects.clear();
+  materialManager.Clear();
+  textureResidency->Clear();
   Scene1Lights();
 
   LoadEnvironmentMap("Resources/IBL/14-Hamarikyu_Bridge_B_3k.hdr");
@@ -1378,29 +2124,8 @@ void Renderer::LoadScene1()
 
   auto terrain2 = LoadObjBatch("Resources/Models/sponza/sponza.obj", materialManager, *vertexBuffer, *indexBuffer);
 
-  auto tempMatsStr = materialManager.GetLinearMaterials();
-  for (size_t i = 0; i < tempMatsStr.size(); i++)
-  {
-    if (sphereBatched.materialName == tempMatsStr[i].first)
-    {
-      sphereBatched.materialIndex = i;
-      break;
-    }
-  }
-
   ObjectBatched terrain2b;
-  for (auto& mesh : terrain2)
-  {
-    for (size_t i = 0; i < tempMatsStr.size(); i++)
-    {
-      if (mesh.materialName == tempMatsStr[i].first)
-      {
-        mesh.materialIndex = i;
-        break;
-      }
-    }
-    terrain2b.meshes.push_back(mesh);
-  }
+  terrain2b.meshes = std::move(terrain2);
   terrain2b.transform.scale = glm::vec3(.05f);
   batchedObjects.push_back(terrain2b);
 
@@ -1412,14 +2137,17 @@ void Renderer::LoadScene1()
     a.transform.rotation;
     a.transform.translation = 2.0f * glm::vec3(glm::cos(glm::two_pi<float>() / num_spheres * i), 1.0f, glm::sin(glm::two_pi<float>() / num_spheres * i));
     a.transform.scale = glm::vec3(1.0f);
+    a.isStatic = false;
     batchedObjects.push_back(a);
   }
 
   SetupBuffers();
+  sceneLoadTime = loadTimer.elapsed();
 }
 
 void Renderer::LoadScene2()
 {
+  Timer loadTimer;
   cam.SetPos({ 4.1f, 2.6f, 2.5f });
   cam.SetPitch(-13.0f);
   cam.SetYaw(209.0f);
@@ -1428,6 +2156,8 @@ void Renderer::LoadScene2()
   vertexBuffer->Clear();
   indexBuffer->Clear();
   batchedObjects.clear();
+  materialManager.Clear();
+  textureResidency->Clear();
   Scene2Lights();
 
   LoadEnvironmentMap("Resources/IBL/Arches_E_PineTree_3k.hdr");
@@ -1435,45 +2165,19 @@ void Renderer::LoadScene2()
   //auto model = LoadObjBatch("Resources/Models/avocado/avocado.obj", materialManager, *vertexBuffer, *indexBuffer);
   auto model = LoadObjBatch("Resources/Models/motorcycle/Srad 750.obj", materialManager, *vertexBuffer, *indexBuffer);
 
-  auto tempMatsStr = materialManager.GetLinearMaterials();
-
   ObjectBatched modelbatched;
-  for (auto& mesh : model)
-  {
-    for (size_t i = 0; i < tempMatsStr.size(); i++)
-    {
-      if (mesh.materialName == tempMatsStr[i].first)
-      {
-        mesh.materialIndex = i;
-        break;
-      }
-    }
-    modelbatched.meshes.push_back(mesh);
-  }
+  modelbatched.meshes = std::move(model);
   modelbatched.transform.scale = glm::vec3(2);
   batchedObjects.push_back(modelbatched);
 
   SetupBuffers();
+  sceneLoadTime = loadTimer.elapsed();
 }
 
 void Renderer::SetupBuffers()
 {
-  // setup material buffer
-  auto tempMatsStr = materialManager.GetLinearMaterials();
-  std::vector<BindlessMaterial> tempMats;
-  for (const auto& matp : tempMatsStr)
-  {
-    BindlessMaterial bm
-    {
-      .albedoHandle = matp.second.albedoTex->GetBindlessHandle(),
-      .roughnessHandle = matp.second.roughnessTex->GetBindlessHandle(),
-      .metalnessHandle = matp.second.metalnessTex->GetBindlessHandle(),
-      .normalHandle = matp.second.normalTex->GetBindlessHandle(),
-      .ambientOcclusionHandle = matp.second.ambientOcclusionTex->GetBindlessHandle(),
-    };
-    tempMats.push_back(bm);
-  }
-  materialsBuffer = std::make_unique<StaticBuffer>(tempMats.data(), tempMats.size() * sizeof(BindlessMaterial), 0);
+  // upload materials added since the last call
+  textureResidency->AddMaterials(materialManager.GetMaterials());
 
   // setup indirect draw buffer
   std::vector<DrawElementsIndirectCommand> cmds;
@@ -1496,55 +2200,494 @@ void Renderer::SetupBuffers()
     }
   }
   drawIndirectBuffer = std::make_unique<StaticBuffer>(cmds.data(), sizeof(DrawElementsIndirectCommand) * cmds.size(), 0);
+  cameraDrawCommands = cmds;
+  cameraDrawIndirectBuffer = std::make_unique<StaticBuffer>(cmds.data(), sizeof(DrawElementsIndirectCommand) * cmds.size(), GL_DYNAMIC_STORAGE_BIT);
+  shadowDrawCommands.clear();
+  for (int set = 0; set < MAX_SHADOW_CASCADES * 2; set++)
+  {
+    shadowDrawCommands.insert(shadowDrawCommands.end(), cmds.begin(), cmds.end());
+  }
+  drawIsDynamic.clear();
+  for (const auto& obj : batchedObjects)
+  {
+    drawIsDynamic.insert(drawIsDynamic.end(), obj.meshes.size(), obj.isStatic ? 0 : 1);
+  }
+  staticShadowsDirty = true;
+  shadowDrawIndirectBuffer = std::make_unique<StaticBuffer>(shadowDrawCommands.data(), sizeof(DrawElementsIndirectCommand) * shadowDrawCommands.size(), GL_DYNAMIC_STORAGE_BIT);
+
+  // inputs and outputs of GPU culling
+  std::vector<glm::vec4> bounds;
+  for (const auto& obj : batchedObjects)
+  {
+    for (const auto& mesh : obj.meshes)
+    {
+      bounds.push_back(glm::vec4(mesh.boundsMin, obj.isStatic ? 0 : 1));
+      bounds.push_back(glm::vec4(mesh.boundsMax, 0));
+    }
+  }
+  drawBoundsBuffer = std::make_unique<StaticBuffer>(bounds.data(), sizeof(glm::vec4) * bounds.size(), 0);
+  gpuCameraCommands = std::make_unique<StaticBuffer>(nullptr, sizeof(DrawElementsIndirectCommand) * cmds.size(), 0);
+  gpuCameraLateCommands = std::make_unique<StaticBuffer>(nullptr, sizeof(DrawElementsIndirectCommand) * cmds.size(), 0);
+  for (auto& commands : gpuShadowCommands)
+  {
+    commands = std::make_unique<StaticBuffer>(nullptr, sizeof(DrawElementsIndirectCommand) * cmds.size(), 0);
+  }
+  gpuDrawCounts = std::make_unique<StaticBuffer>(nullptr, sizeof(GLuint) * (DRAW_COUNT_DYNAMIC_SHADOW + MAX_SHADOW_CASCADES), 0);
+
+  SelectOccluders();
+
+  // everything starts out visible, so the first frame's early pass draws all of it
+  std::vector<GLuint> visibility(cmds.size(), 1);
+  drawVisibility = std::make_unique<StaticBuffer>(visibility.data(), sizeof(GLuint) * visibility.size(), 0);
+  const GLsizeiptr readbackSize = sizeof(GLuint) * std::max<size_t>(cmds.size(), 1);
+  const GLbitfield readbackFlags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  for (int i = 0; i < VISIBILITY_READBACK_FRAMES; i++)
+  {
+    glDeleteSync(visibilityReadbackFences[i]);
+    visibilityReadbackFences[i] = nullptr;
+    glDeleteBuffers(1, &visibilityReadbackBuffers[i]);
+    glCreateBuffers(1, &visibilityReadbackBuffers[i]);
+    glNamedBufferStorage(visibilityReadbackBuffers[i], readbackSize, nullptr, readbackFlags);
+    visibilityReadbackData[i] = static_cast<const uint32_t*>(glMapNamedBufferRange(visibilityReadbackBuffers[i], 0, readbackSize, readbackFlags));
+  }
+  gpuDrawVisible.clear();
 }
 
 void Renderer::LoadEnvironmentMap(std::string path)
 {
-  TextureCreateInfo info
+  environment = std::make_unique<Environment>(path, projectSHOnGPU);
+
+  // the BRDF's half of the split sum doesn't depend on the environment
+  if (!brdfLUT)
   {
-    .path = path,
-    .sRGB = false,
-    .generateMips = true,
-    .HDR = true,
-    .minFilter = GL_LINEAR_MIPMAP_LINEAR,
-    .magFilter = GL_LINEAR,
+    brdfLUT = createBRDFLUT(256, 1024);
+  }
+}
+
+void Renderer::SelectOccluders()
+{
+  // the meshes with the largest bounds make the best occluders. Their geometry is read back
+  // once here, the software rasterizer needs it on the CPU
+  struct Candidate
+  {
+    size_t objectIndex;
+    const MeshInfo* mesh;
+    float area;
   };
+  std::vector<Candidate> candidates;
+  occludersAwaitTextures = false;
+  const auto& materials = materialManager.GetMaterials();
+  for (size_t o = 0; o < batchedObjects.size(); o++)
+  {
+    const glm::vec3 scale = batchedObjects[o].transform.scale;
+    for (const auto& mesh : batchedObjects[o].meshes)
+    {
+      // the gbuffer discards texels with low alpha (foliage, chains, curtains), which things behind
+      // must stay visible through. Meshes whose albedo is still decoding are reconsidered once it's in
+      const auto& albedo = mesh.materialIndex < materials.size() ? materials[mesh.materialIndex].albedoTex : nullptr;
+      if (albedo && !albedo->Valid())
+      {
+        occludersAwaitTextures = true;
+        continue;
+      }
+      if (albedo && albedo->HasAlpha())
+      {
+        continue;
+      }
+      const glm::vec3 size = (mesh.boundsMax - mesh.boundsMin) * scale;
+      candidates.push_back({ o, &mesh, size.x * size.y + size.y * size.z + size.z * size.x });
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.area > b.area; });
+
+  occluders.clear();
+  size_t numTriangles = 0;
+  for (const auto& candidate : candidates)
+  {
+    const auto& vtxInfo = vertexBuffer->GetAlloc(candidate.mesh->verticesAllocHandle);
+    const auto& idxInfo = indexBuffer->GetAlloc(candidate.mesh->indicesAllocHandle);
+    const size_t meshTriangles = idxInfo.size / sizeof(uint32_t) / 3;
+    if (occluders.size() >= MAX_OCCLUDERS || numTriangles + meshTriangles > MAX_OCCLUDER_TRIANGLES)
+    {
+      continue;
+    }
+    numTriangles += meshTriangles;
+
+    std::vector<Vertex> vertices(vtxInfo.size / sizeof(Vertex));
+    Occluder occluder{ .objectIndex = candidate.objectIndex, .indices = std::vector<uint32_t>(idxInfo.size / sizeof(uint32_t)) };
+    glGetNamedBufferSubData(vertexBuffer->GetBufferHandle(), vtxInfo.offset, vtxInfo.size, vertices.data());
+    glGetNamedBufferSubData(indexBuffer->GetBufferHandle(), idxInfo.offset, idxInfo.size, occluder.indices.data());
+    for (const auto& vertex : vertices)
+    {
+      occluder.positions.push_back(vertex.position);
+    }
+    occluders.push_back(std::move(occluder));
+  }
+}
+
+void Renderer::CullDrawsGPU(const glm::mat4& viewProj, const Frustum& frustum, StaticBuffer& objectUniforms, StaticBuffer& outCommands, GLuint countIndex, int pass,
+  int casterFilter)
+{
+  const GLuint numDraws = static_cast<GLuint>(cameraDrawCommands.size());
+  auto& cull = Shader::shaders["cull_draws"];
+  cull->Bind();
+  cull->SetMat4("u_viewProj", viewProj);
+  cull->Set4FloatArray("u_planes[0]", frustum.planes);
+  cull->SetUInt("u_numDraws", numDraws);
+  cull->SetUInt("u_countIndex", countIndex);
+  cull->SetInt("u_pass", pass);
+  cull->SetInt("u_casterFilter", casterFilter);
+  glBindTextureUnit(0, hiZ);
+  objectUniforms.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+  drawBoundsBuffer->BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+  drawIndirectBuffer->BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+  outCommands.BindBase(GL_SHADER_STORAGE_BUFFER, 3);
+  gpuDrawCounts->BindBase(GL_SHADER_STORAGE_BUFFER, 4);
+  drawVisibility->BindBase(GL_SHADER_STORAGE_BUFFER, 5);
+  glDispatchCompute((numDraws + 63) / 64, 1, 1);
+}
+
+void Renderer::FindMovedDraws(const std::vector<ObjectUniforms>& objectUniforms)
+{
+  movedDrawBounds.clear();
+  drawListChanged = prevDrawMatrices.size() != objectUniforms.size();
+  if (!drawListChanged)
+  {
+    for (size_t i = 0; i < objectUniforms.size(); i++)
+    {
+      if (prevDrawMatrices[i] != objectUniforms[i].modelMatrix)
+      {
+        AABB moved = prevMeshWorldBounds[i];
+        moved.Grow(meshWorldBounds[i]);
+        movedDrawBounds.push_back(moved);
+      }
+    }
+  }
+  prevDrawMatrices.resize(objectUniforms.size());
+  for (size_t i = 0; i < objectUniforms.size(); i++)
+  {
+    prevDrawMatrices[i] = objectUniforms[i].modelMatrix;
+  }
+  prevMeshWorldBounds = meshWorldBounds;
+}
+
+void Renderer::UpdatePointShadows(const std::vector<ObjectUniforms>& objectUniforms, StaticBuffer& objectUniformsBuffer)
+{
+  // anything that moved dirties the slots of lights whose radius it was or is now in
+  const size_t numDraws = objectUniforms.size();
+  if (drawListChanged)
+  {
+    pointShadowAtlas.InvalidateAll();
+  }
+  for (const auto& moved : movedDrawBounds)
+  {
+    pointShadowAtlas.InvalidateBox(moved.min, moved.max);
+  }
 
-  envMap_hdri = std::make_unique<Texture2D>(info);
-
-  GLuint samplerID{};
-  glCreateSamplers(1, &samplerID);
-  glSamplerParameteri(samplerID, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glSamplerParameteri(samplerID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glSamplerParameteri(samplerID, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glSamplerParameteri(samplerID, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  //glSamplerParameterf(samplerID, GL_TEXTURE_MIN_LOD, 8.f);
-  //glSamplerParameterf(samplerID, GL_TEXTURE_LOD_BIAS, 1.0f);
-  glBindSampler(0, samplerID);
-
-  float aspectRatio = (float)envMap_hdri->GetSize().x / envMap_hdri->GetSize().y;
-  glm::ivec2 dim;
-  dim.x = aspectRatio * 512;
-  dim.y = dim.x / aspectRatio;
-  if (irradianceMap)
-  {
-    glDeleteTextures(1, &irradianceMap);
-  }
-  glCreateTextures(GL_TEXTURE_2D, 1, &irradianceMap);
-  GLuint levels = (GLuint)glm::ceil(glm::log2((float)glm::min(dim.x, dim.y)));
-  glTextureParameteri(irradianceMap, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTextureParameteri(irradianceMap, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTextureParameteri(irradianceMap, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTextureParameteri(irradianceMap, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTextureParameterf(irradianceMap, GL_TEXTURE_MIN_LOD, 5.5f);
-  //glTextureParameterf(irradianceMap, GL_TEXTURE_LOD_BIAS, 6.0f);
-  glTextureStorage2D(irradianceMap, levels, GL_RGBA16F, dim.x, dim.y);
-
-  convolve_image(envMap_hdri->GetID(), irradianceMap, dim.x, dim.y);
-  glGenerateTextureMipmap(irradianceMap);
-
-  glBindSampler(0, 0);
-  glDeleteSamplers(1, &samplerID);
+  // importance is the light's rough share of the screen times its brightness, lights out of view get none
+  const Frustum frustum = MakeFrustum(cam.GetViewProj());
+  const float tanHalfFov = 1.0f / cam.GetProj()[1][1];
+  std::vector<glm::vec4> spheres(localLights.size());
+  std::vector<float> importance(localLights.size());
+  for (size_t i = 0; i < localLights.size(); i++)
+  {
+    const PointLight& light = localLights[i];
+    const glm::vec4 sphere(glm::vec3(light.position), glm::sqrt(light.radiusSquared));
+    spheres[i] = sphere;
+    bool visible = true;
+    for (const auto& plane : frustum.planes)
+    {
+      visible &= glm::dot(glm::vec3(plane), glm::vec3(sphere)) + plane.w >= -sphere.w;
+    }
+    if (!visible)
+    {
+      continue;
+    }
+    const float distance = glm::distance(glm::vec3(sphere), cam.GetPos());
+    const float coverage = distance <= sphere.w ? 1.0f : glm::min(1.0f, glm::pow(sphere.w / (distance * tanHalfFov), 2.0f));
+    importance[i] = coverage * glm::max(light.diffuse.x, glm::max(light.diffuse.y, light.diffuse.z));
+  }
+  pointShadowAtlas.Assign(spheres, importance, maxShadowedLights);
+  const std::vector<int> updates = pointShadowAtlas.TakeUpdates(pointShadowUpdatesPerFrame);
+  pointShadowsUpdated = static_cast<int>(updates.size());
+
+  std::vector<int32_t> slots(localLights.size());
+  for (uint32_t i = 0; i < slots.size(); i++)
+  {
+    slots[i] = pointShadowAtlas.SlotOfLight(i);
+  }
+  if (slots != lightShadowSlots)
+  {
+    lightShadowSlots = slots;
+    lightShadowSlotsBuffer->SubData(lightShadowSlots.data(), sizeof(int32_t) * lightShadowSlots.size(), 0);
+  }
+
+  if (updates.empty())
+  {
+    return;
+  }
+
+  // one multi-draw per slot of the meshes inside the light's radius. Every command is instanced once
+  // per face and the vertex shader sends instance i to viewport i, which covers face i of the slot
+  std::vector<DrawElementsIndirectCommand> commands;
+  std::vector<std::pair<size_t, size_t>> slotCommands; // first command, count
+  for (int s : updates)
+  {
+    const glm::vec4 sphere = pointShadowAtlas.GetSlots()[s].sphere;
+    const size_t first = commands.size();
+    for (size_t i = 0; i < numDraws; i++)
+    {
+      const glm::vec3 closest = glm::clamp(glm::vec3(sphere), meshWorldBounds[i].min, meshWorldBounds[i].max);
+      if (glm::distance(closest, glm::vec3(sphere)) <= sphere.w)
+      {
+        DrawElementsIndirectCommand cmd = cameraDrawCommands[i];
+        cmd.instanceCount = 6;
+        commands.push_back(cmd);
+      }
+    }
+    slotCommands.push_back({ first, commands.size() - first });
+  }
+
+  // the slots count as drawn now, so clear them even when nothing is in reach of their lights
+  glBindFramebuffer(GL_FRAMEBUFFER, pointShadowFbo);
+  glEnable(GL_SCISSOR_TEST);
+  for (int s : updates)
+  {
+    const auto& slot = pointShadowAtlas.GetSlots()[s];
+    glScissor(slot.origin.x, slot.origin.y, 3 * slot.faceSize, 2 * slot.faceSize);
+    glClear(GL_DEPTH_BUFFER_BIT);
+  }
+  glDisable(GL_SCISSOR_TEST);
+  if (commands.empty())
+  {
+    return;
+  }
+  StaticBuffer commandBuffer(commands.data(), sizeof(DrawElementsIndirectCommand) * commands.size(), 0);
+
+  auto& shader = Shader::shaders["shadowPointBindless"];
+  shader->Bind();
+  objectUniformsBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+  commandBuffer.Bind(GL_DRAW_INDIRECT_BUFFER);
+  glVertexArrayVertexBuffer(vao, 0, vertexBuffer->GetBufferHandle(), 0, sizeof(Vertex));
+  glVertexArrayElementBuffer(vao, indexBuffer->GetBufferHandle());
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+  for (size_t u = 0; u < updates.size(); u++)
+  {
+    const auto& slot = pointShadowAtlas.GetSlots()[updates[u]];
+
+    const glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, slot.sphere.w);
+    const glm::mat4 translate = glm::translate(glm::mat4(1), -glm::vec3(slot.sphere));
+    std::array<glm::mat4, 6> faceViewProjs;
+    for (int face = 0; face < 6; face++)
+    {
+      const glm::ivec2 origin = PointShadowAtlas::FaceOrigin(slot, face);
+      glViewportIndexedf(face, float(origin.x), float(origin.y), float(slot.faceSize), float(slot.faceSize));
+      faceViewProjs[face] = proj * CubeFaceView(face) * translate;
+    }
+    shader->SetMat4Array("u_faceViewProjs[0]", faceViewProjs);
+    const auto [first, count] = slotCommands[u];
+    if (count > 0)
+    {
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(DrawElementsIndirectCommand)),
+        static_cast<GLsizei>(count), sizeof(DrawElementsIndirectCommand));
+    }
+  }
+  glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+void Renderer::UpdateVirtualShadows(StaticBuffer& objectUniformsBuffer)
+{
+  // the map covers a box around everything, fixed in the world so pages stay valid as the camera moves.
+  // It's only remade (dropping every page) when the sun turns or something leaves the box
+  AABB sceneBounds;
+  for (const auto& bounds : meshWorldBounds)
+  {
+    sceneBounds.Grow(bounds);
+  }
+  const bool outgrown = glm::any(glm::lessThan(sceneBounds.min, vsmBounds.min)) || glm::any(glm::greaterThan(sceneBounds.max, vsmBounds.max));
+  if (outgrown || vsmLightDirection != globalLight.direction)
+  {
+    if (outgrown)
+    {
+      vsmBounds.Grow(sceneBounds);
+      const glm::vec3 margin = (vsmBounds.max - vsmBounds.min) * .1f;
+      vsmBounds = { vsmBounds.min - margin, vsmBounds.max + margin };
+    }
+    const glm::vec3 center = vsmBounds.Center();
+    const float radius = glm::distance(vsmBounds.min, vsmBounds.max) * .5f;
+    const glm::vec3 up = glm::abs(globalLight.direction.y) > .99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+    const glm::mat4 lightView = glm::lookAt(center - globalLight.direction * radius, center, up);
+    vsmMatrix = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2 * radius) * lightView;
+    vsmLightDirection = globalLight.direction;
+    vsmTexelSize = 2 * radius / VirtualShadowPages::VIRTUAL_SIZE;
+    vsmPages.Clear();
+  }
+  else
+  {
+    for (const auto& moved : movedDrawBounds)
+    {
+      glm::vec2 uvMin(std::numeric_limits<float>::max());
+      glm::vec2 uvMax(std::numeric_limits<float>::lowest());
+      for (int c = 0; c < 8; c++)
+      {
+        const glm::vec3 corner((c & 1) ? moved.max.x : moved.min.x, (c & 2) ? moved.max.y : moved.min.y, (c & 4) ? moved.max.z : moved.min.z);
+        const glm::vec2 uv = glm::vec2(vsmMatrix * glm::vec4(corner, 1.0f)) * .5f + .5f;
+        uvMin = glm::min(uvMin, uv);
+        uvMax = glm::max(uvMax, uv);
+      }
+      vsmPages.InvalidateRect(uvMin, uvMax);
+    }
+  }
+
+  // requests made VSM_READBACK_FRAMES frames ago are done by now, so the wait is only a formality
+  const int readback = vsmReadbackIndex;
+  if (vsmReadbackFences[readback])
+  {
+    glClientWaitSync(vsmReadbackFences[readback], GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+    glDeleteSync(vsmReadbackFences[readback]);
+    vsmReadbackFences[readback] = nullptr;
+    vsmPages.Request({ vsmReadbackData[readback], size_t(VirtualShadowPages::NumRequestWords()) });
+  }
+
+  glClearNamedBufferData(vsmPageRequests->ID(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  auto& mark = Shader::shaders["vsm_mark_pages"];
+  mark->Bind();
+  mark->SetInt("u_depth", 0);
+  mark->SetMat4("u_invViewProj", glm::inverse(cam.GetViewProj()));
+  mark->SetMat4("u_vsmMatrix", vsmMatrix);
+  glBindTextureUnit(0, gDepth);
+  vsmPageRequests->BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+  glDispatchCompute((WINDOW_WIDTH + 7) / 8, (WINDOW_HEIGHT + 7) / 8, 1);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glCopyNamedBufferSubData(vsmPageRequests->ID(), vsmReadbackBuffers[readback], 0, 0, sizeof(uint32_t) * VirtualShadowPages::NumRequestWords());
+  vsmReadbackFences[readback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  vsmReadbackIndex = (readback + 1) % VSM_READBACK_FRAMES;
+
+  // every page is drawn with the map's projection cropped to it, and gets its own culled multi-draw
+  const std::vector<VirtualShadowPages::PageUpdate> updates = vsmPages.TakeUpdates(vsmPagesPerFrame);
+  vsmPagesUpdated = static_cast<int>(updates.size());
+  if (!updates.empty())
+  {
+    const size_t numDraws = cameraDrawCommands.size();
+    std::vector<glm::mat4> pageMatrices;
+    std::vector<DrawElementsIndirectCommand> commands;
+    for (const auto& update : updates)
+    {
+      const float perSide = float(VirtualShadowPages::PagesPerSide(update.level));
+      const glm::vec2 center = (glm::vec2(update.page) + .5f) / perSide * 2.0f - 1.0f;
+      const glm::mat4 crop = glm::scale(glm::mat4(1), glm::vec3(perSide, perSide, 1)) * glm::translate(glm::mat4(1), glm::vec3(-center, 0));
+      pageMatrices.push_back(crop * vsmMatrix);
+      commands.insert(commands.end(), cameraDrawCommands.begin(), cameraDrawCommands.end());
+      CullBoxes(MakeFrustum(pageMatrices.back()), meshBounds, &commands[commands.size() - numDraws].instanceCount,
+        sizeof(DrawElementsIndirectCommand) / sizeof(GLuint));
+    }
+    StaticBuffer commandBuffer(commands.data(), sizeof(DrawElementsIndirectCommand) * commands.size(), 0);
+
+    auto& shadowBindlessShader = Shader::shaders["shadowBindless"];
+    shadowBindlessShader->Bind();
+    objectUniformsBuffer.BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+    commandBuffer.Bind(GL_DRAW_INDIRECT_BUFFER);
+    glVertexArrayVertexBuffer(vao, 0, vertexBuffer->GetBufferHandle(), 0, sizeof(Vertex));
+    glVertexArrayElementBuffer(vao, indexBuffer->GetBufferHandle());
+    glBindFramebuffer(GL_FRAMEBUFFER, vsmPoolFbo);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    for (size_t u = 0; u < updates.size(); u++)
+    {
+      const glm::ivec2 origin = updates[u].physicalOrigin;
+      glViewport(origin.x, origin.y, VirtualShadowPages::PAGE_SIZE, VirtualShadowPages::PAGE_SIZE);
+      glScissor(origin.x, origin.y, VirtualShadowPages::PAGE_SIZE, VirtualShadowPages::PAGE_SIZE);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      shadowBindlessShader->SetMat4("u_lightMatrix", pageMatrices[u]);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u * numDraws * sizeof(DrawElementsIndirectCommand)),
+        static_cast<GLsizei>(numDraws), sizeof(DrawElementsIndirectCommand));
+    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_SCISSOR_TEST);
+  }
+
+  if (vsmPages.PageTableVersion() != vsmPageTableVersion)
+  {
+    vsmPageTableVersion = vsmPages.PageTableVersion();
+    vsmPageTable->SubData(vsmPages.GetPageTable().data(), sizeof(int32_t) * vsmPages.GetPageTable().size(), 0);
+  }
+}
+
+void Renderer::GrowClusterIndices(uint32_t needed)
+{
+  needed = std::min(needed, MAX_CLUSTER_LIGHT_INDICES);
+  if (needed > clusterIndexCapacity)
+  {
+    clusterIndexCapacity = std::bit_ceil(needed);
+    clusterIndices = std::make_unique<StaticBuffer>(nullptr, sizeof(uint32_t) * clusterIndexCapacity, GL_DYNAMIC_STORAGE_BIT);
+  }
+}
+
+void Renderer::BuildLightClustersGPU()
+{
+  // counts of a build CLUSTER_READBACK_FRAMES frames ago, the wait is only a formality. What it dropped
+  // is lost, the buffer grows for the builds after it
+  const int readback = clusterReadbackIndex;
+  if (clusterReadbackFences[readback])
+  {
+    glClientWaitSync(clusterReadbackFences[readback], GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+    glDeleteSync(clusterReadbackFences[readback]);
+    clusterReadbackFences[readback] = nullptr;
+    clusterIndicesDropped = clusterReadbackData[readback][0];
+    clusterIndicesNeeded = clusterReadbackData[readback][1];
+    GrowClusterIndices(clusterIndicesNeeded);
+  }
+
+  // count, scan the counts into offsets, then count again while writing each light at its cluster's offset
+  auto& bin = Shader::shaders["cluster_lights"];
+  bin->Bind();
+  bin->SetMat4("u_view", cam.GetView());
+  bin->SetMat4("u_proj", cam.GetProj());
+  bin->SetFloat("u_near", cam.GetNear());
+  bin->SetFloat("u_far", cam.GetFar());
+  bin->SetUInt("u_numLights", static_cast<GLuint>(localLights.size()));
+  bin->SetUInt("u_indexCapacity", clusterIndexCapacity);
+  lightSSBO->BindBase(GL_SHADER_STORAGE_BUFFER, 0);
+  clusterRanges->BindBase(GL_SHADER_STORAGE_BUFFER, 1);
+  clusterIndices->BindBase(GL_SHADER_STORAGE_BUFFER, 2);
+  clusterIndexCounts->BindBase(GL_SHADER_STORAGE_BUFFER, 3);
+  const GLuint groups = static_cast<GLuint>((localLights.size() + 63) / 64);
+
+  glClearNamedBufferData(clusterRanges->ID(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glClearNamedBufferData(clusterIndexCounts->ID(), GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  bin->SetInt("u_pass", 0);
+  glDispatchCompute(groups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  Shader::shaders["cluster_scan"]->Bind();
+  glDispatchCompute(1, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  bin->Bind();
+  bin->SetInt("u_pass", 1);
+  glDispatchCompute(groups, 1, 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  glCopyNamedBufferSubData(clusterIndexCounts->ID(), clusterReadbackBuffers[readback], 0, 0, sizeof(uint32_t) * 2);
+  clusterReadbackFences[readback] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void Renderer::BuildHiZ()
+{
+  auto& shader = Shader::shaders["hiz_build"];
+  shader->Bind();
+  for (int level = 0; level < hiZLevels; level++)
+  {
+    const bool fromDepth = level == 0;
+    const glm::ivec2 size = glm::max(hiZSize >> level, glm::ivec2(1));
+    shader->SetInt("u_srcLevel", fromDepth ? 0 : level - 1);
+    shader->SetBool("u_srcIsDepth", fromDepth);
+    glBindTextureUnit(0, fromDepth ? gDepth : hiZ);
+    glBindImageTexture(0, hiZ, level, false, 0, GL_WRITE_ONLY, GL_RG32F);
+    glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  }
 }
 
 void Renderer::DrawPbrSphereGrid()
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <vector>
+#include <array>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -17,12 +18,46 @@ import Light;
 import GPU.Texture;
 import GPU.StaticBuffer;
 import GPU.DynamicBuffer;
+import ResidencyManager;
+import Environment;
+import Culling;
+import SoftwareOcclusion;
+import BVH;
+import GPU.IndirectDraw;
+import PointShadowAtlas;
+import VirtualShadowMap;
+import LightClusters;
 
 #define SHADOW_METHOD_PCF 0
 #define SHADOW_METHOD_VSM 1
 #define SHADOW_METHOD_ESM 2
 #define SHADOW_METHOD_MSM 3
 
+#define CULLING_METHOD_NONE 0
+#define CULLING_METHOD_CPU 1
+#define CULLING_METHOD_GPU 2
+
+#define LOCAL_LIGHTS_VOLUMES 0 // an additively blended sphere per light
+#define LOCAL_LIGHTS_CLUSTERED_GPU 1
+#define LOCAL_LIGHTS_CLUSTERED_CPU 2 // clusters built by BuildLightClusters, for comparison
+
+// see cull_draws.cs
+#define CULL_PASS_FRUSTUM 0
+#define CULL_PASS_EARLY 1
+#define CULL_PASS_LATE 2
+#define CULL_PASS_CAMERA 3 // frustum only, records visibility like the late pass
+
+// slots in gpuDrawCounts
+#define DRAW_COUNT_CAMERA 0
+#define DRAW_COUNT_CAMERA_LATE 1
+#define DRAW_COUNT_SHADOW 2 // + cascade index
+#define DRAW_COUNT_DYNAMIC_SHADOW (DRAW_COUNT_SHADOW + MAX_SHADOW_CASCADES) // + cascade index
+
+// which shadow casters CullDrawsGPU keeps
+#define CULL_CASTERS_ALL 0
+#define CULL_CASTERS_STATIC 1
+#define CULL_CASTERS_DYNAMIC 2
+
 #define WINDOW_WIDTH 1440
 #define WINDOW_HEIGHT 810
 
@@ -56,14 +91,18 @@ private:
   void LoadScene1();
   void LoadScene2();
   void SetupBuffers(); // draw commands, materials
+  void SelectOccluders();
+  double sceneLoadTime{}; // seconds
 
   // pbr stuff
-  std::unique_ptr<Texture2D> envMap_hdri;
-  //std::unique_ptr<Texture2D> envMap_irradiance;
-  int numEnvSamples{ 10 };
-  GLuint irradianceMap{};
+  std::unique_ptr<Environment> environment;
+  GLuint brdfLUT{};
+  bool projectSHOnGPU{ true };
   void LoadEnvironmentMap(std::string path);
   void DrawPbrSphereGrid();
+  void CullDrawsGPU(const glm::mat4& viewProj, const Frustum& frustum, StaticBuffer& objectUniforms, StaticBuffer& outCommands, GLuint countIndex, int pass,
+    int casterFilter = CULL_CASTERS_ALL);
+  void BuildHiZ();
   bool drawPbrSphereGridQuestionMark{ false };
 
   struct SSAOConfig
@@ -180,9 +219,67 @@ private:
   const int max_vertices{ 5'000'000 };
   std::unique_ptr<DynamicBuffer> vertexBuffer;
   std::unique_ptr<DynamicBuffer> indexBuffer;
-  std::unique_ptr<StaticBuffer> materialsBuffer; // material info
   std::unique_ptr<StaticBuffer> drawIndirectBuffer; // DrawElementsIndirectCommand
+  std::vector<DrawElementsIndirectCommand> cameraDrawCommands; // instanceCount = 0 for meshes outside the view frustum
+  std::unique_ptr<StaticBuffer> cameraDrawIndirectBuffer; // cameraDrawCommands
+  std::vector<DrawElementsIndirectCommand> shadowDrawCommands; // static casters of each cascade, then dynamic ones. instanceCount = 0 for meshes that aren't drawn
+  std::vector<GLuint> drawIsDynamic; // per draw, 1 if its object moves
+  std::unique_ptr<StaticBuffer> shadowDrawIndirectBuffer; // shadowDrawCommands
+  size_t numShadowCasters{};
+  BoundsSoA meshBounds; // world space, same order as the draw commands
+  std::vector<AABB> meshWorldBounds; // same as meshBounds
+
+  // draws whose model matrix changed since last frame, as the union of their old and new bounds. Cached
+  // shadows under these boxes are stale. Everything counts as moved when the draw list changes
+  void FindMovedDraws(const std::vector<ObjectUniforms>& objectUniforms);
+  std::vector<AABB> movedDrawBounds;
+  bool drawListChanged{ true };
+  std::vector<AABB> prevMeshWorldBounds;
+  std::vector<glm::mat4> prevDrawMatrices;
+  BVH sceneBVH; // over meshWorldBounds, refit every frame and rebuilt when it degrades
+  std::vector<uint32_t> bvhResults;
+  bool cullWithBVH{ true }; // CPU culling only
+  int bvhRebuilds{};
+  std::unique_ptr<StaticBuffer> drawBoundsBuffer; // local space AABB per draw (vec4 min, vec4 max), for cull_draws
+  std::unique_ptr<StaticBuffer> gpuCameraCommands; // compacted by cull_draws
+  std::unique_ptr<StaticBuffer> gpuCameraLateCommands; // draws that failed the early occlusion pass, but passed the late one
+  std::array<std::unique_ptr<StaticBuffer>, MAX_SHADOW_CASCADES * 2> gpuShadowCommands; // static casters of each cascade, then dynamic ones
+  std::unique_ptr<StaticBuffer> gpuDrawCounts; // see DRAW_COUNT_*
+  std::unique_ptr<StaticBuffer> drawVisibility; // per draw, 1 if it passed the last late occlusion pass
+  // drawVisibility is read back VISIBILITY_READBACK_FRAMES frames later to tell texture residency which
+  // materials the GPU drew
+  static constexpr int VISIBILITY_READBACK_FRAMES = 3;
+  std::array<GLuint, VISIBILITY_READBACK_FRAMES> visibilityReadbackBuffers{}; // persistently mapped copies of drawVisibility
+  std::array<const uint32_t*, VISIBILITY_READBACK_FRAMES> visibilityReadbackData{};
+  std::array<GLsync, VISIBILITY_READBACK_FRAMES> visibilityReadbackFences{};
+  int visibilityReadbackIndex{};
+  std::vector<uint32_t> gpuDrawVisible; // latest read back, empty until the first one arrives
+  int cullingMethod{ CULLING_METHOD_GPU };
+
+  // CPU occlusion culling against a software rasterized depth buffer of the largest meshes
+  struct Occluder
+  {
+    size_t objectIndex{}; // into batchedObjects
+    std::vector<glm::vec3> positions; // object space
+    std::vector<uint32_t> indices;
+  };
+  static constexpr size_t MAX_OCCLUDERS = 64;
+  static constexpr size_t MAX_OCCLUDER_TRIANGLES = 100'000;
+  std::vector<Occluder> occluders;
+  bool occludersAwaitTextures{}; // some candidates were skipped because their albedo hadn't loaded yet
+  std::unique_ptr<SoftwareOcclusion> softwareOcclusion;
+  GLuint softwareOcclusionTex{}; // coverage of the software depth buffer, for "View Texture"
+  bool softwareOcclusionCulling{ true }; // CPU culling only
+  double softwareOcclusionTime{}; // seconds
+  SoftwareOcclusionBenchmark softwareOcclusionBenchmark{};
+  bool occlusionCulling{ true }; // GPU culling only
+  size_t numVisibleMeshes{};
+  double cullTime{}; // seconds
+  CullingBenchmark cullingBenchmark{};
+  std::array<BlurBenchmark, 2> blurBenchmarks{}; // 1024^2 and 4096^2
   MaterialManager materialManager;
+  std::unique_ptr<ResidencyManager> textureResidency;
+  int textureBudgetMB{ 1024 };
   GLuint legitFinalImage{};
   float magnifierScale{ .025f };
   bool magnifierLock{ false };
@@ -196,6 +293,67 @@ private:
   int numLights{ 1000 };
   glm::vec2 lightFalloff{ 2, 8 };
   float lightVolumeThreshold{ 0.01f };
+
+  // clustered shading: lights are binned into a froxel grid (see LightClusters), then one compute pass
+  // shades every pixel with the lights of its cluster
+  void BuildLightClustersGPU();
+  int localLightsMethod{ LOCAL_LIGHTS_CLUSTERED_GPU };
+  std::unique_ptr<StaticBuffer> clusterRanges; // offset, count per cluster
+  std::unique_ptr<StaticBuffer> clusterIndices; // light indices
+  LightClusterLists cpuLightClusters;
+  double clusterBuildTime{}; // seconds, CPU builds only
+  // clusterIndices grows to fit what a build needed, up to MAX_CLUSTER_LIGHT_INDICES. The GPU build's
+  // counts are read back CLUSTER_READBACK_FRAMES frames later, so a few frames drop entries first
+  void GrowClusterIndices(uint32_t needed);
+  uint32_t clusterIndexCapacity{ 1 << 20 };
+  uint32_t clusterIndicesNeeded{}; // of the latest build known
+  uint32_t clusterIndicesDropped{};
+  std::unique_ptr<StaticBuffer> clusterIndexCounts; // dropped and needed entries of the GPU build, see cluster_lights.cs
+  static constexpr int CLUSTER_READBACK_FRAMES = 3;
+  std::array<GLuint, CLUSTER_READBACK_FRAMES> clusterReadbackBuffers{}; // persistently mapped copies of clusterIndexCounts
+  std::array<const uint32_t*, CLUSTER_READBACK_FRAMES> clusterReadbackData{};
+  std::array<GLsync, CLUSTER_READBACK_FRAMES> clusterReadbackFences{};
+  std::array<GLuint, CLUSTER_READBACK_FRAMES> clusterTimerQueries{}; // GL_TIME_ELAPSED of building and shading
+  std::array<bool, CLUSTER_READBACK_FRAMES> clusterTimerPending{};
+  int clusterReadbackIndex{};
+  double clusterGpuTime{}; // seconds, build (GPU builds only) and shading
+
+  // cube shadow maps of the most important local lights, see PointShadowAtlas. Lights without a slot are unshadowed
+  void UpdatePointShadows(const std::vector<ObjectUniforms>& objectUniforms, StaticBuffer& objectUniformsBuffer);
+  bool pointShadows{ true };
+  int maxShadowedLights{ 64 };
+  int pointShadowUpdatesPerFrame{ 8 };
+  int pointShadowsUpdated{};
+  static constexpr float POINT_SHADOW_NEAR = .05f; // also in gPhongManyLocal.fs
+  PointShadowAtlas pointShadowAtlas;
+  GLuint pointShadowAtlasTex{};
+  GLuint pointShadowFbo{};
+  std::vector<int32_t> lightShadowSlots; // what lightShadowSlotsBuffer holds, -1 for lights without a shadow
+  std::unique_ptr<StaticBuffer> lightShadowSlotsBuffer;
+  std::unique_ptr<StaticBuffer> shadowSlotsBuffer; // per atlas slot, uv of face 0's lower left corner and uv size of a face
+
+  // sun shadows from a virtual shadow map, see VirtualShadowPages. The pages the G-buffer needs are read
+  // back VSM_READBACK_FRAMES frames later, pixels without a mapped page use the cascades. Off by default:
+  // it is only filtered with hardware PCF, whatever shadow_method and the summed-area tables are set to
+  void UpdateVirtualShadows(StaticBuffer& objectUniformsBuffer);
+  bool virtualShadows{ false };
+  int vsmPagesPerFrame{ 64 };
+  int vsmPagesUpdated{};
+  VirtualShadowPages vsmPages;
+  glm::mat4 vsmMatrix{ 1 }; // world to the whole map's clip space, covers vsmBounds
+  glm::vec3 vsmLightDirection{}; // vsmMatrix's
+  float vsmTexelSize{}; // world size of a level 0 texel
+  AABB vsmBounds; // only grows, so moving objects don't redo the map every frame
+  GLuint vsmPool{}; // depth, compare mode for hardware PCF
+  GLuint vsmPoolFbo{};
+  std::unique_ptr<StaticBuffer> vsmPageRequests; // a bit per virtual page, see vsm_mark_pages.cs
+  std::unique_ptr<StaticBuffer> vsmPageTable;
+  uint64_t vsmPageTableVersion{}; // vsmPageTable's
+  static constexpr int VSM_READBACK_FRAMES = 3;
+  std::array<GLuint, VSM_READBACK_FRAMES> vsmReadbackBuffers{}; // persistently mapped copies of vsmPageRequests
+  std::array<const uint32_t*, VSM_READBACK_FRAMES> vsmReadbackData{};
+  std::array<GLsync, VSM_READBACK_FRAMES> vsmReadbackFences{};
+  int vsmReadbackIndex{};
   bool materialOverride{ false };
   glm::vec3 albedoOverride{ 0.129f, 0.643f, 0.921f };
   float roughnessOverride{ 0.5f };
@@ -211,13 +369,50 @@ private:
   GLuint gNormal{};
   GLuint gDepth{};
   GLuint gRMA{}; // roughness, metalness, ambient occlusion
+  GLuint hiZ{}; // min/max depth pyramid (RG32F) of gDepth, level 0 is the largest power of two that fits in the screen
+  glm::ivec2 hiZSize{};
+  int hiZLevels{};
   GLuint postprocessFbo{};
   GLuint postprocessColor{};
   GLuint postprocessPostSRGB{};
 
-  // generic shadow stuff
-  GLuint shadowFbo{};
+  // generic shadow stuff. The sun uses cascaded shadow maps, so every shadow texture is an array with
+  // a layer per cascade. The copy and blur passes work on 2D views of single layers
+  std::array<GLuint, MAX_SHADOW_CASCADES> shadowFbos{};
   GLuint shadowDepth{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> shadowDepthViews{};
+  int numCascades{ MAX_SHADOW_CASCADES };
+  float cascadeSplitLambda{ .8f };
+  float shadowDistance{ 100.0f };
+  bool showCascades{ false };
+
+  // static casters are drawn and filtered into the cascades only when their inputs change. Cached cascades
+  // don't follow the view, so that is only when the light turns, the static scene changes or the camera
+  // strays from a cascade's anchor. Dynamic casters are drawn every frame into a small depth-only overlay
+  // with the same matrices, which the lighting pass tests as well
+  struct StaticShadowState
+  {
+    glm::vec3 lightDirection{};
+    int method{ -1 };
+    int blurPasses{};
+    int blurStrength{};
+    float eConstant{};
+    bool genMips{};
+    bool summedAreaTables{};
+    float satScale{};
+    bool operator==(const StaticShadowState&) const = default;
+  };
+  StaticShadowState staticShadowState; // what the cached cascades were made with
+  std::array<glm::mat4, MAX_SHADOW_CASCADES> cachedCascadeMatrices{};
+  std::array<glm::vec3, MAX_SHADOW_CASCADES> cascadeAnchors{}; // centers of the cached cascades
+  std::array<float, MAX_SHADOW_CASCADES> cascadeReach{}; // distance from the camera each cached cascade must cover
+  static constexpr float CASCADE_ANCHOR_SLACK = .25f; // how far the camera can move from an anchor, relative to reach
+  bool staticShadowsDirty{ true }; // redraws every cascade, e.g. after loading a scene
+  bool cacheStaticShadows{ true };
+  int cascadesRedrawn{};
+  GLuint dynamicShadowDepth{}; // array with a layer per cascade, compare mode for hardware PCF
+  std::array<GLuint, MAX_SHADOW_CASCADES> dynamicShadowFbos{};
+  GLuint DYNAMIC_SHADOW_SIZE{ 512 };
   GLuint SHADOW_WIDTH{ 1024 };
   GLuint SHADOW_HEIGHT{ 1024 };
   GLuint SHADOW_LEVELS{ (GLuint)glm::ceil(glm::log2((float)glm::max(SHADOW_WIDTH, SHADOW_HEIGHT))) };
@@ -226,22 +421,33 @@ private:
   int shadow_method{ SHADOW_METHOD_ESM };
   bool shadow_gen_mips{ false };
 
+  // VSM and MSM moments can be turned into summed-area tables instead of being blurred, for
+  // PCSS-style filtering with a per pixel width
+  bool useSummedAreaTables{ true };
+  float lightSize{ .02f }; // tangent of the sun's angular radius
+  float maxShadowFilterRadius{ 32.0f }; // texels
+
   // variance shadow stuff
-  GLuint vshadowGoodFormatFbo{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> vshadowGoodFormatFbos{};
   GLuint vshadowDepthGoodFormat{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> vshadowDepthGoodFormatViews{};
   GLuint vshadowMomentBlur{};
+  GLuint vshadowMomentsSAT{}; // RG32UI view of vshadowDepthGoodFormat's base level, for fixed point summed-area tables
   float vlightBleedFix{ .9f };
 
   // exponential shadow stuff
-  GLuint eShadowFbo{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> eShadowFbos{};
   GLuint eExpShadowDepth{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> eExpShadowDepthViews{};
   GLuint eShadowDepthBlur{};
   float eConstant{ 80.0f };
 
   // moment shadow stuff
-  GLuint msmShadowFbo{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> msmShadowFbos{};
   GLuint msmShadowMoments{};
+  std::array<GLuint, MAX_SHADOW_CASCADES> msmShadowMomentsViews{};
   GLuint msmShadowMomentsBlur{};
+  GLuint msmShadowMomentsSAT{}; // RGBA32UI view of msmShadowMoments' base level
   float msmA = 3e-5f; // unused
 
   GLint uiViewBuffer{};
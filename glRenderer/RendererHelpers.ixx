@@ -1,13 +1,21 @@
 module;
 
 #include <string>
+#include <string_view>
 #include <span>
+#include <vector>
+#include <algorithm>
+#include <limits>
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 #include <iostream>
 #include "Shader.h"
 
 export module RendererHelpers;
 
+import VirtualShadowMap;
+import LightClusters;
+
 export void GLAPIENTRY
   GLerrorCB(GLenum source,
     GLenum type,
@@ -58,8 +66,58 @@ export void GLAPIENTRY
   std::cout << std::endl;
 }
 
+namespace
+{
+  // formats the separable filters are specialized for
+  struct FilterFormat
+  {
+    const char* layout; // image format qualifier
+    const char* vector; // GLSL type holding its channels
+    GLenum internalFormat;
+    const char* tableLayout; // same size in uints, for fixed point summed-area tables. Null if it can't hold them
+    const char* tableVector;
+    GLenum tableFormat;
+  };
+
+  constexpr FilterFormat FILTER_FORMATS[] =
+  {
+    { "R32f", "float", GL_R32F, "R32ui", "uint", GL_R32UI },
+    { "RG32f", "vec2", GL_RG32F, "RG32ui", "uvec2", GL_RG32UI },
+    { "RGBA16f", "vec4", GL_RGBA16F, nullptr, nullptr, GL_NONE },
+    { "RGBA32f", "vec4", GL_RGBA32F, "RGBA32ui", "uvec4", GL_RGBA32UI },
+  };
+  constexpr int MAX_BLUR_RADIUS = 6;
+
+  const FilterFormat& GetFilterFormat(GLenum internalFormat)
+  {
+    return *std::find_if(std::begin(FILTER_FORMATS), std::end(FILTER_FORMATS),
+      [=](const FilterFormat& format) { return format.internalFormat == internalFormat; });
+  }
+
+  // e.g. gaussian_shared_RG32f_3
+  std::string BlurShaderName(std::string_view kernel, const FilterFormat& format, int radius)
+  {
+    return std::string(kernel) + "_" + format.layout + "_" + std::to_string(radius);
+  }
+
+  // e.g. summed_area_RG32f
+  std::string SummedAreaShaderName(const FilterFormat& format)
+  {
+    return std::string("summed_area_") + format.layout;
+  }
+}
+
 export void CompileShaders()
 {
+  // virtual_shadow.h layout, from VirtualShadowPages
+  const std::vector<std::pair<std::string, std::string>> vsmDefines =
+  {
+    { "VSM_VIRTUAL_SIZE", std::to_string(VirtualShadowPages::VIRTUAL_SIZE) },
+    { "VSM_PAGE_SIZE", std::to_string(VirtualShadowPages::PAGE_SIZE) },
+    { "VSM_NUM_LEVELS", std::to_string(VirtualShadowPages::NUM_LEVELS) },
+    { "VSM_POOL_SIZE", std::to_string(VirtualShadowPages::POOL_SIZE) },
+  };
+
   Shader::shaders["gBuffer"].emplace(Shader(
     {
       { "gBuffer.vs", GL_VERTEX_SHADER },
@@ -83,8 +141,24 @@ export void CompileShaders()
   Shader::shaders["gPhongGlobal"].emplace(Shader(
     {
       { "fullscreen_tri.vs", GL_VERTEX_SHADER },
-      { "gPhongGlobal.fs", GL_FRAGMENT_SHADER }
+      { "gPhongGlobal.fs", GL_FRAGMENT_SHADER, {}, vsmDefines }
     }));
+  Shader::shaders["vsm_mark_pages"].emplace(Shader(
+    { { "vsm_mark_pages.cs", GL_COMPUTE_SHADER, {}, vsmDefines } }));
+
+  // clusters.h grid, from LightClusters
+  const std::vector<std::pair<std::string, std::string>> clusterDefines =
+  {
+    { "CLUSTER_TILES_X", std::to_string(CLUSTER_TILES_X) },
+    { "CLUSTER_TILES_Y", std::to_string(CLUSTER_TILES_Y) },
+    { "CLUSTER_SLICES", std::to_string(CLUSTER_SLICES) },
+  };
+  Shader::shaders["cluster_lights"].emplace(Shader(
+    { { "cluster_lights.cs", GL_COMPUTE_SHADER, {}, clusterDefines } }));
+  Shader::shaders["cluster_scan"].emplace(Shader(
+    { { "cluster_scan.cs", GL_COMPUTE_SHADER, {}, clusterDefines } }));
+  Shader::shaders["cluster_shading"].emplace(Shader(
+    { { "cluster_shading.cs", GL_COMPUTE_SHADER, {}, clusterDefines } }));
   Shader::shaders["gPhongManyLocal"].emplace(Shader(
     {
       { "lightGeom.vs", GL_VERTEX_SHADER },
@@ -95,57 +169,35 @@ export void CompileShaders()
   Shader::shaders["calc_exposure"].emplace(Shader(
     { { "calc_exposure.cs", GL_COMPUTE_SHADER } }));
 
-  Shader::shaders["gaussian_blur6"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 6"}}} }));
-  Shader::shaders["gaussian_blur5"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 5"}}} }));
-  Shader::shaders["gaussian_blur4"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 4"}}} }));
-  Shader::shaders["gaussian_blur3"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 3"}}} }));
-  Shader::shaders["gaussian_blur2"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 2"}}} }));
-  Shader::shaders["gaussian_blur1"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 1"}}} }));
-
-  Shader::shaders["gaussian32f_blur6"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 6"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-  Shader::shaders["gaussian32f_blur5"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 5"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-  Shader::shaders["gaussian32f_blur4"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 4"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-  Shader::shaders["gaussian32f_blur3"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 3"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-  Shader::shaders["gaussian32f_blur2"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 2"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-  Shader::shaders["gaussian32f_blur1"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 1"}, {"#define FORMAT RG32f", "#define FORMAT R32f"}}} }));
-
-  Shader::shaders["gaussianRGBA32f_blur6"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 6"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-  Shader::shaders["gaussianRGBA32f_blur5"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 5"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-  Shader::shaders["gaussianRGBA32f_blur4"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 4"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-  Shader::shaders["gaussianRGBA32f_blur3"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 3"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-  Shader::shaders["gaussianRGBA32f_blur2"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 2"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-  Shader::shaders["gaussianRGBA32f_blur1"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 1"}, {"#define FORMAT RG32f", "#define FORMAT RGBA32f"}}} }));
-
-  Shader::shaders["gaussianRGBA16f_blur6"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 6"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
-  Shader::shaders["gaussianRGBA16f_blur5"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 5"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
-  Shader::shaders["gaussianRGBA16f_blur4"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 4"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
-  Shader::shaders["gaussianRGBA16f_blur3"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 3"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
-  Shader::shaders["gaussianRGBA16f_blur2"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 2"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
-  Shader::shaders["gaussianRGBA16f_blur1"].emplace(Shader(
-    { { "gaussian.cs", GL_COMPUTE_SHADER, {{"#define KERNEL_RADIUS 3", "#define KERNEL_RADIUS 1"}, {"#define FORMAT RG32f", "#define FORMAT RGBA16f"}}} }));
+  // separable gaussians, specialized per radius and image format
+  for (const auto& format : FILTER_FORMATS)
+  {
+    for (int radius = 1; radius <= MAX_BLUR_RADIUS; radius++)
+    {
+      std::vector<std::pair<std::string, std::string>> defines =
+      {
+        { "KERNEL_RADIUS", std::to_string(radius) },
+        { "FORMAT", format.layout },
+      };
+      Shader::shaders[BlurShaderName("gaussian", format, radius)].emplace(Shader(
+        { { "gaussian.cs", GL_COMPUTE_SHADER, {}, defines } }));
+      defines.push_back({ "VECTOR", format.vector });
+      Shader::shaders[BlurShaderName("gaussian_shared", format, radius)].emplace(Shader(
+        { { "gaussian_shared.cs", GL_COMPUTE_SHADER, {}, defines } }));
+    }
+
+    if (format.tableLayout)
+    {
+      const std::vector<std::pair<std::string, std::string>> defines =
+      {
+        { "FORMAT", format.tableLayout },
+        { "VECTOR", format.vector },
+        { "UVECTOR", format.tableVector },
+      };
+      Shader::shaders[SummedAreaShaderName(format)].emplace(Shader(
+        { { "summed_area.cs", GL_COMPUTE_SHADER, {}, defines } }));
+    }
+  }
 
   Shader::shaders["tonemap"].emplace(Shader(
     {
@@ -163,6 +215,9 @@ export void CompileShaders()
   Shader::shaders["shadowBindless"].emplace(Shader(
     { { "shadowBindless.vs", GL_VERTEX_SHADER },
     }));
+  Shader::shaders["shadowPointBindless"].emplace(Shader(
+    { { "shadowPointBindless.vs", GL_VERTEX_SHADER },
+    }));
   Shader::shaders["volumetric"].emplace(Shader(
     {
       { "fullscreen_tri.vs", GL_VERTEX_SHADER },
@@ -211,8 +266,20 @@ export void CompileShaders()
       { "fullscreen_tri.vs", GL_VERTEX_SHADER },
       { "hdri_skybox.fs", GL_FRAGMENT_SHADER }
     }));
-  Shader::shaders["convolve_image"].emplace(Shader(
-    { { "irradiance_convolve.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["cull_draws"].emplace(Shader(
+    { { "cull_draws.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["hiz_build"].emplace(Shader(
+    { { "hiz_build.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["equirect_to_cube"].emplace(Shader(
+    { { "equirect_to_cube.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["sh_project"].emplace(Shader(
+    { { "sh_project.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["sh_reduce"].emplace(Shader(
+    { { "sh_reduce.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["prefilter_env"].emplace(Shader(
+    { { "prefilter_env.cs", GL_COMPUTE_SHADER } }));
+  Shader::shaders["brdf_lut"].emplace(Shader(
+    { { "brdf_lut.cs", GL_COMPUTE_SHADER } }));
 }
 
 export void drawFSTexture(GLuint texID)
@@ -229,24 +296,26 @@ export void drawFSTexture(GLuint texID)
 
 namespace // detail
 {
+  // shared selects gaussian_shared.cs (a workgroup per 128 texel line segment) over the
+  // reference gaussian.cs (8x8 workgroups, one fetch per tap)
   void blurTextureBase(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height,
-    GLint passes, GLint strength, std::span<std::string> shaderNames, GLenum imageFormat)
+    GLint passes, GLint strength, GLenum imageFormat, bool shared = true)
   {
-    if (strength > shaderNames.size() || strength <= 1)
+    if (strength > MAX_BLUR_RADIUS || strength <= 1)
     {
       return;
     }
 
-    auto& shader = Shader::shaders[shaderNames[strength - 1]];
+    const FilterFormat& format = GetFilterFormat(imageFormat);
+    auto& shader = Shader::shaders[BlurShaderName(shared ? "gaussian_shared" : "gaussian", format, strength)];
     shader->Bind();
     shader->SetIVec2("u_texSize", width, height);
     shader->SetInt("u_inTex", 0);
     shader->SetInt("u_outTex", 0);
 
+    const int TILE_SIZE = 128; // matches gaussian_shared.cs
     const int X_SIZE = 8;
     const int Y_SIZE = 8;
-    const int xgroups = (width + X_SIZE - 1) / X_SIZE;
-    const int ygroups = (height + Y_SIZE - 1) / Y_SIZE;
 
     bool horizontal = false;
     for (int i = 0; i < passes * 2; i++)
@@ -255,8 +324,16 @@ namespace // detail
       glBindTextureUnit(0, inOutTex);
       glBindImageTexture(0, intermediateTexture, 0, false, 0, GL_WRITE_ONLY, imageFormat);
       shader->SetBool("u_horizontal", horizontal);
-      glDispatchCompute(xgroups, ygroups, 1);
-      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+      if (shared)
+      {
+        const int lineLength = horizontal ? width : height;
+        glDispatchCompute((lineLength + TILE_SIZE - 1) / TILE_SIZE, horizontal ? height : width, 1);
+      }
+      else
+      {
+        glDispatchCompute((width + X_SIZE - 1) / X_SIZE, (height + Y_SIZE - 1) / Y_SIZE, 1);
+      }
+      glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
       std::swap(inOutTex, intermediateTexture);
       horizontal = !horizontal;
     }
@@ -265,42 +342,120 @@ namespace // detail
 
 export void blurTextureRGBA32f(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height, GLint passes, GLint strength)
 {
-  std::string strs[] = { "gaussianRGBA32f_blur1","gaussianRGBA32f_blur2", "gaussianRGBA32f_blur3", "gaussianRGBA32f_blur4", "gaussianRGBA32f_blur5", "gaussianRGBA32f_blur6" };
-  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, strs, GL_RGBA32F);
+  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, GL_RGBA32F);
 }
 
 export void blurTextureRGBA16f(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height, GLint passes, GLint strength)
 {
-  std::string strs[] = { "gaussianRGBA16f_blur1","gaussianRGBA16f_blur2", "gaussianRGBA16f_blur3", "gaussianRGBA16f_blur4", "gaussianRGBA16f_blur5", "gaussianRGBA16f_blur6" };
-  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, strs, GL_RGBA16F);
+  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, GL_RGBA16F);
 }
 
 export void blurTextureRG32f(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height, GLint passes, GLint strength)
 {
-  std::string strs[] = { "gaussian_blur1","gaussian_blur2", "gaussian_blur3", "gaussian_blur4", "gaussian_blur5", "gaussian_blur6" };
-  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, strs, GL_RG32F);
+  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, GL_RG32F);
 }
 
 export void blurTextureR32f(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height, GLint passes, GLint strength)
 {
-  std::string strs[] = { "gaussian32f_blur1", "gaussian32f_blur2", "gaussian32f_blur3", "gaussian32f_blur4", "gaussian32f_blur5", "gaussian32f_blur6" };
-  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, strs, GL_R32F);
+  blurTextureBase(inOutTex, intermediateTexture, width, height, passes, strength, GL_R32F);
 }
 
-export void convolve_image(GLuint inTex, GLuint outTex, GLint outWidth, GLint outHeight)
+// replaces inOutTex with its summed-area table: each texel becomes the sum of every texel at or below
+// and left of it. The table is fixed point in uints of the same size as imageFormat, so read it through
+// a uint view: moments are clamped to [0, 1] and multiplied by scale. Sums wrap, differences of two
+// entries are exact while the region between them sums to under 2^32. Rows are scanned into
+// intermediateTexture, then its columns back into inOutTex
+export void summedAreaTable(GLuint inOutTex, GLuint intermediateTexture, GLint width, GLint height,
+  GLenum imageFormat, float scale)
 {
-  auto& shader = Shader::shaders["convolve_image"];
+  const FilterFormat& format = GetFilterFormat(imageFormat);
+  auto& shader = Shader::shaders[SummedAreaShaderName(format)];
   shader->Bind();
-  shader->SetInt("u_environment", 0);
+  shader->SetIVec2("u_texSize", width, height);
+  shader->SetFloat("u_scale", scale);
+  shader->SetInt("u_inTex", 0);
   shader->SetInt("u_outTex", 0);
+  shader->SetInt("u_rowSums", 1);
 
-  const int X_SIZE = 8;
-  const int Y_SIZE = 8;
-  const int xgroups = (outWidth + X_SIZE - 1) / X_SIZE;
-  const int ygroups = (outHeight + Y_SIZE - 1) / Y_SIZE;
-
-  glBindTextureUnit(0, inTex);
-  glBindImageTexture(0, outTex, 0, false, 0, GL_WRITE_ONLY, GL_RGBA16F);
-  glDispatchCompute(xgroups, ygroups, 1);
+  // a workgroup per row
+  glBindTextureUnit(0, inOutTex);
+  glBindImageTexture(0, intermediateTexture, 0, false, 0, GL_WRITE_ONLY, format.tableFormat);
+  shader->SetBool("u_horizontal", true);
+  glDispatchCompute(height, 1, 1);
   glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+  // then per column
+  glBindImageTexture(0, inOutTex, 0, false, 0, GL_WRITE_ONLY, format.tableFormat);
+  glBindImageTexture(1, intermediateTexture, 0, false, 0, GL_READ_ONLY, format.tableFormat);
+  shader->SetBool("u_horizontal", false);
+  glDispatchCompute(width, 1, 1);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+export struct BlurBenchmark
+{
+  GLint size{};
+  double referenceTime{}; // seconds of GPU time, best of several runs
+  double sharedTime{};
+};
+
+// blurs a size x size RG32F texture (the VSM format) with both kernels, timed with GL_TIME_ELAPSED queries
+export BlurBenchmark BenchmarkBlur(GLint size, GLint passes, GLint strength)
+{
+  GLuint textures[2]{};
+  glCreateTextures(GL_TEXTURE_2D, 2, textures);
+  for (GLuint tex : textures)
+  {
+    glTextureStorage2D(tex, 1, GL_RG32F, size, size);
+    glTextureParameteri(tex, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(tex, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+  const float clearColor[] = { .5f, .25f, 0, 0 };
+  glClearTexImage(textures[0], 0, GL_RG, GL_FLOAT, clearColor);
+
+  GLuint query{};
+  glCreateQueries(GL_TIME_ELAPSED, 1, &query);
+  auto time = [&](bool shared)
+  {
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    blurTextureBase(textures[0], textures[1], size, size, passes, strength, GL_RG32F, shared);
+    glEndQuery(GL_TIME_ELAPSED);
+    GLuint64 ns{};
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+    return ns / 1e9;
+  };
+
+  BlurBenchmark result{ .size = size, .referenceTime = std::numeric_limits<double>::max(), .sharedTime = std::numeric_limits<double>::max() };
+  time(false); // warm up
+  time(true);
+  for (int run = 0; run < 10; run++)
+  {
+    result.referenceTime = std::min(result.referenceTime, time(false));
+    result.sharedTime = std::min(result.sharedTime, time(true));
+  }
+
+  glDeleteQueries(1, &query);
+  glDeleteTextures(2, textures);
+  return result;
+}
+
+// split sum DFG LUT, indexed by (NoV, roughness). Independent of the environment
+export GLuint createBRDFLUT(GLint size, GLuint samples)
+{
+  GLuint outTex{};
+  glCreateTextures(GL_TEXTURE_2D, 1, &outTex);
+  glTextureParameteri(outTex, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(outTex, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(outTex, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(outTex, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTextureStorage2D(outTex, 1, GL_RG16F, size, size);
+
+  auto& shader = Shader::shaders["brdf_lut"];
+  shader->Bind();
+  shader->SetUInt("u_samples", samples);
+  shader->SetInt("u_outTex", 0);
+  glBindImageTexture(0, outTex, 0, false, 0, GL_WRITE_ONLY, GL_RG16F);
+  glDispatchCompute((size + 7) / 8, (size + 7) / 8, 1);
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  return outTex;
 }
\ No newline at end of file
@@ -0,0 +1,299 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+export module ResidencyManager;
+
+import GPU.Texture;
+import GPU.StaticBuffer;
+import Material;
+
+// keeps bindless material textures within a VRAM budget.
+// textures are ranked by the last frame a visible draw used one of their materials, and
+// the least recently used ones are made non-resident. Materials referencing evicted
+// textures get 1x1 fallbacks in their materialsBuffer entry until they're needed again, the
+// evicted handles stay resident until the frames already submitted are done with them.
+// It also streams in the finer mips of resident textures, largest on screen first, and
+// owns materialsBuffer, the GPU copy of the material table
+export class ResidencyManager
+{
+public:
+  ResidencyManager(size_t budgetBytes);
+
+  // starts tracking the materials appended to the table since the last call, indices match materialsBuffer
+  void AddMaterials(const std::vector<Material>& materials);
+
+  // forgets every material (e.g. when the material table is cleared)
+  void Clear();
+
+  // call for every material drawn this frame. screenSize is the projected size of the draw
+  // as a fraction of the screen's height, used to prioritize mip streaming
+  void MarkUsed(uint32_t materialIndex, float screenSize);
+
+  // applies the budget, streams mips and patches the entries of materials whose texture handles changed
+  void Update();
+
+  // entry for materialsBuffer, with fallbacks for textures that aren't resident
+  BindlessMaterial GetBindlessMaterial(uint32_t materialIndex) const;
+  const std::vector<BindlessMaterial>& GetBindlessMaterials() const { return bindlessMaterials_; }
+  StaticBuffer& GetMaterialsBuffer() { return *materialsBuffer_; }
+
+  void SetBudget(size_t budgetBytes) { budgetBytes_ = budgetBytes; }
+  size_t GetBudget() const { return budgetBytes_; }
+  size_t GetResidentBytes() const { return residentBytes_; }
+  size_t GetTotalBytes() const { return totalBytes_; }
+
+private:
+  static constexpr size_t SLOT_COUNT = 4; // albedo, roughness/metalness, normal, AO
+  static constexpr size_t STREAM_BYTES_PER_FRAME = 4 << 20;
+  static constexpr size_t INITIAL_MATERIAL_CAPACITY = 256;
+
+  struct TrackedTexture
+  {
+    std::shared_ptr<Texture2D> texture;
+    uint64_t lastUsedFrame{};
+    float screenSize{}; // largest draw using it in lastUsedFrame
+    uint64_t publishedHandle{}; // what materialsBuffer currently has for it, 0 for the fallback
+    std::vector<uint32_t> materials; // materials that use this texture
+  };
+
+  struct TrackedMaterial
+  {
+    std::array<int32_t, SLOT_COUNT> textures{ -1, -1, -1, -1 }; // index into textures_, -1 if none
+  };
+
+  std::vector<TrackedTexture> textures_;
+  std::unordered_map<const Texture2D*, int32_t> textureIndices_;
+  std::vector<TrackedMaterial> materials_;
+  std::vector<BindlessMaterial> bindlessMaterials_;
+  std::unique_ptr<StaticBuffer> materialsBuffer_;
+  size_t materialCapacity_{};
+  std::array<std::unique_ptr<Texture2D>, SLOT_COUNT> fallbacks_;
+
+  uint64_t frame_ = 1;
+  size_t budgetBytes_{};
+  size_t residentBytes_{};
+  size_t totalBytes_{};
+};
+
+namespace
+{
+  std::unique_ptr<Texture2D> MakeSolidTexture(glm::u8vec4 color)
+  {
+    TextureCreateInfo info
+    {
+      .minFilter = GL_NEAREST,
+      .magFilter = GL_NEAREST,
+    };
+    TextureData data
+    {
+      .dim = { 1, 1 },
+      .pixels = { std::byte(color.r), std::byte(color.g), std::byte(color.b), std::byte(color.a) },
+      .levelOffsets = { 0 },
+    };
+    return std::make_unique<Texture2D>(info, data);
+  }
+}
+
+ResidencyManager::ResidencyManager(size_t budgetBytes)
+  : budgetBytes_(budgetBytes)
+{
+  // albedo is a neutral gray, the rest match the shader's defaults
+  fallbacks_[0] = MakeSolidTexture({ 128, 128, 128, 255 });
+  fallbacks_[1] = MakeSolidTexture({ 255, 0, 0, 255 });
+  fallbacks_[2] = MakeSolidTexture({ 128, 128, 255, 255 });
+  fallbacks_[3] = MakeSolidTexture({ 255, 255, 255, 255 });
+
+  materialCapacity_ = INITIAL_MATERIAL_CAPACITY;
+  materialsBuffer_ = std::make_unique<StaticBuffer>(nullptr, materialCapacity_ * sizeof(BindlessMaterial), GL_DYNAMIC_STORAGE_BIT);
+}
+
+void ResidencyManager::Clear()
+{
+  textures_.clear();
+  textureIndices_.clear();
+  materials_.clear();
+  bindlessMaterials_.clear();
+  totalBytes_ = 0;
+  residentBytes_ = 0;
+}
+
+void ResidencyManager::AddMaterials(const std::vector<Material>& materials)
+{
+  const uint32_t first = static_cast<uint32_t>(materials_.size());
+  if (materials.size() <= first)
+  {
+    return;
+  }
+  materials_.resize(materials.size());
+  bindlessMaterials_.resize(materials.size());
+
+  for (uint32_t m = first; m < materials.size(); m++)
+  {
+    const std::array<const std::shared_ptr<Texture2D>*, SLOT_COUNT> slots =
+    {
+      &materials[m].albedoTex,
+      &materials[m].roughnessMetalnessTex,
+      &materials[m].normalTex,
+      &materials[m].ambientOcclusionTex,
+    };
+    for (size_t s = 0; s < SLOT_COUNT; s++)
+    {
+      // textures that are still decoding are tracked too, they use the fallback until they arrive
+      const auto& texture = *slots[s];
+      if (!texture)
+      {
+        continue;
+      }
+
+      auto [it, inserted] = textureIndices_.try_emplace(texture.get(), static_cast<int32_t>(textures_.size()));
+      if (inserted)
+      {
+        textures_.push_back({ .texture = texture, .publishedHandle = texture->IsResident() ? texture->GetBindlessHandle() : 0 });
+        totalBytes_ += texture->GetMemoryUsage();
+        residentBytes_ += texture->IsResident() ? texture->GetMemoryUsage() : 0;
+      }
+      textures_[it->second].materials.push_back(m);
+      materials_[m].textures[s] = it->second;
+    }
+    bindlessMaterials_[m] = GetBindlessMaterial(m);
+  }
+
+  // only the new entries are uploaded, unless the buffer has to grow
+  if (materials.size() > materialCapacity_)
+  {
+    while (materialCapacity_ < materials.size())
+    {
+      materialCapacity_ *= 2;
+    }
+    materialsBuffer_ = std::make_unique<StaticBuffer>(nullptr, materialCapacity_ * sizeof(BindlessMaterial), GL_DYNAMIC_STORAGE_BIT);
+    materialsBuffer_->SubData(bindlessMaterials_.data(), bindlessMaterials_.size() * sizeof(BindlessMaterial), 0);
+  }
+  else
+  {
+    materialsBuffer_->SubData(&bindlessMaterials_[first], (materials.size() - first) * sizeof(BindlessMaterial), first * sizeof(BindlessMaterial));
+  }
+}
+
+void ResidencyManager::MarkUsed(uint32_t materialIndex, float screenSize)
+{
+  for (int32_t texture : materials_[materialIndex].textures)
+  {
+    if (texture < 0)
+    {
+      continue;
+    }
+    auto& tracked = textures_[texture];
+    tracked.screenSize = tracked.lastUsedFrame == frame_ ? std::max(tracked.screenSize, screenSize) : screenSize;
+    tracked.lastUsedFrame = frame_;
+  }
+}
+
+void ResidencyManager::Update()
+{
+  Texture2D::ReleaseRetiredHandles();
+
+  // most recently used first, smaller textures win ties so more of them fit
+  std::vector<uint32_t> order(textures_.size());
+  for (uint32_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+    {
+      const auto& ta = textures_[a];
+      const auto& tb = textures_[b];
+      if (ta.lastUsedFrame != tb.lastUsedFrame)
+      {
+        return ta.lastUsedFrame > tb.lastUsedFrame;
+      }
+      return ta.texture->GetMemoryUsage() < tb.texture->GetMemoryUsage();
+    });
+
+  size_t bytes = 0;
+  totalBytes_ = 0;
+  for (uint32_t i : order)
+  {
+    auto& tracked = textures_[i];
+    const size_t size = tracked.texture->GetMemoryUsage();
+    const bool resident = bytes + size <= budgetBytes_;
+    bytes += resident ? size : 0;
+    totalBytes_ += size;
+    tracked.texture->SetResident(resident);
+  }
+  residentBytes_ = bytes;
+
+  // refine streamed textures that are drawn, biggest on screen first. Whole levels are
+  // uploaded, so the last one can overshoot the per-frame allowance
+  std::vector<uint32_t> streaming;
+  for (uint32_t i = 0; i < textures_.size(); i++)
+  {
+    if (textures_[i].texture->IsStreaming() && textures_[i].texture->IsResident() && textures_[i].lastUsedFrame == frame_)
+    {
+      streaming.push_back(i);
+    }
+  }
+  std::sort(streaming.begin(), streaming.end(), [this](uint32_t a, uint32_t b)
+    {
+      return textures_[a].screenSize > textures_[b].screenSize;
+    });
+  size_t streamedBytes = 0;
+  for (uint32_t i : streaming)
+  {
+    while (streamedBytes < STREAM_BYTES_PER_FRAME && textures_[i].texture->IsStreaming())
+    {
+      streamedBytes += textures_[i].texture->StreamNextLevel();
+    }
+  }
+  frame_++;
+
+  // residency changes, refinements and textures that just finished decoding all change the handle
+  std::vector<uint32_t> dirtyMaterials;
+  for (auto& tracked : textures_)
+  {
+    const uint64_t handle = tracked.texture->IsResident() ? tracked.texture->GetBindlessHandle() : 0;
+    if (handle != tracked.publishedHandle)
+    {
+      tracked.publishedHandle = handle;
+      dirtyMaterials.insert(dirtyMaterials.end(), tracked.materials.begin(), tracked.materials.end());
+    }
+  }
+
+  std::sort(dirtyMaterials.begin(), dirtyMaterials.end());
+  dirtyMaterials.erase(std::unique(dirtyMaterials.begin(), dirtyMaterials.end()), dirtyMaterials.end());
+  for (uint32_t m : dirtyMaterials)
+  {
+    bindlessMaterials_[m] = GetBindlessMaterial(m);
+    materialsBuffer_->SubData(&bindlessMaterials_[m], sizeof(BindlessMaterial), sizeof(BindlessMaterial) * m);
+  }
+}
+
+BindlessMaterial ResidencyManager::GetBindlessMaterial(uint32_t materialIndex) const
+{
+  std::array<uint64_t, SLOT_COUNT> handles{};
+  for (size_t s = 0; s < SLOT_COUNT; s++)
+  {
+    const int32_t texture = materials_[materialIndex].textures[s];
+    if (texture < 0)
+    {
+      continue; // a null handle lets the shader use its own defaults
+    }
+    const auto& tex = textures_[texture].texture;
+    handles[s] = tex->IsResident() ? tex->GetBindlessHandle() : fallbacks_[s]->GetBindlessHandle();
+  }
+  return
+  {
+    .albedoHandle = handles[0],
+    .roughnessMetalnessHandle = handles[1],
+    .normalHandle = handles[2],
+    .ambientOcclusionHandle = handles[3],
+  };
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#version 460 core
+#include "pbr_common.h"
+
+// split sum DFG term: the specular BRDF integrated against a white environment,
+// as a scale (r) and bias (g) to F0 for each (NoV, roughness)
+layout (location = 0) uniform uint u_samples;
+layout (location = 1, rg16f) uniform writeonly image2D u_outTex;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main()
+{
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 outSize = imageSize(u_outTex);
+  if (any(greaterThanEqual(texel, outSize))) return;
+
+  vec2 uv = (vec2(texel) + 0.5) / vec2(outSize);
+  float NoV = uv.x;
+  float roughness = uv.y;
+  vec3 V = vec3(sqrt(1.0 - NoV * NoV), 0.0, NoV);
+  vec3 N = vec3(0.0, 0.0, 1.0);
+
+  float A = 0.0;
+  float B = 0.0;
+  for (uint i = 0; i < u_samples; i++)
+  {
+    vec2 Xi = Hammersley(i, u_samples);
+    vec3 H = ImportanceSampleGGX(Xi, N, roughness);
+    vec3 L = normalize(2.0 * dot(V, H) * H - V);
+
+    float NoL = max(L.z, 0.0);
+    float NoH = max(H.z, 0.0);
+    float VoH = max(dot(V, H), 0.0);
+    if (NoL > 0.0)
+    {
+      // same estimator the lighting shader used when it sampled the environment directly
+      float G_Vis = G_Smith(N, V, L, roughness) * VoH / max(NoH * NoV, 0.001);
+      float Fc = pow(1.0 - VoH, 5.0);
+      A += (1.0 - Fc) * G_Vis;
+      B += Fc * G_Vis;
+    }
+  }
+
+  imageStore(u_outTex, texel, vec4(A, B, 0.0, 0.0) / float(u_samples));
+}
\ No newline at end of file
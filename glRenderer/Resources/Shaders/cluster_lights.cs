@@ -0,0 +1,121 @@
+#version 460 core
+#include "clusters.h"
+
+// bins lights into the froxels they touch, an invocation per light. Run twice: pass 0 counts every
+// cluster's lights, then cluster_scan.cs turns the counts into offsets, then pass 1 writes the indices.
+// A froxel is tested as its view space box, the same test as BuildLightClusters. Indices that don't
+// fit are counted, the CPU grows the buffer from the total the scan stores
+layout (local_size_x = 64) in;
+
+struct PointLight
+{
+  vec4 diffuse;
+
+  vec4 position;
+  float linear;
+  float quadratic;
+  float radiusSquared;
+  float _padding;
+};
+
+layout (location = 0) uniform mat4 u_view;
+layout (location = 1) uniform mat4 u_proj;
+layout (location = 2) uniform float u_near;
+layout (location = 3) uniform float u_far;
+layout (location = 4) uniform uint u_numLights;
+layout (location = 5) uniform int u_pass;
+layout (location = 6) uniform uint u_indexCapacity; // entries of clusterIndices
+
+layout (std430, binding = 0) readonly buffer Lights
+{
+  PointLight lights[];
+};
+
+layout (std430, binding = 1) buffer ClusterRanges
+{
+  uvec2 clusterRanges[]; // offset, count
+};
+
+layout (std430, binding = 2) writeonly buffer ClusterIndices
+{
+  uint clusterIndices[];
+};
+
+layout (std430, binding = 3) buffer ClusterIndexCounts
+{
+  uint droppedIndices;
+  uint neededIndices; // written by cluster_scan.cs
+};
+
+// first and last tile the sphere's view space box covers on one axis, false if it's off screen.
+// c / depth is extreme at the box's corners
+bool TileRange(float c, float radius, float front, float back, float scale, int tiles, out int first, out int last)
+{
+  float lo = min((c - radius) / front, (c - radius) / back) * scale;
+  float hi = max((c + radius) / front, (c + radius) / back) * scale;
+  first = clamp(int(floor((lo * 0.5 + 0.5) * tiles)), 0, tiles - 1);
+  last = clamp(int(floor((hi * 0.5 + 0.5) * tiles)), 0, tiles - 1);
+  return lo <= 1.0 && hi >= -1.0;
+}
+
+// distance from c to [lo, hi], with the tile's edges at depths d0 and d1 spanning the range
+float AxisDistance(float c, float ndc0, float ndc1, float d0, float d1, float scale)
+{
+  float lo = min(ndc0 * d0, ndc0 * d1) / scale;
+  float hi = max(ndc1 * d0, ndc1 * d1) / scale;
+  return max(max(lo - c, c - hi), 0.0);
+}
+
+void main()
+{
+  uint light = gl_GlobalInvocationID.x;
+  if (light >= u_numLights)
+  {
+    return;
+  }
+
+  vec3 center = (u_view * vec4(lights[light].position.xyz, 1.0)).xyz;
+  float radius = sqrt(lights[light].radiusSquared);
+  float front = max(-center.z - radius, u_near);
+  float back = min(-center.z + radius, u_far);
+  int x0, x1, y0, y1;
+  if (front > back ||
+    !TileRange(center.x, radius, front, back, u_proj[0][0], CLUSTER_TILES_X, x0, x1) ||
+    !TileRange(center.y, radius, front, back, u_proj[1][1], CLUSTER_TILES_Y, y0, y1))
+  {
+    return;
+  }
+
+  for (int s = ClusterSlice(front, u_near, u_far); s <= ClusterSlice(back, u_near, u_far); s++)
+  {
+    float d0 = SliceDepth(s, u_near, u_far);
+    float d1 = SliceDepth(s + 1, u_near, u_far);
+    float dz = max(max(d0 + center.z, -center.z - d1), 0.0);
+    for (int y = y0; y <= y1; y++)
+    {
+      float dy = AxisDistance(center.y, float(y) / CLUSTER_TILES_Y * 2.0 - 1.0, float(y + 1) / CLUSTER_TILES_Y * 2.0 - 1.0, d0, d1, u_proj[1][1]);
+      for (int x = x0; x <= x1; x++)
+      {
+        float dx = AxisDistance(center.x, float(x) / CLUSTER_TILES_X * 2.0 - 1.0, float(x + 1) / CLUSTER_TILES_X * 2.0 - 1.0, d0, d1, u_proj[0][0]);
+        if (dx * dx + dy * dy + dz * dz > radius * radius)
+        {
+          continue;
+        }
+        int cluster = ClusterIndex(ivec3(x, y, s));
+        uint slot = atomicAdd(clusterRanges[cluster].y, 1);
+        if (u_pass == 1)
+        {
+          uint index = clusterRanges[cluster].x + slot;
+          if (index < u_indexCapacity)
+          {
+            clusterIndices[index] = light;
+          }
+          else
+          {
+            atomicAdd(droppedIndices, 1);
+          }
+        }
+      }
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#version 460 core
+#include "clusters.h"
+
+// exclusive prefix sum of the light counts cluster_lights.cs counted, in one workgroup. Each
+// invocation sums a run of clusters serially, the run totals are scanned in shared memory. Counts
+// are reset so the fill pass can count again as it writes. The total is stored for the CPU, which
+// sizes the index buffer from it
+#define GROUP_SIZE 1024
+#define RUN_LENGTH ((NUM_CLUSTERS + GROUP_SIZE - 1) / GROUP_SIZE)
+
+layout (local_size_x = GROUP_SIZE) in;
+
+layout (std430, binding = 1) buffer ClusterRanges
+{
+  uvec2 clusterRanges[]; // offset, count
+};
+
+layout (std430, binding = 3) buffer ClusterIndexCounts
+{
+  uint droppedIndices; // counted by cluster_lights.cs
+  uint neededIndices;
+};
+
+shared uint runTotals[GROUP_SIZE];
+
+void main()
+{
+  uint first = gl_LocalInvocationID.x * RUN_LENGTH;
+  uint total = 0;
+  for (uint i = first; i < min(first + RUN_LENGTH, NUM_CLUSTERS); i++)
+  {
+    total += clusterRanges[i].y;
+  }
+  runTotals[gl_LocalInvocationID.x] = total;
+  barrier();
+
+  // inclusive Hillis-Steele scan of the run totals
+  for (uint stride = 1; stride < GROUP_SIZE; stride *= 2)
+  {
+    uint value = gl_LocalInvocationID.x >= stride ? runTotals[gl_LocalInvocationID.x - stride] : 0;
+    barrier();
+    runTotals[gl_LocalInvocationID.x] += value;
+    barrier();
+  }
+
+  if (gl_LocalInvocationID.x == GROUP_SIZE - 1)
+  {
+    neededIndices = runTotals[GROUP_SIZE - 1];
+  }
+
+  uint offset = runTotals[gl_LocalInvocationID.x] - total;
+  for (uint i = first; i < min(first + RUN_LENGTH, NUM_CLUSTERS); i++)
+  {
+    uint count = clusterRanges[i].y;
+    clusterRanges[i] = uvec2(offset, 0);
+    offset += count;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#version 460 core
+#include "common.h"
+#include "pbr_common.h"
+#include "clusters.h"
+#include "local_light.h"
+
+// all local lights in one pass: every pixel reads the G-buffer once and shades the lights of its
+// cluster, adding the result to the lit image
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (location = 0) uniform sampler2D gNormal;
+layout (location = 1) uniform sampler2D gAlbedo;
+layout (location = 2) uniform sampler2D gRMA;
+layout (location = 3) uniform sampler2D gDepth;
+layout (location = 4, rgba16f) uniform image2D u_outColor;
+layout (location = 5) uniform vec3 u_viewPos;
+layout (location = 6) uniform mat4 u_invViewProj;
+layout (location = 16) uniform mat4 u_view;
+layout (location = 20) uniform float u_near;
+layout (location = 21) uniform float u_far;
+layout (location = 22) uniform uint u_indexCapacity; // entries of clusterIndices
+
+layout (std430, binding = 0) readonly buffer Lights
+{
+  PointLight lights[];
+};
+
+layout (std430, binding = 1) readonly buffer LightShadowSlots
+{
+  int lightShadowSlots[];
+};
+
+layout (std430, binding = 4) readonly buffer ClusterRanges
+{
+  uvec2 clusterRanges[]; // offset, count
+};
+
+layout (std430, binding = 5) readonly buffer ClusterIndices
+{
+  uint clusterIndices[];
+};
+
+void main()
+{
+  ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(u_outColor);
+  if (any(greaterThanEqual(pixel, size)))
+  {
+    return;
+  }
+  float depth = texelFetch(gDepth, pixel, 0).r;
+  if (depth == 1.0)
+  {
+    return;
+  }
+
+  vec3 worldPos = WorldPosFromDepthUV(depth, (vec2(pixel) + 0.5) / size, u_invViewProj);
+  vec3 N = oct_to_float32x3(texelFetch(gNormal, pixel, 0).xy);
+  vec3 V = normalize(u_viewPos - worldPos);
+  vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+  vec4 RMA = texelFetch(gRMA, pixel, 0);
+
+  float viewDepth = -(u_view * vec4(worldPos, 1.0)).z;
+  ivec2 tile = ivec2((vec2(pixel) + 0.5) / size * vec2(CLUSTER_TILES_X, CLUSTER_TILES_Y));
+  ivec3 cluster = ivec3(tile, ClusterSlice(viewDepth, u_near, u_far));
+  uvec2 range = clusterRanges[ClusterIndex(cluster)];
+  uint count = min(range.y, u_indexCapacity - min(range.x, u_indexCapacity));
+
+  vec3 color = vec3(0.0);
+  for (uint i = 0; i < count; i++)
+  {
+    uint light = clusterIndices[range.x + i];
+    color += ShadeLocalLight(lights[light], lightShadowSlots[light], worldPos, N, V, albedo, RMA[0], RMA[1]);
+  }
+  imageStore(u_outColor, pixel, imageLoad(u_outColor, pixel) + vec4(color, 0.0));
+}
\ No newline at end of file
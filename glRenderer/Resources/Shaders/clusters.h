@@ -0,0 +1,32 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+// froxel grid of clustered shading, see LightClusters. Slices are spaced exponentially in view depth
+#ifndef CLUSTER_TILES_X
+#define CLUSTER_TILES_X 16
+#endif
+#ifndef CLUSTER_TILES_Y
+#define CLUSTER_TILES_Y 9
+#endif
+#ifndef CLUSTER_SLICES
+#define CLUSTER_SLICES 24
+#endif
+#define NUM_CLUSTERS (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+
+int ClusterIndex(ivec3 cluster)
+{
+  return cluster.x + CLUSTER_TILES_X * (cluster.y + CLUSTER_TILES_Y * cluster.z);
+}
+
+// depth is positive
+int ClusterSlice(float depth, float near, float far)
+{
+  return clamp(int(floor(log(depth / near) / log(far / near) * CLUSTER_SLICES)), 0, CLUSTER_SLICES - 1);
+}
+
+float SliceDepth(int slice, float near, float far)
+{
+  return near * pow(far / near, float(slice) / CLUSTER_SLICES);
+}
+
+#endif // CLUSTERS_H
\ No newline at end of file
@@ -0,0 +1,167 @@
+#version 460 core
+#define WORKGROUPSIZE 64
+
+#define CULL_PASS_FRUSTUM 0
+#define CULL_PASS_EARLY 1
+#define CULL_PASS_LATE 2
+#define CULL_PASS_CAMERA 3
+
+#define CULL_CASTERS_ALL 0
+#define CULL_CASTERS_STATIC 1
+#define CULL_CASTERS_DYNAMIC 2
+
+// frustum culls the draws of a multi-draw and appends the visible ones to outCommands, counting
+// them in drawCounts[u_countIndex] for glMultiDrawElementsIndirectCount. baseInstance keeps the
+// original draw index, so vertex shaders look their per-draw data up with gl_BaseInstance.
+// Occlusion culling takes two passes. The early pass appends what was visible last frame, which is
+// drawn and turned into the Hi-Z pyramid. The late pass tests every draw against it, records the
+// result for the next frame, and appends the visible draws the early pass missed. Without occlusion
+// culling the camera's frustum pass records its result the same way
+struct DrawElementsIndirectCommand
+{
+  uint count;
+  uint instanceCount;
+  uint firstIndex;
+  uint baseVertex;
+  uint baseInstance;
+};
+
+struct ObjectUniforms
+{
+  mat4 modelMatrix;
+  uint materialIndex;
+};
+
+struct DrawBounds
+{
+  vec4 boundsMin; // local space, w is 1 for meshes of moving objects
+  vec4 boundsMax;
+};
+
+layout (location = 0) uniform mat4 u_viewProj;
+layout (location = 1) uniform uint u_numDraws;
+layout (location = 2) uniform uint u_countIndex;
+layout (location = 3) uniform int u_pass;
+layout (location = 4) uniform vec4 u_planes[6]; // see Frustum in Culling.ixx, not always the planes of u_viewProj
+layout (location = 10) uniform int u_casterFilter = CULL_CASTERS_ALL;
+
+layout (binding = 0) uniform sampler2D u_hiz; // min/max depth pyramid, see hiz_build.cs
+
+layout (std430, binding = 0) readonly buffer Uniforms
+{
+  ObjectUniforms objects[];
+};
+
+layout (std430, binding = 1) readonly buffer Bounds
+{
+  DrawBounds bounds[];
+};
+
+layout (std430, binding = 2) readonly buffer InCommands
+{
+  DrawElementsIndirectCommand inCommands[];
+};
+
+layout (std430, binding = 3) writeonly buffer OutCommands
+{
+  DrawElementsIndirectCommand outCommands[];
+};
+
+layout (std430, binding = 4) buffer DrawCounts
+{
+  uint drawCounts[];
+};
+
+layout (std430, binding = 5) buffer Visibility
+{
+  uint drawVisible[]; // result of the last late (or camera) pass, also read back for texture residency
+};
+
+// true if the box is behind the farthest depth in the Hi-Z texels its screen rect covers
+bool IsOccluded(vec3 center, vec3 extent)
+{
+  vec3 ndcMin = vec3(1.0);
+  vec3 ndcMax = vec3(-1.0);
+  for (int c = 0; c < 8; c++)
+  {
+    vec3 corner = center + extent * vec3((c & 1) != 0 ? 1.0 : -1.0, (c & 2) != 0 ? 1.0 : -1.0, (c & 4) != 0 ? 1.0 : -1.0);
+    vec4 clip = u_viewProj * vec4(corner, 1.0);
+    if (clip.w <= 0.0)
+    {
+      return false; // crosses the camera plane
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    ndcMin = min(ndcMin, ndc);
+    ndcMax = max(ndcMax, ndc);
+  }
+
+  // the rect spans at most 2x2 texels of this level, so its corners cover it
+  vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+  vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+  vec2 size = (uvMax - uvMin) * vec2(textureSize(u_hiz, 0));
+  float lod = min(ceil(log2(max(max(size.x, size.y), 1.0))), float(textureQueryLevels(u_hiz) - 1));
+  float farthest = max(
+    max(textureLod(u_hiz, uvMin, lod).g, textureLod(u_hiz, vec2(uvMax.x, uvMin.y), lod).g),
+    max(textureLod(u_hiz, vec2(uvMin.x, uvMax.y), lod).g, textureLod(u_hiz, uvMax, lod).g));
+  return ndcMin.z * 0.5 + 0.5 > farthest;
+}
+
+layout (local_size_x = WORKGROUPSIZE, local_size_y = 1, local_size_z = 1) in;
+void main()
+{
+  uint i = gl_GlobalInvocationID.x;
+  if (i >= u_numDraws)
+  {
+    return;
+  }
+
+  bool isDynamic = bounds[i].boundsMin.w != 0.0;
+  if ((u_casterFilter == CULL_CASTERS_STATIC && isDynamic) || (u_casterFilter == CULL_CASTERS_DYNAMIC && !isDynamic))
+  {
+    return;
+  }
+
+  // same test as CullBoxes in Culling.ixx: the transformed box is re-fitted to an AABB and
+  // is outside if its center is further behind a plane than its projected radius
+  mat4 model = objects[i].modelMatrix;
+  vec3 localCenter = (bounds[i].boundsMin.xyz + bounds[i].boundsMax.xyz) * 0.5;
+  vec3 localExtent = (bounds[i].boundsMax.xyz - bounds[i].boundsMin.xyz) * 0.5;
+  vec3 center = vec3(model * vec4(localCenter, 1.0));
+  vec3 extent = mat3(abs(model[0].xyz), abs(model[1].xyz), abs(model[2].xyz)) * localExtent;
+
+  bool inFrustum = true;
+  for (int p = 0; p < 6; p++)
+  {
+    inFrustum = inFrustum && dot(u_planes[p].xyz, center) + u_planes[p].w + dot(abs(u_planes[p].xyz), extent) >= 0.0;
+  }
+
+  if (!inFrustum)
+  {
+    if (u_pass == CULL_PASS_LATE || u_pass == CULL_PASS_CAMERA)
+    {
+      drawVisible[i] = 0u;
+    }
+    return;
+  }
+  if (u_pass == CULL_PASS_CAMERA)
+  {
+    drawVisible[i] = 1u;
+  }
+  if (u_pass == CULL_PASS_EARLY && drawVisible[i] == 0)
+  {
+    return;
+  }
+  if (u_pass == CULL_PASS_LATE)
+  {
+    bool drawnEarly = drawVisible[i] != 0;
+    bool visible = !IsOccluded(center, extent);
+    drawVisible[i] = visible ? 1u : 0u;
+    if (!visible || drawnEarly)
+    {
+      return;
+    }
+  }
+
+  uint slot = atomicAdd(drawCounts[u_countIndex], 1u);
+  outCommands[slot] = inCommands[i];
+}
\ No newline at end of file
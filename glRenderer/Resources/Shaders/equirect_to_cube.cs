@@ -0,0 +1,17 @@
+#version 460 core
+#include "pbr_common.h"
+
+// resamples an equirectangular environment into the 6 faces of a cubemap (z = face)
+layout (location = 0) uniform sampler2D u_equirect;
+layout (location = 1, rgba16f) uniform writeonly imageCube u_outCube;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main()
+{
+  ivec3 texel = ivec3(gl_GlobalInvocationID.xyz);
+  int faceSize = imageSize(u_outCube).x;
+  if (any(greaterThanEqual(texel.xy, ivec2(faceSize)))) return;
+
+  vec3 dir = CubeTexelDirection(texel, faceSize);
+  imageStore(u_outCube, texel, vec4(textureLod(u_equirect, NormToEquirectangularUV(dir), 0.0).rgb, 1.0));
+}
\ No newline at end of file
@@ -5,8 +5,7 @@
 struct Material
 {
   uvec2 albedoHandle;
-  uvec2 roughnessHandle;
-  uvec2 metalnessHandle;
+  uvec2 roughnessMetalnessHandle; // R = roughness, G = metalness
   uvec2 normalHandle;
   uvec2 ambientOcclusionHandle;
 };
@@ -40,8 +39,7 @@ void main()
   Material material = materials[vMaterialIndex];
   vec3 normal = normalize(vNormal);
   const bool hasAlbedo = (material.albedoHandle.x != 0 || material.albedoHandle.y != 0);
-  const bool hasRoughness = (material.roughnessHandle.x != 0 || material.roughnessHandle.y != 0);
-  const bool hasMetalness = (material.metalnessHandle.x != 0 || material.metalnessHandle.y != 0);
+  const bool hasRoughnessMetalness = (material.roughnessMetalnessHandle.x != 0 || material.roughnessMetalnessHandle.y != 0);
   const bool hasNormal = (material.normalHandle.x != 0 || material.normalHandle.y != 0);
   const bool hasAmbientOcclusion = (material.ambientOcclusionHandle.x != 0 || material.ambientOcclusionHandle.y != 0);
   gNormal = float32x3_to_oct(normalize(normal));
@@ -59,13 +57,10 @@ void main()
   gRMA.rgba = vec4(1.0, 0.0, 1.0, 1.0); // sane defaults, gRMA.a is unused
   if (!u_materialOverride)
   {
-    if (hasRoughness)
+    if (hasRoughnessMetalness)
     {
-      gRMA[0] = texture(sampler2D(material.roughnessHandle), vTexCoord).r;
-    }
-    if (hasMetalness)
-    {
-      gRMA[1] = texture(sampler2D(material.metalnessHandle), vTexCoord).r;
+      // a map the material doesn't have is baked with the same default as above
+      gRMA.rg = texture(sampler2D(material.roughnessMetalnessHandle), vTexCoord).rg;
     }
     if (hasAmbientOcclusion)
     {
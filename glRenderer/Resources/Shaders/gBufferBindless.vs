@@ -27,7 +27,7 @@ layout (location = 0) out VS_OUT
 
 void main()
 {
-  ObjectUniforms obj = objects[gl_DrawID];
+  ObjectUniforms obj = objects[gl_BaseInstance];
   vMaterialIndex = obj.materialIndex;
   vTexCoord = aTexCoord;
   vec3 wPos = vec3(obj.modelMatrix * vec4(aPos, 1.0));
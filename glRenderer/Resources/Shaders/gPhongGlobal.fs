@@ -1,11 +1,13 @@
 #version 460 core
 #include "common.h"
 #include "pbr_common.h"
+#include "virtual_shadow.h"
 
 #define SHADOW_METHOD_PCF 0
 #define SHADOW_METHOD_VSM 1
 #define SHADOW_METHOD_ESM 2
 #define SHADOW_METHOD_MSM 3
+#define MAX_SHADOW_CASCADES 4
 
 layout (location = 0) in vec2 vTexCoord;
 
@@ -14,13 +16,12 @@ layout (location = 1, binding = 1) uniform sampler2D gAlbedo;
 layout (location = 2, binding = 2) uniform sampler2D gRMA;
 layout (location = 3, binding = 3) uniform sampler2D gDepth;
 layout (location = 4, binding = 4) uniform sampler2D ambientOcclusionTexture; // PCF, raw shadowmap
-layout (location = 5, binding = 5) uniform sampler2D filteredShadow; // ESM or VSM
-layout (location = 6, binding = 6) uniform sampler2D env_irradiance;
-layout (location = 7, binding = 7) uniform sampler2D env_radiance;
+layout (location = 5, binding = 5) uniform sampler2DArray filteredShadow; // ESM, VSM or MSM, a layer per cascade
+layout (location = 6, binding = 6) uniform sampler2D brdfLUT; // x = scale, y = bias to F0
+layout (location = 7, binding = 7) uniform samplerCube env_prefiltered; // GGX prefiltered radiance, roughness increases with mip
 layout (location = 8) uniform ivec2 u_screenSize;
-layout (location = 9) uniform uint u_samples;
+layout (location = 9) uniform float u_prefilteredMaxLod;
 layout (location = 10) uniform vec3 u_viewPos;
-layout (location = 11) uniform mat4 u_lightMatrix;
 layout (location = 12) uniform mat4 u_invViewProj;
 layout (location = 13) uniform float u_lightBleedFix = .9;
 layout (location = 14) uniform int u_shadowMethod = SHADOW_METHOD_ESM;
@@ -28,15 +29,62 @@ layout (location = 15) uniform float u_C;
 layout (location = 16) uniform vec3 u_globalLight_diffuse;
 layout (location = 17) uniform vec3 u_globalLight_direction;
 layout (location = 18) uniform float msmBias = 3e-5;
+layout (location = 19) uniform mat4 u_lightMatrices[MAX_SHADOW_CASCADES];
+layout (location = 23) uniform int u_numCascades;
+layout (location = 24) uniform bool u_showCascades = false;
+layout (location = 25, binding = 8) uniform sampler2DArrayShadow dynamicShadow; // moving casters only, redrawn every frame
+layout (location = 26) uniform bool u_summedAreaTables = false; // VSM and MSM moments are fixed point summed-area tables, read from u_momentsSAT
+layout (location = 27) uniform float u_satScale; // a moment of 1 in the tables
+layout (location = 28) uniform float u_lightSize = 0.02; // tangent of the light's angular radius
+layout (location = 29) uniform float u_maxFilterRadius = 32.0; // texels
+layout (location = 30, binding = 9) uniform sampler2DShadow u_vsmPool; // physical pages of the virtual shadow map
+layout (location = 31) uniform mat4 u_vsmMatrix; // world to the virtual shadow map's clip space
+layout (location = 35) uniform bool u_virtualShadows = false;
+layout (location = 36) uniform float u_vsmTexelSize; // world size of a level 0 texel
+layout (location = 37, binding = 10) uniform usampler2DArray u_momentsSAT; // uint view of filteredShadow's base level
+
+layout (std430, binding = 2) readonly buffer IrradianceSH
+{
+  vec4 irradianceSH[9]; // already convolved with the cosine lobe and divided by pi
+};
+
+layout (std430, binding = 3) readonly buffer VsmPageTable
+{
+  int vsmPageTable[]; // physical page of each virtual page, -1 if it has none
+};
 
 layout (location = 0) out vec4 fragColor;
 
-vec3 ShadowTexCoord(vec4 lightSpacePos)
+vec3 IrradianceSH9(vec3 n)
+{
+  vec3 result = irradianceSH[0].rgb * 0.282095
+    + irradianceSH[1].rgb * 0.488603 * n.y
+    + irradianceSH[2].rgb * 0.488603 * n.z
+    + irradianceSH[3].rgb * 0.488603 * n.x
+    + irradianceSH[4].rgb * 1.092548 * n.x * n.y
+    + irradianceSH[5].rgb * 1.092548 * n.y * n.z
+    + irradianceSH[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+    + irradianceSH[7].rgb * 1.092548 * n.x * n.z
+    + irradianceSH[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+  return max(result, vec3(0.0));
+}
+
+// the first (sharpest) cascade whose map contains the point, or -1 past the last one. The margin
+// keeps lookups off the edge texels: the blur clamps its fetches there, so they are biased towards
+// the border texel, and a filter region near the edge would reach past the map
+int SelectCascade(vec3 worldPos, out vec3 shadowCoord)
 {
-  vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-  if(projCoords.z > 1.0) return vec3(1.0);
-  projCoords = projCoords * 0.5 + 0.5;
-  return projCoords.xyz;
+  float margin = 8.0 / textureSize(filteredShadow, 0).x;
+  for (int c = 0; c < u_numCascades; c++)
+  {
+    vec4 lightSpacePos = u_lightMatrices[c] * vec4(worldPos, 1.0);
+    shadowCoord = lightSpacePos.xyz / lightSpacePos.w * 0.5 + 0.5;
+    if (all(greaterThan(shadowCoord, vec3(margin, margin, 0.0))) && all(lessThan(shadowCoord, vec3(1.0 - margin, 1.0 - margin, 1.0))))
+    {
+      return c;
+    }
+  }
+  return -1;
 }
 
 const float u_minVariance = .000001; // compensate for numeric precision
@@ -62,17 +110,15 @@ float Chebyshev(vec2 moments, float t)
   return max(p, p_max);
 }
 
-float ShadowVSM(vec4 lightSpacePos)
+float ShadowVSM(vec3 LightTexCoord, int cascade)
 {
-  vec3 LightTexCoord = ShadowTexCoord(lightSpacePos);
-  vec2 moments = texture(filteredShadow, LightTexCoord.xy).xy;
+  vec2 moments = texture(filteredShadow, vec3(LightTexCoord.xy, cascade)).xy;
   return Chebyshev(moments, LightTexCoord.z);
 }
 
-float ShadowESM(vec4 lightSpacePos)
+float ShadowESM(vec3 LightTexCoord, int cascade)
 {
-  vec3 LightTexCoord = ShadowTexCoord(lightSpacePos);
-  float lightDepth = texture(filteredShadow, LightTexCoord.xy).x;
+  float lightDepth = texture(filteredShadow, vec3(LightTexCoord.xy, cascade)).x;
   float eyeDepth = LightTexCoord.z;
   float shadowFacktor = lightDepth * exp(-u_C * eyeDepth);
   return clamp(shadowFacktor, 0.0, 1.0);
@@ -145,69 +191,173 @@ float computeMSM(vec4 moments, float fragmentDepth, float depthBias, float momen
   return 1.0 - clamp(sv[2] + sv[3] * quotient, 0.0, 1.0);
 }
 
-float ShadowMSM(vec4 lightSpacePos, float cosTheta)
+// power moments (z, z^2, z^3, z^4) from what msm_copy stored. Affine, so it commutes with filtering
+vec4 MSMPowerMoments(vec4 moments)
 {
-  float depthBias = .005 * tan(acos(cosTheta));
-  depthBias = clamp(depthBias, 0.0, 0.1);
-  vec3 LightTexCoord = ShadowTexCoord(lightSpacePos);
-  vec4 moments = texture(filteredShadow, LightTexCoord.xy).xyzw;
   mat4 magic = mat4(0.2227744146, 0.1549679261, 0.1451988946, 0.163127443,
                     0.0771972861, 0.1394629426, 0.2120202157, 0.2591432266,
                     0.7926986636, 0.7963415838, 0.7258694464, 0.6539092497,
                     0.0319417555,-0.1722823173,-0.2758014811,-0.3376131734);
   moments.x -= 0.035955884801;
-  moments = magic * moments; // undo original curve
-  return computeMSM(moments, LightTexCoord.z, depthBias * 0.15, msmBias);
+  return magic * moments; // undo original curve
 }
 
-float Shadow(vec4 lightSpacePos, float cosTheta)
+float MSMDepthBias(float cosTheta)
 {
-  switch (u_shadowMethod)
+  float depthBias = .005 * tan(acos(cosTheta));
+  return clamp(depthBias, 0.0, 0.1) * 0.15;
+}
+
+float ShadowMSM(vec3 LightTexCoord, int cascade, float cosTheta)
+{
+  vec4 moments = texture(filteredShadow, vec3(LightTexCoord.xy, cascade)).xyzw;
+  return computeMSM(MSMPowerMoments(moments), LightTexCoord.z, MSMDepthBias(cosTheta), msmBias);
+}
+
+// summed-area table entry, 0 (the empty sum) left of or below the map
+uvec4 FetchSAT(ivec2 texel, int cascade)
+{
+  if (any(lessThan(texel, ivec2(0))))
   {
-    case SHADOW_METHOD_ESM: return ShadowESM(lightSpacePos);
-    case SHADOW_METHOD_VSM: return ShadowVSM(lightSpacePos);
-    case SHADOW_METHOD_MSM: return ShadowMSM(lightSpacePos, cosTheta);
-    default: return 1.0;
+    return uvec4(0);
   }
+  return texelFetch(u_momentsSAT, ivec3(texel, cascade), 0);
 }
 
-float CalcLOD(uint samples, vec3 N, vec3 H, float roughness)
+// mean of the moments over the square of half size radius (uv) around uv, from their summed-area
+// table. Entry i holds the sum over texels 0 to i, so the sum up to a fractional texel coordinate x
+// lerps entries floor(x) - 1 and floor(x). Corners are interpolated by hand because every box is
+// differenced in uints first: only those differences are small enough to convert to floats exactly
+vec4 BoxFilterSAT(vec2 uv, float radius, int cascade)
 {
-  float dist = D_GGX(N, H, roughness);
-  return 0.5 * (log2(float(u_screenSize.x * u_screenSize.y) / samples) - log2(dist));
+  const ivec2 size = textureSize(u_momentsSAT, 0).xy;
+  const vec2 lo = clamp((uv - radius) * size, vec2(0.0), vec2(size));
+  const vec2 hi = clamp((uv + radius) * size, vec2(0.0), vec2(size));
+  const vec2 area = max(hi - lo, vec2(1e-3));
+
+  // x: lo.x, lo.x, hi.x, hi.x taps, y likewise. The last tap of a coordinate on the far edge has no weight
+  const ivec4 tapsX = min(ivec4(ivec2(floor(lo.x)), ivec2(floor(hi.x))) + ivec4(-1, 0, -1, 0), size.x - 1);
+  const ivec4 tapsY = min(ivec4(ivec2(floor(lo.y)), ivec2(floor(hi.y))) + ivec4(-1, 0, -1, 0), size.y - 1);
+  const vec4 weightsX = vec4(1.0 - fract(lo.x), fract(lo.x), 1.0 - fract(hi.x), fract(hi.x));
+  const vec4 weightsY = vec4(1.0 - fract(lo.y), fract(lo.y), 1.0 - fract(hi.y), fract(hi.y));
+  uvec4 table[4][4];
+  for (int y = 0; y < 4; y++)
+  {
+    for (int x = 0; x < 4; x++)
+    {
+      table[y][x] = FetchSAT(ivec2(tapsX[x], tapsY[y]), cascade);
+    }
+  }
+
+  vec4 sum = vec4(0.0);
+  for (int y = 0; y < 2; y++)
+  {
+    for (int x = 0; x < 2; x++)
+    {
+      for (int j = 2; j < 4; j++)
+      {
+        for (int i = 2; i < 4; i++)
+        {
+          const uvec4 box = table[j][i] - table[j][x] - table[y][i] + table[y][x]; // wraps back into range
+          sum += weightsX[x] * weightsX[i] * weightsY[y] * weightsY[j] * vec4(box);
+        }
+      }
+    }
+  }
+  return sum / (area.x * area.y * u_satScale);
 }
 
-vec3 ComputeSpecularRadiance(vec3 N, vec3 V, vec3 F0, float roughness)
+// first two power moments of the depths around uv
+vec2 DepthMomentsSAT(vec2 uv, float radius, int cascade)
+{
+  vec4 moments = BoxFilterSAT(uv, radius, cascade);
+  return u_shadowMethod == SHADOW_METHOD_MSM ? MSMPowerMoments(moments).xy : moments.xy;
+}
+
+// PCSS in a constant number of fetches. The average blocker depth comes from the moments of the
+// search region: whatever Chebyshev doesn't count as lit is assumed to be in front. Cascades are
+// orthographic with a depth range as long as their width, so a depth gap maps to uv by the
+// tangent of the light's angular radius
+float ShadowSAT(vec3 LightTexCoord, int cascade, float cosTheta)
 {
-  vec3 up = abs(N.z) < 0.999 ? vec3(0, 0, 1) : vec3(1, 0, 0);
-  vec3 tanX = normalize(cross(up, N));
-  vec3 tanY = cross(N, tanX);
+  const float texel = 1.0 / textureSize(filteredShadow, 0).x;
+  const float receiver = LightTexCoord.z;
 
-  float NoV = abs(dot(N, V));
+  float searchRadius = clamp(u_lightSize * receiver, texel, u_maxFilterRadius * texel);
+  vec2 search = DepthMomentsSAT(LightTexCoord.xy, searchRadius, cascade);
+  if (receiver <= search.x)
+  {
+    return 1.0;
+  }
+  float variance = max(search.y - search.x * search.x, u_minVariance);
+  float d = receiver - search.x;
+  float pLit = variance / (variance + d * d);
+  float blocker = clamp((search.x - pLit * receiver) / max(1.0 - pLit, 1e-4), 0.0, receiver);
+
+  float radius = clamp(u_lightSize * (receiver - blocker), texel, u_maxFilterRadius * texel);
+  vec4 moments = BoxFilterSAT(LightTexCoord.xy, radius, cascade);
+  if (u_shadowMethod == SHADOW_METHOD_MSM)
+  {
+    return computeMSM(MSMPowerMoments(moments), receiver, MSMDepthBias(cosTheta), msmBias);
+  }
+  return Chebyshev(moments.xy, receiver);
+}
 
-  vec3 accumColor = vec3(0.0);
-  const uint samples = u_samples;
-  for (uint i = 0; i < samples; i++)
+float StaticShadow(vec3 shadowCoord, int cascade, float cosTheta)
+{
+  if (u_summedAreaTables && (u_shadowMethod == SHADOW_METHOD_VSM || u_shadowMethod == SHADOW_METHOD_MSM))
   {
-    vec2 Xi = Hammersley(i, samples);
-    vec3 H = ImportanceSampleGGX(Xi, N, roughness);
-    vec3 L = normalize(-reflect(V, H));
-    //vec3 L  = normalize(2.0 * dot(V, H) * H - V);
-    
-    float NoL = abs(dot(N, L));
-    float NoH = abs(dot(N, H));
-    float VoH = abs(dot(V, H));
-    float lod = CalcLOD(samples, N, H, roughness);
-
-    vec3 F_ = fresnelSchlick(VoH, F0);
-    float G_ = G_Smith(N, V, L, roughness);
-    vec2 uuv = NormToEquirectangularUV(L);
-    vec3 LColor = textureLod(env_radiance, uuv, lod).rgb;
-
-    accumColor += F_ * G_ * LColor * VoH / max((NoH * NoV), 0.001);
+    return ShadowSAT(shadowCoord, cascade, cosTheta);
   }
+  switch (u_shadowMethod)
+  {
+    case SHADOW_METHOD_ESM: return ShadowESM(shadowCoord, cascade);
+    case SHADOW_METHOD_VSM: return ShadowVSM(shadowCoord, cascade);
+    case SHADOW_METHOD_MSM: return ShadowMSM(shadowCoord, cascade, cosTheta);
+    default: return 1.0;
+  }
+}
 
-  return accumColor / float(samples);
+float Shadow(vec3 shadowCoord, int cascade, float cosTheta)
+{
+  if (cascade < 0)
+  {
+    return 1.0; // beyond the shadow distance
+  }
+  // the cached map only has static casters, moving ones come from the hardware filtered overlay
+  float dynamicLit = texture(dynamicShadow, vec4(shadowCoord.xy, cascade, shadowCoord.z));
+  return min(StaticShadow(shadowCoord, cascade, cosTheta), dynamicLit);
+}
+
+// hardware PCF from the virtual shadow map, starting at level and falling back to coarser levels
+// while pages aren't mapped. -1 if none are (the cascades are used instead)
+float VirtualShadow(vec3 worldPos, vec3 N, int level)
+{
+  for (; level < VSM_NUM_LEVELS; level++)
+  {
+    // a texel and a half along the normal against acne, texels double in size every level
+    vec3 offsetPos = worldPos + N * (1.5 * u_vsmTexelSize * float(1 << level));
+    vec3 coord = (u_vsmMatrix * vec4(offsetPos, 1.0)).xyz * 0.5 + 0.5;
+    int physical = vsmPageTable[VsmPageIndex(coord.xy, level)];
+    if (physical >= 0)
+    {
+      // keep the bilinear footprint inside the page, neighbouring physical pages are unrelated
+      vec2 inPage = clamp(fract(coord.xy * (VSM_PAGES_PER_SIDE >> level)) * VSM_PAGE_SIZE, vec2(0.5), vec2(VSM_PAGE_SIZE - 0.5));
+      vec2 texel = vec2(physical % VSM_POOL_PAGES_PER_SIDE, physical / VSM_POOL_PAGES_PER_SIDE) * VSM_PAGE_SIZE + inPage;
+      return texture(u_vsmPool, vec3(texel / VSM_POOL_SIZE, coord.z));
+    }
+  }
+  return -1.0;
+}
+
+vec3 ComputeSpecularRadiance(vec3 N, vec3 V, vec3 F0, float roughness)
+{
+  // split sum: prefiltered radiance * integrated BRDF
+  vec3 R = reflect(-V, N);
+  float NoV = max(dot(N, V), 0.0);
+  vec3 radiance = textureLod(env_prefiltered, R, roughness * u_prefilteredMaxLod).rgb;
+  vec2 brdf = texture(brdfLUT, vec2(NoV, roughness)).xy;
+  return radiance * (F0 * brdf.x + brdf.y);
 }
 
 void main()
@@ -230,7 +380,8 @@ void main()
   float ambientOcclusion = RMA[2]; // material AO
   float ambientOcclusion2 = texture(ambientOcclusionTexture, vTexCoord).r; // SSAO
   ambientOcclusion *= ambientOcclusion2;
-  vec4 lightSpacePos = u_lightMatrix * vec4(vPos, 1.0);
+  vec3 shadowCoord;
+  int cascade = SelectCascade(vPos, shadowCoord);
 
   vec3 N = normalize(vNormal);
   vec3 V = normalize(u_viewPos - vPos);
@@ -240,7 +391,7 @@ void main()
   vec3 kS = fresnelSchlickRoughness(NoV, F0, roughness);
   vec3 kD = 1.0 - kS;
   kD *= 1.0 - metalness;
-  vec3 irradiance = texture(env_irradiance, NormToEquirectangularUV(N)).rgb;
+  vec3 irradiance = IrradianceSH9(N);
   vec3 envDiffuse = irradiance * albedo;
   vec3 envSpecular = vec3(0.0);
   if (metalness > 0.0 || roughness < 1.0)
@@ -276,13 +427,27 @@ void main()
     float shadow = 0.0;
     if (NoL > 0.0) // only shadow light-facing pixels
     {
-      shadow = Shadow(lightSpacePos, clamp(dot(N, L), -1.0, 1.0));
+      shadow = -1.0;
+      if (u_virtualShadows)
+      {
+        shadow = VirtualShadow(vPos, N, VsmPixelLevel(gDepth, ivec2(gl_FragCoord.xy), u_invViewProj, u_vsmMatrix));
+      }
+      if (shadow < 0.0)
+      {
+        shadow = Shadow(shadowCoord, cascade, clamp(dot(N, L), -1.0, 1.0));
+      }
     }
     //fragColor = vec4((shadow * (diffuse + step(.005, shadow) * specular)), 1.0);
     fragColor = vec4((shadow * local), 1.0);
   }
 
   fragColor.rgb += env;
+
+  if (u_showCascades && cascade >= 0)
+  {
+    const vec3 cascadeColors[MAX_SHADOW_CASCADES] = { vec3(1, .2, .2), vec3(.2, 1, .2), vec3(.2, .2, 1), vec3(1, 1, .2) };
+    fragColor.rgb *= cascadeColors[cascade];
+  }
   //fragColor = fragColor * .0001 + vec4(irradiance, 1.0);
   //fragColor = fragColor * .0001 + vec4(shadow); // view shadow
 }
\ No newline at end of file
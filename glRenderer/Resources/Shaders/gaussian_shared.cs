@@ -0,0 +1,62 @@
+#version 460 core
+#ifndef KERNEL_RADIUS
+#define KERNEL_RADIUS 3
+#endif
+#ifndef FORMAT
+#define FORMAT RG32f
+#endif
+#ifndef VECTOR
+#define VECTOR vec4 // smallest type holding FORMAT's channels, shrinks the shared tile
+#endif
+
+#include "gaussian_weights.h"
+
+// one pass of a separable gaussian. A workgroup blurs TILE_SIZE texels of one row (or column):
+// the tile and its apron are fetched into shared memory once, then every tap reads from there.
+// Fetches past the edges are clamped, so border texels are filtered too
+#define TILE_SIZE 128
+#define APRON (KERNEL_RADIUS - 1)
+
+layout (location = 0) uniform bool u_horizontal = false;
+layout (location = 1) uniform sampler2D u_inTex;
+layout (location = 2, FORMAT) uniform image2D u_outTex;
+layout (location = 3) uniform ivec2 u_texSize;
+
+shared VECTOR tile[TILE_SIZE + 2 * APRON];
+
+vec4 ToVec4(float v) { return vec4(v, 0.0, 0.0, 0.0); }
+vec4 ToVec4(vec2 v) { return vec4(v, 0.0, 0.0); }
+vec4 ToVec4(vec4 v) { return v; }
+
+// x = tiles along the line, y = lines
+layout (local_size_x = TILE_SIZE, local_size_y = 1, local_size_z = 1) in;
+void main()
+{
+  const ivec2 axis = u_horizontal ? ivec2(1, 0) : ivec2(0, 1);
+  const ivec2 lineStart = u_horizontal ? ivec2(0, gl_WorkGroupID.y) : ivec2(gl_WorkGroupID.y, 0);
+  const int lineLength = u_horizontal ? u_texSize.x : u_texSize.y;
+  const int tileStart = int(gl_WorkGroupID.x) * TILE_SIZE - APRON;
+
+  for (int i = int(gl_LocalInvocationIndex); i < TILE_SIZE + 2 * APRON; i += TILE_SIZE)
+  {
+    const int along = clamp(tileStart + i, 0, lineLength - 1);
+    tile[i] = VECTOR(texelFetch(u_inTex, lineStart + axis * along, 0));
+  }
+  barrier();
+
+  const int along = int(gl_GlobalInvocationID.x);
+  if (along >= lineLength)
+  {
+    return;
+  }
+
+  // taps are paired around the center, both share a weight
+  const int center = int(gl_LocalInvocationIndex) + APRON;
+  VECTOR color = tile[center] * weights[0];
+  for (int i = 1; i < KERNEL_RADIUS; i++)
+  {
+    color += (tile[center - i] + tile[center + i]) * weights[i];
+  }
+
+  imageStore(u_outTex, lineStart + axis * along, ToVec4(color));
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef GAUSSIAN_WEIGHTS_H
+#define GAUSSIAN_WEIGHTS_H
+
+// one side of a normalized gaussian, KERNEL_RADIUS taps including the center (2 * KERNEL_RADIUS - 1 wide)
+#if KERNEL_RADIUS == 6
+const float weights[] = { 0.22528, 0.192187, 0.119319, 0.053904, 0.017716, 0.004235 }; // 11x11
+#elif KERNEL_RADIUS == 5
+const float weights[] = { 0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216 }; // 9x9
+#elif KERNEL_RADIUS == 4
+const float weights[] = { 0.235624, 0.201012, 0.124798, 0.056379 }; // 7x7
+#elif KERNEL_RADIUS == 3
+const float weights[] = { 0.265569, 0.226558, 0.140658 }; // 5x5
+#elif KERNEL_RADIUS == 2
+const float weights[] = { 0.369521, 0.31524 }; // 3x3
+#elif KERNEL_RADIUS == 1
+const float weights[] = { 1.0 }; // 1x1 (lol)
+#endif
+
+#endif // GAUSSIAN_WEIGHTS_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#version 460 core
+
+// writes one level of the min/max depth pyramid (r = min, g = max) by reducing the texels of
+// u_src it covers. Level 0 is reduced from the depth buffer, whose size isn't a multiple of the
+// pyramid's, so a destination texel covers up to 3x3 source texels
+layout (location = 0) uniform int u_srcLevel;
+layout (location = 1) uniform bool u_srcIsDepth; // only r is valid
+
+layout (binding = 0) uniform sampler2D u_src;
+layout (binding = 0, rg32f) uniform writeonly image2D u_dst;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main()
+{
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 dstSize = imageSize(u_dst);
+  if (any(greaterThanEqual(texel, dstSize)))
+  {
+    return;
+  }
+
+  ivec2 srcSize = textureSize(u_src, u_srcLevel);
+  ivec2 first = (texel * srcSize) / dstSize;
+  ivec2 last = ((texel + 1) * srcSize - 1) / dstSize;
+
+  vec2 minMax = vec2(1.0, 0.0);
+  for (int y = first.y; y <= last.y; y++)
+  {
+    for (int x = first.x; x <= last.x; x++)
+    {
+      vec2 depth = texelFetch(u_src, ivec2(x, y), u_srcLevel).rg;
+      if (u_srcIsDepth)
+      {
+        depth = depth.rr;
+      }
+      minMax = vec2(min(minMax.x, depth.x), max(minMax.y, depth.y));
+    }
+  }
+  imageStore(u_dst, texel, vec4(minMax, 0.0, 0.0));
+}
\ No newline at end of file
@@ -16,15 +16,23 @@ layout (std430, binding = 0) readonly buffer lit
   PointLight lights[];
 };
 
+// atlas slot of each light's cube shadow map, -1 if it has none
+layout (std430, binding = 1) readonly buffer LightShadowSlots
+{
+  int lightShadowSlots[];
+};
+
 layout (location = 0) in vec3 aPos;
 
 layout (location = 1) uniform mat4 u_viewProj;
 
 layout (location = 0) out flat PointLight vLight;
+layout (location = 6) out flat int vShadowSlot;
 
 void main()
 {
   vLight = lights[gl_InstanceID];
+  vShadowSlot = lightShadowSlots[gl_InstanceID];
   vec3 vPos = aPos * sqrt(vLight.radiusSquared) + vLight.position.xyz;
   gl_Position = u_viewProj * vec4(vPos, 1.0);
 }
\ No newline at end of file
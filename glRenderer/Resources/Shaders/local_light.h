@@ -0,0 +1,113 @@
+#ifndef LOCAL_LIGHT_H
+#define LOCAL_LIGHT_H
+
+// point light shading shared by the light volume (gPhongManyLocal.fs) and clustered (cluster_shading.cs)
+// paths. Needs pbr_common.h
+struct PointLight
+{
+  vec4 diffuse;
+
+  vec4 position;
+  float linear;
+  float quadratic;
+  float radiusSquared;
+  float _padding;
+};
+
+layout (location = 8) uniform sampler2DShadow u_pointShadowAtlas;
+layout (location = 9) uniform mat4 u_cubeFaceViews[6]; // rotations only, see CubeFaceView
+layout (location = 15) uniform bool u_pointShadows;
+
+// per atlas slot, uv of face 0's lower left corner and uv size of a face. Faces are laid out 3 x 2
+layout (std430, binding = 3) readonly buffer ShadowSlots
+{
+  vec4 shadowSlots[];
+};
+
+const float POINT_SHADOW_NEAR = 0.05; // Renderer::POINT_SHADOW_NEAR
+
+float GetAttenuation(float distance, float linearFalloff, float quadraticFalloff)
+{
+  return 1.0 / (linearFalloff * distance + quadraticFalloff * (distance * distance));
+}
+
+// 1 if lit, sampled from the face of the light's cube map that the fragment's direction points into
+float PointShadow(PointLight light, int shadowSlot, vec3 worldPos, vec3 N)
+{
+  vec4 rect = shadowSlots[shadowSlot];
+  float faceTexels = rect.z * textureSize(u_pointShadowAtlas, 0).x;
+  vec3 toFrag = worldPos - light.position.xyz;
+  vec3 absDir = abs(toFrag);
+  float major = max(absDir.x, max(absDir.y, absDir.z));
+
+  // push the receiver out along its normal by about a texel at its distance to avoid acne
+  worldPos += N * (3.0 * major / faceTexels);
+  toFrag = worldPos - light.position.xyz;
+  absDir = abs(toFrag);
+
+  int face;
+  if (absDir.x >= absDir.y && absDir.x >= absDir.z)
+  {
+    face = toFrag.x > 0.0 ? 0 : 1;
+  }
+  else if (absDir.y >= absDir.z)
+  {
+    face = toFrag.y > 0.0 ? 2 : 3;
+  }
+  else
+  {
+    face = toFrag.z > 0.0 ? 4 : 5;
+  }
+
+  vec3 view = mat3(u_cubeFaceViews[face]) * toFrag;
+  vec2 faceUV = (view.xy / -view.z) * 0.5 + 0.5;
+  float n = POINT_SHADOW_NEAR;
+  float f = sqrt(light.radiusSquared);
+  float ndcDepth = (f + n) / (f - n) + 2.0 * f * n / ((f - n) * view.z);
+  float depth = ndcDepth * 0.5 + 0.5;
+
+  // keep the bilinear footprint inside the face
+  faceUV = clamp(faceUV, vec2(0.5 / faceTexels), vec2(1.0 - 0.5 / faceTexels));
+  vec2 uv = rect.xy + (vec2(face % 3, face / 3) + faceUV) * rect.zw;
+  return texture(u_pointShadowAtlas, vec3(uv, depth));
+}
+
+// outgoing radiance towards V, shadowSlot is -1 for unshadowed lights
+vec3 ShadeLocalLight(PointLight light, int shadowSlot, vec3 worldPos, vec3 N, vec3 V, vec3 albedo, float roughness, float metalness)
+{
+  float distanceToLightSquared = dot(worldPos - light.position.xyz, worldPos - light.position.xyz);
+  if (distanceToLightSquared > light.radiusSquared)
+  {
+    return vec3(0.0);
+  }
+  float attenuation = GetAttenuation(sqrt(distanceToLightSquared), light.linear, light.quadratic);
+
+  vec3 L = normalize(light.position.xyz - worldPos);
+  vec3 H = normalize(V + L);
+  vec3 F0 = mix(vec3(0.04), albedo, metalness);
+  F0 = clamp(F0, vec3(0.01), vec3(0.99));
+  vec3 radiance = light.diffuse.rgb * attenuation;
+
+  float NDF = D_GGX(N, H, roughness);
+  float G = G_Smith(N, V, L, roughness);
+  vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+  vec3 kS = F;
+  vec3 kD = vec3(1.0) - kS;
+  kD *= 1.0 - metalness;
+
+  // cook-torrance brdf
+  vec3 numerator = NDF * G * F;
+  float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
+  vec3 specular = numerator / max(denominator, 0.001);
+
+  float cosTheta = max(dot(N, L), 0.0);
+  vec3 local = (kD * albedo / M_PI + specular) * radiance * cosTheta;
+  if (u_pointShadows && shadowSlot >= 0)
+  {
+    local *= PointShadow(light, shadowSlot, worldPos, N);
+  }
+  return local * smoothstep(light.radiusSquared, .4 * light.radiusSquared, distanceToLightSquared);
+}
+
+#endif // LOCAL_LIGHT_H
\ No newline at end of file
@@ -52,6 +52,23 @@ vec2 NormToEquirectangularUV(vec3 normal)
   // return uv;
 }
 
+// direction through the center of a cubemap texel, following the GL face orientation table
+vec3 CubeTexelDirection(ivec3 texel, int faceSize)
+{
+  vec2 st = (vec2(texel.xy) + 0.5) / float(faceSize) * 2.0 - 1.0;
+  vec3 dir;
+  switch (texel.z)
+  {
+    case 0: dir = vec3(1.0, -st.y, -st.x); break;
+    case 1: dir = vec3(-1.0, -st.y, st.x); break;
+    case 2: dir = vec3(st.x, 1.0, st.y); break;
+    case 3: dir = vec3(st.x, -1.0, -st.y); break;
+    case 4: dir = vec3(st.x, -st.y, 1.0); break;
+    default: dir = vec3(-st.x, -st.y, -1.0); break;
+  }
+  return normalize(dir);
+}
+
 vec2 Hammersley(uint i, uint N)
 {
   return vec2(
@@ -0,0 +1,53 @@
+#version 460 core
+#include "pbr_common.h"
+
+// convolves a cubemap environment with the GGX lobe of one roughness (split sum, N = V = R)
+// each mip of the output holds a different roughness, see Environment.ixx
+layout (location = 0) uniform samplerCube u_environment;
+layout (location = 1) uniform float u_roughness;
+layout (location = 2) uniform uint u_samples;
+layout (location = 3, rgba16f) uniform writeonly imageCube u_outTex;
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main()
+{
+  ivec3 texel = ivec3(gl_GlobalInvocationID.xyz);
+  int faceSize = imageSize(u_outTex).x;
+  if (any(greaterThanEqual(texel.xy, ivec2(faceSize)))) return;
+
+  vec3 N = CubeTexelDirection(texel, faceSize);
+  vec3 V = N;
+
+  if (u_roughness == 0.0)
+  {
+    imageStore(u_outTex, texel, vec4(textureLod(u_environment, N, 0.0).rgb, 1.0));
+    return;
+  }
+
+  // sample from lower mips where samples are sparse to avoid fireflies
+  int envSize = textureSize(u_environment, 0).x;
+  float texelSolidAngle = 4.0 * M_PI / float(6 * envSize * envSize);
+
+  vec3 color = vec3(0.0);
+  float totalWeight = 0.0;
+  for (uint i = 0; i < u_samples; i++)
+  {
+    vec2 Xi = Hammersley(i, u_samples);
+    vec3 H = ImportanceSampleGGX(Xi, N, u_roughness);
+    vec3 L = normalize(2.0 * dot(V, H) * H - V);
+    float NoL = dot(N, L);
+    if (NoL > 0.0)
+    {
+      float NoH = max(dot(N, H), 0.0);
+      float VoH = max(dot(V, H), 0.0);
+      float pdf = D_GGX(N, H, u_roughness) * NoH / (4.0 * VoH) + 0.0001;
+      float sampleSolidAngle = 1.0 / (float(u_samples) * pdf);
+      float lod = 0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0;
+
+      color += textureLod(u_environment, L, lod).rgb * NoL;
+      totalWeight += NoL;
+    }
+  }
+
+  imageStore(u_outTex, texel, vec4(color / max(totalWeight, 0.0001), 1.0));
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#version 460 core
+#include "pbr_common.h"
+#define LOCAL_X 8
+#define LOCAL_Y 8
+#define WORKGROUPSIZE (LOCAL_X * LOCAL_Y)
+
+// first pass of the SH9 projection: every workgroup reduces its tile of one cubemap
+// face to 9 coefficients, which sh_reduce.cs then sums up
+layout (location = 0) uniform samplerCube u_environment;
+layout (location = 1) uniform int u_lod;
+
+layout (std430, binding = 0) writeonly buffer partials
+{
+  vec4 partialSums[]; // 9 per workgroup
+};
+
+// 9 coefficients per invocation stay well under the 32 KB of shared memory GL guarantees
+shared vec3 shSums[WORKGROUPSIZE][9];
+
+layout (local_size_x = LOCAL_X, local_size_y = LOCAL_Y, local_size_z = 1) in;
+void main()
+{
+  int faceSize = textureSize(u_environment, u_lod).x;
+  ivec3 texel = ivec3(gl_GlobalInvocationID.xyz);
+  uint idx = gl_LocalInvocationIndex;
+
+  for (int k = 0; k < 9; k++)
+  {
+    shSums[idx][k] = vec3(0.0);
+  }
+
+  if (all(lessThan(texel.xy, ivec2(faceSize))))
+  {
+    vec3 n = CubeTexelDirection(texel, faceSize);
+
+    // texels towards the face's corners cover less of the sphere
+    vec2 st = (vec2(texel.xy) + 0.5) / float(faceSize) * 2.0 - 1.0;
+    float solidAngle = (4.0 / float(faceSize * faceSize)) / pow(1.0 + dot(st, st), 1.5);
+    vec3 radiance = textureLod(u_environment, n, float(u_lod)).rgb * solidAngle;
+
+    shSums[idx][0] = radiance * 0.282095;
+    shSums[idx][1] = radiance * 0.488603 * n.y;
+    shSums[idx][2] = radiance * 0.488603 * n.z;
+    shSums[idx][3] = radiance * 0.488603 * n.x;
+    shSums[idx][4] = radiance * 1.092548 * n.x * n.y;
+    shSums[idx][5] = radiance * 1.092548 * n.y * n.z;
+    shSums[idx][6] = radiance * 0.315392 * (3.0 * n.z * n.z - 1.0);
+    shSums[idx][7] = radiance * 1.092548 * n.x * n.z;
+    shSums[idx][8] = radiance * 0.546274 * (n.x * n.x - n.y * n.y);
+  }
+  barrier();
+
+  for (uint stride = WORKGROUPSIZE / 2; stride > 0; stride /= 2)
+  {
+    if (idx < stride)
+    {
+      for (int k = 0; k < 9; k++)
+      {
+        shSums[idx][k] += shSums[idx + stride][k];
+      }
+    }
+    barrier();
+  }
+
+  if (idx == 0)
+  {
+    uint group = (gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y) * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    for (int k = 0; k < 9; k++)
+    {
+      partialSums[group * 9 + k] = vec4(shSums[0][k], 0.0);
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#version 460 core
+#define WORKGROUPSIZE 64
+
+// second pass of the SH9 projection: sums the per-workgroup results of sh_project.cs and
+// convolves them with the cosine lobe (divided by pi), matching RadianceToIrradianceSH9
+layout (location = 0) uniform uint u_numPartials;
+
+layout (std430, binding = 0) readonly buffer partials
+{
+  vec4 partialSums[];
+};
+
+layout (std430, binding = 1) writeonly buffer irradiance
+{
+  vec4 irradianceSH[9];
+};
+
+// 9 coefficients per invocation stay well under the 32 KB of shared memory GL guarantees
+shared vec3 shSums[WORKGROUPSIZE][9];
+
+layout (local_size_x = WORKGROUPSIZE, local_size_y = 1, local_size_z = 1) in;
+void main()
+{
+  uint idx = gl_LocalInvocationIndex;
+  for (int k = 0; k < 9; k++)
+  {
+    shSums[idx][k] = vec3(0.0);
+  }
+  for (uint i = idx; i < u_numPartials; i += WORKGROUPSIZE)
+  {
+    for (int k = 0; k < 9; k++)
+    {
+      shSums[idx][k] += partialSums[i * 9 + k].rgb;
+    }
+  }
+  barrier();
+
+  for (uint stride = WORKGROUPSIZE / 2; stride > 0; stride /= 2)
+  {
+    if (idx < stride)
+    {
+      for (int k = 0; k < 9; k++)
+      {
+        shSums[idx][k] += shSums[idx + stride][k];
+      }
+    }
+    barrier();
+  }
+
+  if (idx < 9)
+  {
+    const float bandScale[9] = float[](1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25);
+    irradianceSH[idx] = vec4(shSums[0][idx] * bandScale[idx], 0.0);
+  }
+}
\ No newline at end of file
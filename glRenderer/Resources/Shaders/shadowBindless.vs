@@ -2,17 +2,20 @@
 
 layout (location = 0) in vec3 aPos;
 
-struct ShadowUniformData
+struct ObjectUniforms
 {
-  mat4 modelLightMatrix;
+  mat4 modelMatrix;
+  uint materialIndex;
 };
 
+layout (location = 0) uniform mat4 u_lightMatrix; // of the cascade being drawn
+
 layout (binding = 0, std430) readonly buffer Uniforms
 {
-  ShadowUniformData uniforms[];  
+  ObjectUniforms objects[];
 };
 
 void main()
 {
-  gl_Position = uniforms[gl_DrawID].modelLightMatrix * vec4(aPos, 1.0);
+  gl_Position = u_lightMatrix * objects[gl_BaseInstance].modelMatrix * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+#version 460 core
+#extension GL_ARB_shader_viewport_layer_array : require
+
+layout (location = 0) in vec3 aPos;
+
+struct ObjectUniforms
+{
+  mat4 modelMatrix;
+  uint materialIndex;
+};
+
+// one per cube face, instance i of every draw goes to viewport i (face i's rect in the atlas)
+layout (location = 0) uniform mat4 u_faceViewProjs[6];
+
+layout (binding = 0, std430) readonly buffer Uniforms
+{
+  ObjectUniforms objects[];
+};
+
+void main()
+{
+  gl_ViewportIndex = gl_InstanceID;
+  gl_Position = u_faceViewProjs[gl_InstanceID] * objects[gl_BaseInstance].modelMatrix * vec4(aPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#version 460 core
+#ifndef FORMAT
+#define FORMAT RG32ui
+#endif
+#ifndef VECTOR
+#define VECTOR vec2
+#endif
+#ifndef UVECTOR
+#define UVECTOR uvec2
+#endif
+
+// one pass of summed-area table generation: inclusive prefix sums along every row (or column).
+// A workgroup scans one line. Each invocation sums a contiguous run serially, the run totals are
+// scanned in shared memory, then every run is rescanned from its total's prefix and stored.
+// The table is fixed point: the horizontal pass clamps each moment to [0, 1] and rounds it to
+// a multiple of 1 / u_scale. Sums wrap around 2^32, which leaves the difference of two entries
+// exact as long as the region between them sums to less than that
+#define GROUP_SIZE 256
+
+layout (location = 0) uniform bool u_horizontal = true;
+layout (location = 1) uniform sampler2D u_inTex; // moments, read by the horizontal pass
+layout (location = 2, FORMAT) uniform writeonly uimage2D u_outTex;
+layout (location = 3) uniform ivec2 u_texSize;
+layout (location = 4) uniform float u_scale;
+layout (location = 5, FORMAT) uniform readonly uimage2D u_rowSums; // read by the vertical pass
+
+shared UVECTOR runTotals[GROUP_SIZE];
+
+uvec4 ToUVec4(uint v) { return uvec4(v, 0u, 0u, 0u); }
+uvec4 ToUVec4(uvec2 v) { return uvec4(v, 0u, 0u); }
+uvec4 ToUVec4(uvec4 v) { return v; }
+
+UVECTOR Load(ivec2 texel)
+{
+  if (u_horizontal)
+  {
+    return UVECTOR(clamp(VECTOR(texelFetch(u_inTex, texel, 0)), 0.0, 1.0) * u_scale + 0.5);
+  }
+  return UVECTOR(imageLoad(u_rowSums, texel));
+}
+
+// x = lines
+layout (local_size_x = GROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+void main()
+{
+  const ivec2 axis = u_horizontal ? ivec2(1, 0) : ivec2(0, 1);
+  const ivec2 lineStart = u_horizontal ? ivec2(0, gl_WorkGroupID.x) : ivec2(gl_WorkGroupID.x, 0);
+  const int lineLength = u_horizontal ? u_texSize.x : u_texSize.y;
+  const int runLength = (lineLength + GROUP_SIZE - 1) / GROUP_SIZE;
+  const int local = int(gl_LocalInvocationIndex);
+  const int runStart = local * runLength;
+  const int runEnd = min(runStart + runLength, lineLength);
+
+  UVECTOR sum = UVECTOR(0);
+  for (int i = runStart; i < runEnd; i++)
+  {
+    sum += Load(lineStart + axis * i);
+  }
+  runTotals[local] = sum;
+  barrier();
+
+  // inclusive scan of the run totals
+  for (int stride = 1; stride < GROUP_SIZE; stride *= 2)
+  {
+    UVECTOR before = local >= stride ? runTotals[local - stride] : UVECTOR(0);
+    barrier();
+    runTotals[local] += before;
+    barrier();
+  }
+
+  UVECTOR running = local > 0 ? runTotals[local - 1] : UVECTOR(0);
+  for (int i = runStart; i < runEnd; i++)
+  {
+    running += Load(lineStart + axis * i);
+    imageStore(u_outTex, lineStart + axis * i, ToUVec4(running));
+  }
+}
\ No newline at end of file
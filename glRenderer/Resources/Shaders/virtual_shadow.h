@@ -0,0 +1,62 @@
+#ifndef VIRTUAL_SHADOW_H
+#define VIRTUAL_SHADOW_H
+
+// virtual shadow map layout, see VirtualShadowPages. Needs WorldPosFromDepthUV from common.h
+#ifndef VSM_VIRTUAL_SIZE
+#define VSM_VIRTUAL_SIZE 16384
+#endif
+#ifndef VSM_PAGE_SIZE
+#define VSM_PAGE_SIZE 128
+#endif
+#ifndef VSM_NUM_LEVELS
+#define VSM_NUM_LEVELS 8
+#endif
+#ifndef VSM_POOL_SIZE
+#define VSM_POOL_SIZE 4096
+#endif
+#define VSM_PAGES_PER_SIDE (VSM_VIRTUAL_SIZE / VSM_PAGE_SIZE)
+#define VSM_POOL_PAGES_PER_SIDE (VSM_POOL_SIZE / VSM_PAGE_SIZE)
+
+// index of the level's first page, pages are row major within a level
+int VsmLevelOffset(int level)
+{
+  int offset = 0;
+  for (int l = 0; l < level; l++)
+  {
+    int perSide = VSM_PAGES_PER_SIDE >> l;
+    offset += perSide * perSide;
+  }
+  return offset;
+}
+
+int VsmPageIndex(vec2 uv, int level)
+{
+  int perSide = VSM_PAGES_PER_SIDE >> level;
+  ivec2 page = clamp(ivec2(uv * perSide), ivec2(0), ivec2(perSide - 1));
+  return VsmLevelOffset(level) + page.x + page.y * perSide;
+}
+
+vec2 VsmPixelUV(sampler2D depthTex, ivec2 pixel, mat4 invViewProj, mat4 vsmMatrix)
+{
+  ivec2 size = textureSize(depthTex, 0);
+  pixel = clamp(pixel, ivec2(0), size - 1);
+  vec3 worldPos = WorldPosFromDepthUV(texelFetch(depthTex, pixel, 0).r, (vec2(pixel) + 0.5) / size, invViewProj);
+  return (vsmMatrix * vec4(worldPos, 1.0)).xy * 0.5 + 0.5;
+}
+
+// the level whose texels are about a pixel in size. The footprint is measured to both neighbours on
+// each axis and the smaller difference kept, so depth edges don't pick a coarse level
+int VsmPixelLevel(sampler2D depthTex, ivec2 pixel, mat4 invViewProj, mat4 vsmMatrix)
+{
+  vec2 uv = VsmPixelUV(depthTex, pixel, invViewProj, vsmMatrix);
+  vec2 right = VsmPixelUV(depthTex, pixel + ivec2(1, 0), invViewProj, vsmMatrix) - uv;
+  vec2 left = uv - VsmPixelUV(depthTex, pixel - ivec2(1, 0), invViewProj, vsmMatrix);
+  vec2 up = VsmPixelUV(depthTex, pixel + ivec2(0, 1), invViewProj, vsmMatrix) - uv;
+  vec2 down = uv - VsmPixelUV(depthTex, pixel - ivec2(0, 1), invViewProj, vsmMatrix);
+  float dx = min(length(right), length(left));
+  float dy = min(length(up), length(down));
+  float footprint = max(dx, dy) * VSM_VIRTUAL_SIZE;
+  return clamp(int(floor(log2(max(footprint, 1.0)))), 0, VSM_NUM_LEVELS - 1);
+}
+
+#endif // VIRTUAL_SHADOW_H
\ No newline at end of file
@@ -1,13 +1,13 @@
 #version 460 core
 #include "common.h"
+#define MAX_SHADOW_CASCADES 4
 
 layout (location = 0) in vec2 vTexCoord;
 
 layout (location = 1, binding = 1) uniform sampler2D gDepth;
-layout (location = 2, binding = 2) uniform sampler2D shadowDepth;
+layout (location = 2, binding = 2) uniform sampler2DArray shadowDepth; // a layer per cascade
 layout (location = 3, binding = 3) uniform sampler2D u_blueNoise;
 layout (location = 4) uniform mat4 u_invViewProj;
-layout (location = 5) uniform mat4 u_lightMatrix;
 layout (location = 6) uniform ivec2 u_screenSize;
 layout (location = 8) uniform int NUM_STEPS = 32;
 layout (location = 9) uniform float intensity = .025;
@@ -17,21 +17,27 @@ layout (location = 12) uniform float u_powderPower = 1.0;
 layout (location = 13) uniform float u_distanceScale = 1.0;
 layout (location = 14) uniform float u_heightOffset = 0.0;
 layout (location = 15) uniform float u_hfIntensity = 1.0;
+layout (location = 16) uniform mat4 u_lightMatrices[MAX_SHADOW_CASCADES];
+layout (location = 20) uniform int u_numCascades;
+layout (location = 21, binding = 4) uniform sampler2DArrayShadow dynamicShadowDepth; // moving casters only
 
 layout (location = 0) out float fragColor;
 
-float Shadow(vec4 lightSpacePos)
+// uses the first cascade that contains the point
+float Shadow(vec3 worldPos)
 {
-  vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
-  if (projCoords.z > 1.0) return 1.0;
-  projCoords = projCoords * 0.5 + 0.5;
-  if (any(lessThan(projCoords.xy, vec2(0))) || any(greaterThan(projCoords.xy, vec2(1)))) return 1.0;
-  float closestDepth = texture(shadowDepth, projCoords.xy).r;
-
-  float currentDepth = projCoords.z;
-  float shadow = currentDepth > closestDepth ? 1.0 : 0.0;
-
-  return shadow;
+  for (int c = 0; c < u_numCascades; c++)
+  {
+    vec4 lightSpacePos = u_lightMatrices[c] * vec4(worldPos, 1.0);
+    vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w * 0.5 + 0.5;
+    if (all(greaterThanEqual(projCoords, vec3(0))) && all(lessThanEqual(projCoords, vec3(1))))
+    {
+      float closestDepth = texture(shadowDepth, vec3(projCoords.xy, c)).r;
+      float dynamicLit = texture(dynamicShadowDepth, vec4(projCoords.xy, c, projCoords.z));
+      return max(projCoords.z > closestDepth ? 1.0 : 0.0, 1.0 - dynamicLit);
+    }
+  }
+  return 1.0;
 }
 
 void main()
@@ -48,8 +54,7 @@ void main()
   float accum = 0.0;
   for (int i = 0; i < NUM_STEPS; i++)
   {
-    vec4 lightSpacePos = u_lightMatrix * vec4(rayPos, 1.0);
-    accum += 1.0 - Shadow(lightSpacePos);
+    accum += 1.0 - Shadow(rayPos);
     rayPos += rayDir * rayStep;
   }
 
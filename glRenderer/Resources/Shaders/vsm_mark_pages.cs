@@ -0,0 +1,43 @@
+#version 460 core
+#include "common.h"
+#include "virtual_shadow.h"
+
+// sets the request bit of the virtual shadow map page every visible pixel needs, at the level
+// matching its footprint, and of the page a level coarser that the lighting pass falls back to
+// while the first isn't drawn yet. Read back by the CPU, which maps and draws the pages
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (location = 0) uniform sampler2D u_depth;
+layout (location = 1) uniform mat4 u_invViewProj;
+layout (location = 2) uniform mat4 u_vsmMatrix;
+
+layout (std430, binding = 0) coherent buffer PageRequests
+{
+  uint pageRequests[];
+};
+
+void main()
+{
+  ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(pixel, textureSize(u_depth, 0))) || texelFetch(u_depth, pixel, 0).r == 1.0)
+  {
+    return;
+  }
+
+  vec2 uv = VsmPixelUV(u_depth, pixel, u_invViewProj, u_vsmMatrix);
+  if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+  {
+    return;
+  }
+  int level = VsmPixelLevel(u_depth, pixel, u_invViewProj, u_vsmMatrix);
+  for (int l = level; l <= min(level + 1, VSM_NUM_LEVELS - 1); l++)
+  {
+    // most pixels hit a page whose bit is already set, reading first avoids most of the atomics
+    int page = VsmPageIndex(uv, l);
+    uint bit = 1u << (page % 32);
+    if ((pageRequests[page / 32] & bit) == 0)
+    {
+      atomicOr(pageRequests[page / 32], bit);
+    }
+  }
+}
\ No newline at end of file
@@ -66,12 +66,17 @@ Shader::Shader(std::vector<ShaderInfo> shaderInfos)
   options.SetAutoBindUniforms(true);
 
   std::vector<GLuint> shaderIDs;
-  for (auto& [shaderPath, shaderType, replace] : shaderInfos)
+  for (auto& [shaderPath, shaderType, replace, defines] : shaderInfos)
   {
+    shaderc::CompileOptions shaderOptions = options;
+    for (const auto& [name, value] : defines)
+    {
+      shaderOptions.AddMacroDefinition(name, value);
+    }
 #if USE_SPIRV
     // preprocess shader
     auto compileResult = spvPreprocessAndCompile(compiler,
-      options,
+      shaderOptions,
       replace,
       shaderPath,
       gl2shadercTypes.at(shaderType));
@@ -104,7 +109,7 @@ Shader::Shader(std::vector<ShaderInfo> shaderInfos)
       printf("Error binary-ing shader of type %d\n%s\n", shaderType, infoLog);
     }
 #else
-    std::string preprocessedSource = preprocessShader(compiler, options, replace, shaderPath, gl2shadercTypes.at(shaderType));
+    std::string preprocessedSource = preprocessShader(compiler, shaderOptions, replace, shaderPath, gl2shadercTypes.at(shaderType));
     GLuint shaderID = compileShader(shaderType, preprocessedSource, shaderPath);
     shaderIDs.push_back(shaderID);
 #endif
@@ -126,13 +131,13 @@ Shader::Shader(std::vector<ShaderInfo> shaderInfos)
   {
     glGetProgramInfoLog(programID, 512, NULL, infoLog);
     printf("Failed to link shader program.\nFiles:\n");
-    for (auto [path, type, repl] : shaderInfos)
+    for (const auto& [path, type, repl, defs] : shaderInfos)
       std::printf("%s\n", path.c_str());
     std::cout << "Failed to link shader program\n" << infoLog << std::endl;
   }
 
   std::vector<std::string_view> strs;
-  for (const auto& [shaderPath, shaderType, replace] : shaderInfos)
+  for (const auto& [shaderPath, shaderType, replace, defines] : shaderInfos)
   {
     strs.push_back(shaderPath);
   }
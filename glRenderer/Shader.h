@@ -9,11 +9,13 @@
 
 struct ShaderInfo
 {
-  ShaderInfo(std::string p, GLenum t, std::vector<std::pair<std::string, std::string>> r = {}) : path(p), type(t), replace(r) {}
+  ShaderInfo(std::string p, GLenum t, std::vector<std::pair<std::string, std::string>> r = {},
+    std::vector<std::pair<std::string, std::string>> d = {}) : path(p), type(t), replace(r), defines(d) {}
 
   std::string path{};
   GLenum type{};
-  std::vector<std::pair<std::string, std::string>> replace{};
+  std::vector<std::pair<std::string, std::string>> replace{}; // regex, replacement
+  std::vector<std::pair<std::string, std::string>> defines{}; // name, value. Predefined macros, use #ifndef for defaults
 };
 
 // encapsulates shaders by storing uniforms and its GPU memory location
@@ -148,6 +150,11 @@ public:
     assert(Uniforms.find(uniform) != Uniforms.end());
     glProgramUniformMatrix4fv(programID, Uniforms[uniform], 1, GL_FALSE, glm::value_ptr(mat));
   }
+  void SetMat4Array(std::string uniform, std::span<const glm::mat4> mats)
+  {
+    assert(Uniforms.find(uniform) != Uniforms.end());
+    glProgramUniformMatrix4fv(programID, Uniforms[uniform], static_cast<GLsizei>(mats.size()), GL_FALSE, glm::value_ptr(mats.front()));
+  }
   void SetHandle(std::string uniform, const uint64_t handle)
   {
     assert(Uniforms.find(uniform) != Uniforms.end());
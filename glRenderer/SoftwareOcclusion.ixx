@@ -0,0 +1,479 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <future>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <emmintrin.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+export module SoftwareOcclusion;
+
+import ThreadPool;
+import Utilities;
+
+// low resolution depth buffer rasterized on the CPU from a few large occluders, for rejecting
+// draws hidden behind them before the indirect commands are written. Rows are split into bands
+// that are rasterized in parallel, 4 samples at a time with SSE. Depth is GL window depth [0, 1],
+// smaller is closer, and the buffer is cleared to 1 (nothing there).
+// Triangles are sampled at pixel corners rather than centers, and a pixel takes the farthest depth
+// of its four corners. A pixel an occluder only partly covers thus stays empty, while pixels on an
+// edge shared by two of its triangles are still covered
+export class SoftwareOcclusion
+{
+public:
+  static constexpr int TILE_SIZE = 8; // tiles keep their farthest depth so tests can skip whole tiles
+
+  // width is rounded up to a multiple of 4
+  SoftwareOcclusion(int width, int height);
+
+  // clears the buffer and drops last frame's occluders
+  void BeginFrame(const glm::mat4& viewProj);
+
+  // transforms, clips and queues the triangles of an occluder (object space positions, 3 indices per triangle)
+  void AddOccluder(const glm::mat4& model, const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+  // rasterizes everything added since BeginFrame (uses the thread pool, so main thread only)
+  void Rasterize();
+
+  // true if any part of the world space box could be in front of the occluders
+  bool IsVisible(glm::vec3 center, glm::vec3 extent) const;
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  const std::vector<float>& GetDepth() const { return depth_; } // row major, bottom row first
+  size_t NumTriangles() const { return triangles_.size(); }
+
+private:
+  struct ScreenTriangle
+  {
+    std::array<glm::vec3, 3> v; // pixels and window depth
+  };
+
+  void AddClipTriangle(const std::array<glm::vec4, 3>& clip);
+  void RasterizeCorners(int firstRow, int lastRow);
+  void ResolveRows(int firstRow, int lastRow);
+
+  int width_{};
+  int height_{};
+  int cornerStride_{}; // width_ + 1 corners, padded for SSE
+  std::vector<float> corners_; // (height_ + 1) rows of cornerStride_
+  int tilesX_{};
+  int tilesY_{};
+  glm::mat4 viewProj_{ 1 };
+  std::vector<float> depth_;
+  std::vector<float> tileMax_;
+  std::vector<ScreenTriangle> triangles_;
+};
+
+export struct SoftwareOcclusionBenchmark
+{
+  size_t numTriangles{};
+  double rasterTime{}; // seconds, best of several runs
+  size_t numBoxes{};
+  size_t numVisible{};
+  double testTime{};
+};
+
+// rasterizes numTriangles random triangles in front of the camera, then tests numBoxes random boxes against them
+export SoftwareOcclusionBenchmark BenchmarkSoftwareOcclusion(size_t numTriangles, size_t numBoxes);
+
+SoftwareOcclusion::SoftwareOcclusion(int width, int height)
+  : width_((width + 3) & ~3),
+  height_(height),
+  cornerStride_(width_ + 4),
+  corners_(size_t(cornerStride_) * (height_ + 1), 1.0f),
+  tilesX_((width_ + TILE_SIZE - 1) / TILE_SIZE),
+  tilesY_((height_ + TILE_SIZE - 1) / TILE_SIZE),
+  depth_(size_t(width_) * height, 1.0f),
+  tileMax_(size_t(tilesX_) * tilesY_, 1.0f)
+{
+}
+
+void SoftwareOcclusion::BeginFrame(const glm::mat4& viewProj)
+{
+  viewProj_ = viewProj;
+  triangles_.clear();
+  std::fill(corners_.begin(), corners_.end(), 1.0f);
+  std::fill(depth_.begin(), depth_.end(), 1.0f);
+  std::fill(tileMax_.begin(), tileMax_.end(), 1.0f);
+}
+
+void SoftwareOcclusion::AddOccluder(const glm::mat4& model, const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+  const glm::mat4 mvp = viewProj_ * model;
+  std::vector<glm::vec4> clip(positions.size());
+  for (size_t i = 0; i < positions.size(); i++)
+  {
+    clip[i] = mvp * glm::vec4(positions[i], 1.0f);
+  }
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3)
+  {
+    const std::array<glm::vec4, 3> tri = { clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]] };
+
+    // trivially outside one of the side or far planes
+    bool outside = false;
+    for (int axis = 0; axis < 3 && !outside; axis++)
+    {
+      outside |= tri[0][axis] > tri[0].w && tri[1][axis] > tri[1].w && tri[2][axis] > tri[2].w;
+      outside |= axis < 2 && tri[0][axis] < -tri[0].w && tri[1][axis] < -tri[1].w && tri[2][axis] < -tri[2].w;
+    }
+    if (!outside)
+    {
+      AddClipTriangle(tri);
+    }
+  }
+}
+
+void SoftwareOcclusion::AddClipTriangle(const std::array<glm::vec4, 3>& clip)
+{
+  // near and side planes (dot(plane, v) >= 0 inside). Clipping to the sides keeps vertices
+  // close to the screen, so the edge functions don't lose precision. The sides are pushed out
+  // a little so clipped edges don't land exactly on the screen's outermost corner samples
+  constexpr float guard = 1.01f;
+  constexpr std::array<glm::vec4, 5> planes =
+  {
+    glm::vec4(0, 0, 1, 1),
+    glm::vec4(1, 0, 0, guard),
+    glm::vec4(-1, 0, 0, guard),
+    glm::vec4(0, 1, 0, guard),
+    glm::vec4(0, -1, 0, guard),
+  };
+
+  std::array<glm::vec4, 8> poly = { clip[0], clip[1], clip[2] };
+  std::array<glm::vec4, 8> clipped;
+  int count = 3;
+  for (const auto& plane : planes)
+  {
+    if (glm::dot(plane, poly[0]) >= 0 && glm::dot(plane, poly[1]) >= 0 && glm::dot(plane, poly[2]) >= 0 && count == 3)
+    {
+      continue; // the common case, nothing to clip
+    }
+    int clippedCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+      const glm::vec4& a = poly[i];
+      const glm::vec4& b = poly[(i + 1) % count];
+      const float da = glm::dot(plane, a);
+      const float db = glm::dot(plane, b);
+      if (da >= 0)
+      {
+        clipped[clippedCount++] = a;
+      }
+      if ((da >= 0) != (db >= 0))
+      {
+        clipped[clippedCount++] = glm::mix(a, b, da / (da - db));
+      }
+    }
+    poly = clipped;
+    count = clippedCount;
+    if (count < 3)
+    {
+      return;
+    }
+  }
+
+  std::array<glm::vec3, 8> screen;
+  for (int i = 0; i < count; i++)
+  {
+    const glm::vec3 ndc = glm::vec3(poly[i]) / poly[i].w;
+    screen[i] = glm::vec3((ndc.x * .5f + .5f) * width_, (ndc.y * .5f + .5f) * height_, ndc.z * .5f + .5f);
+  }
+  for (int i = 1; i + 1 < count; i++)
+  {
+    triangles_.push_back({ { screen[0], screen[i], screen[i + 1] } });
+  }
+}
+
+void SoftwareOcclusion::Rasterize()
+{
+  // bands are whole tile rows, so each band also owns its tiles' farthest depth. A band's pixels
+  // need the first corner row of the next band, so pixels are resolved once every corner is in
+  auto& pool = ThreadPool::Get();
+  const int numBands = std::max(1, std::min(static_cast<int>(pool.NumThreads()), tilesY_));
+  auto forEachBand = [&](auto&& func)
+  {
+    std::vector<std::future<void>> jobs;
+    for (int band = 0; band < numBands; band++)
+    {
+      const int firstTile = tilesY_ * band / numBands;
+      const int lastTile = tilesY_ * (band + 1) / numBands;
+      const int firstRow = firstTile * TILE_SIZE;
+      const int lastRow = std::min(lastTile * TILE_SIZE, height_);
+      jobs.push_back(pool.Submit([=, this] { (this->*func)(firstRow, band + 1 == numBands ? lastRow + 1 : lastRow); }));
+    }
+    for (auto& job : jobs)
+    {
+      job.get();
+    }
+  };
+  forEachBand(&SoftwareOcclusion::RasterizeCorners);
+  forEachBand(&SoftwareOcclusion::ResolveRows);
+}
+
+void SoftwareOcclusion::RasterizeCorners(int firstRow, int lastRow)
+{
+  const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  for (const auto& tri : triangles_)
+  {
+    glm::vec3 v0 = tri.v[0];
+    glm::vec3 v1 = tri.v[1];
+    glm::vec3 v2 = tri.v[2];
+
+    const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (std::abs(area) < 1e-8f)
+    {
+      continue;
+    }
+    if (area < 0)
+    {
+      std::swap(v1, v2); // occluders are two-sided
+    }
+
+    const int minY = std::max(firstRow, static_cast<int>(std::floor(std::min({ v0.y, v1.y, v2.y }))));
+    const int maxY = std::min(lastRow - 1, static_cast<int>(std::ceil(std::max({ v0.y, v1.y, v2.y }))));
+    const int minX = std::max(0, static_cast<int>(std::floor(std::min({ v0.x, v1.x, v2.x })))) & ~3;
+    const int maxX = std::min(width_, static_cast<int>(std::ceil(std::max({ v0.x, v1.x, v2.x }))));
+    if (minY > maxY || minX > maxX)
+    {
+      continue;
+    }
+
+    // edge functions E(x, y) = a * x + b * y + c, positive inside
+    const std::array<glm::vec3, 3> verts = { v0, v1, v2 };
+    std::array<float, 3> ea, eb, ec;
+    for (int e = 0; e < 3; e++)
+    {
+      const glm::vec3& p = verts[(e + 1) % 3];
+      const glm::vec3& q = verts[(e + 2) % 3];
+      ea[e] = p.y - q.y;
+      eb[e] = q.x - p.x;
+      ec[e] = p.x * q.y - p.y * q.x;
+    }
+
+    // window depth is affine in screen space
+    const float invArea = 1.0f / std::abs(area);
+    const float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+    const float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+
+    std::array<__m128, 3> stepX, eRow;
+    for (int e = 0; e < 3; e++)
+    {
+      stepX[e] = _mm_set1_ps(ea[e] * 4.0f);
+    }
+    const __m128 zStepX = _mm_set1_ps(dzdx * 4.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (int y = minY; y <= maxY; y++)
+    {
+      // span of the row where every edge function can be positive, widened by a pixel against rounding
+      const float py = float(y);
+      float spanMin = float(minX);
+      float spanMax = float(maxX);
+      for (int e = 0; e < 3; e++)
+      {
+        if (ea[e] != 0.0f)
+        {
+          const float crossing = -(eb[e] * py + ec[e]) / ea[e];
+          if (ea[e] > 0.0f)
+          {
+            spanMin = std::max(spanMin, crossing - 1.0f);
+          }
+          else
+          {
+            spanMax = std::min(spanMax, crossing + 1.0f);
+          }
+        }
+      }
+      if (spanMin > spanMax)
+      {
+        continue;
+      }
+      const int rowMinX = static_cast<int>(spanMin) & ~3;
+      const int rowMaxX = std::min(static_cast<int>(spanMax), width_);
+
+      const __m128 px = _mm_add_ps(_mm_set1_ps(float(rowMinX)), laneOffsets);
+      for (int e = 0; e < 3; e++)
+      {
+        eRow[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ea[e]), px), _mm_set1_ps(eb[e] * py + ec[e]));
+      }
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(v0.x)), _mm_set1_ps(dzdx)), _mm_set1_ps(v0.z + (py - v0.y) * dzdy));
+
+      float* row = &corners_[size_t(y) * cornerStride_];
+      for (int x = rowMinX; x <= rowMaxX; x += 4)
+      {
+        const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(eRow[0], zero), _mm_cmpge_ps(eRow[1], zero)), _mm_cmpge_ps(eRow[2], zero));
+        if (_mm_movemask_ps(inside))
+        {
+          const __m128 old = _mm_loadu_ps(row + x);
+          const __m128 closer = _mm_min_ps(old, z);
+          _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+        }
+        for (int e = 0; e < 3; e++)
+        {
+          eRow[e] = _mm_add_ps(eRow[e], stepX[e]);
+        }
+        z = _mm_add_ps(z, zStepX);
+      }
+    }
+  }
+}
+
+void SoftwareOcclusion::ResolveRows(int firstRow, int lastRow)
+{
+  lastRow = std::min(lastRow, height_);
+  for (int y = firstRow; y < lastRow; y++)
+  {
+    const float* below = &corners_[size_t(y) * cornerStride_];
+    const float* above = below + cornerStride_;
+    float* row = &depth_[size_t(y) * width_];
+    for (int x = 0; x < width_; x += 4)
+    {
+      const __m128 left = _mm_max_ps(_mm_loadu_ps(below + x), _mm_loadu_ps(above + x));
+      const __m128 right = _mm_max_ps(_mm_loadu_ps(below + x + 1), _mm_loadu_ps(above + x + 1));
+      _mm_storeu_ps(row + x, _mm_max_ps(left, right));
+    }
+  }
+
+  // farthest depth of each tile in this band
+  for (int ty = firstRow / TILE_SIZE; ty * TILE_SIZE < lastRow; ty++)
+  {
+    for (int tx = 0; tx < tilesX_; tx++)
+    {
+      float farthest = 0.0f;
+      for (int y = ty * TILE_SIZE; y < std::min((ty + 1) * TILE_SIZE, height_); y++)
+      {
+        for (int x = tx * TILE_SIZE; x < std::min((tx + 1) * TILE_SIZE, width_); x++)
+        {
+          farthest = std::max(farthest, depth_[size_t(y) * width_ + x]);
+        }
+      }
+      tileMax_[size_t(ty) * tilesX_ + tx] = farthest;
+    }
+  }
+}
+
+bool SoftwareOcclusion::IsVisible(glm::vec3 center, glm::vec3 extent) const
+{
+  glm::vec2 pixelMin(std::numeric_limits<float>::max());
+  glm::vec2 pixelMax(std::numeric_limits<float>::lowest());
+  float nearest = 1.0f;
+  for (int c = 0; c < 8; c++)
+  {
+    const glm::vec3 corner = center + extent * glm::vec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+    const glm::vec4 clip = viewProj_ * glm::vec4(corner, 1.0f);
+    if (clip.z < -clip.w)
+    {
+      return true; // crosses the near plane
+    }
+    const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    const glm::vec2 pixel = (glm::vec2(ndc) * .5f + .5f) * glm::vec2(width_, height_);
+    pixelMin = glm::min(pixelMin, pixel);
+    pixelMax = glm::max(pixelMax, pixel);
+    nearest = std::min(nearest, ndc.z * .5f + .5f);
+  }
+
+  // every pixel the box touches, not just the ones whose centers it covers
+  const int minX = std::max(0, static_cast<int>(std::floor(pixelMin.x)));
+  const int minY = std::max(0, static_cast<int>(std::floor(pixelMin.y)));
+  const int maxX = std::min(width_ - 1, static_cast<int>(std::floor(pixelMax.x)));
+  const int maxY = std::min(height_ - 1, static_cast<int>(std::floor(pixelMax.y)));
+  if (minX > maxX || minY > maxY)
+  {
+    return false; // off screen
+  }
+
+  const __m128 vNearest = _mm_set1_ps(nearest);
+  for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ty++)
+  {
+    for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; tx++)
+    {
+      if (nearest > tileMax_[size_t(ty) * tilesX_ + tx])
+      {
+        continue; // behind everything in this tile
+      }
+
+      const int x0 = std::max(minX, tx * TILE_SIZE);
+      const int x1 = std::min(maxX, (tx + 1) * TILE_SIZE - 1);
+      for (int y = std::max(minY, ty * TILE_SIZE); y <= std::min(maxY, (ty + 1) * TILE_SIZE - 1); y++)
+      {
+        const float* row = &depth_[size_t(y) * width_];
+        int x = x0;
+        for (; x + 3 <= x1; x += 4)
+        {
+          if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), vNearest)))
+          {
+            return true;
+          }
+        }
+        for (; x <= x1; x++)
+        {
+          if (row[x] >= nearest)
+          {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+SoftwareOcclusionBenchmark BenchmarkSoftwareOcclusion(size_t numTriangles, size_t numBoxes)
+{
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> spread(-60.0f, 60.0f);
+  std::uniform_real_distribution<float> depth(-80.0f, -5.0f);
+  std::uniform_real_distribution<float> offset(-1.5f, 1.5f);
+
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  for (size_t i = 0; i < numTriangles; i++)
+  {
+    const glm::vec3 center(spread(rng), spread(rng) * .5f, depth(rng));
+    for (int v = 0; v < 3; v++)
+    {
+      indices.push_back(static_cast<uint32_t>(positions.size()));
+      positions.push_back(center + glm::vec3(offset(rng), offset(rng), offset(rng) * .1f));
+    }
+  }
+
+  const glm::mat4 view = glm::lookAt(glm::vec3(0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+  const glm::mat4 proj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.3f, 300.0f);
+  SoftwareOcclusion occlusion(320, 180);
+
+  SoftwareOcclusionBenchmark result{ .rasterTime = std::numeric_limits<double>::max(), .numBoxes = numBoxes, .testTime = std::numeric_limits<double>::max() };
+  for (int run = 0; run < 5; run++)
+  {
+    Timer timer;
+    occlusion.BeginFrame(proj * view);
+    occlusion.AddOccluder(glm::mat4(1), positions, indices);
+    occlusion.Rasterize();
+    result.rasterTime = std::min(result.rasterTime, timer.elapsed());
+  }
+  result.numTriangles = occlusion.NumTriangles();
+
+  std::vector<glm::vec3> centers(numBoxes);
+  for (auto& center : centers)
+  {
+    center = { spread(rng), spread(rng) * .5f, depth(rng) - 10.0f };
+  }
+  for (int run = 0; run < 5; run++)
+  {
+    Timer timer;
+    size_t visible = 0;
+    for (const auto& center : centers)
+    {
+      visible += occlusion.IsVisible(center, glm::vec3(1.0f));
+    }
+    result.testTime = std::min(result.testTime, timer.elapsed());
+    result.numVisible = visible;
+  }
+  return result;
+}
\ No newline at end of file
@@ -0,0 +1,188 @@
+module;
+
+#include <array>
+#include <vector>
+#include <future>
+#include <cmath>
+#include <algorithm>
+#include <xmmintrin.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+export module SphericalHarmonics;
+
+import ThreadPool;
+
+// 3 band (9 coefficient) spherical harmonics of an RGB signal. Coefficients are vec4 so the
+// array can be uploaded as-is to a std430 buffer, w is unused
+export using SH9 = std::array<glm::vec4, 9>;
+
+// projects an RGBA32F equirectangular environment onto SH9, splitting rows across the thread pool
+// rows are bottom to top (as uploaded), matching NormToEquirectangularUV in pbr_common.h
+export SH9 ProjectEquirectSH9(const float* rgba, glm::ivec2 dim);
+
+// convolves radiance with the clamped cosine lobe and divides by pi, so evaluating the result
+// gives irradiance / pi (what the shader multiplies by albedo)
+export SH9 RadianceToIrradianceSH9(const SH9& radiance);
+
+export glm::vec3 EvaluateSH9(const SH9& sh, glm::vec3 n);
+
+namespace
+{
+  constexpr float SH_C0 = 0.282095f;
+  constexpr float SH_C1 = 0.488603f;
+  constexpr float SH_C2 = 1.092548f;
+  constexpr float SH_C3 = 0.315392f;
+  constexpr float SH_C4 = 0.546274f;
+
+  using Sums = std::array<double, 27>; // 9 coefficients, RGB each
+
+  // accumulates rows [first, last), 4 texels at a time
+  Sums ProjectRows(const float* rgba, glm::ivec2 dim, int first, int last,
+    const std::vector<float>& cosTheta, const std::vector<float>& sinTheta)
+  {
+    Sums sums{};
+    const float texelArea = (glm::two_pi<float>() / dim.x) * (glm::pi<float>() / dim.y);
+    for (int j = first; j < last; j++)
+    {
+      const float phi = (j + 0.5f) / dim.y * glm::pi<float>();
+      const float sinPhi = std::sin(phi);
+      const float y = -std::cos(phi);
+      const __m128 vSinPhi = _mm_set1_ps(sinPhi);
+      const __m128 vy = _mm_set1_ps(y);
+      const __m128 weight = _mm_set1_ps(texelArea * sinPhi); // solid angle of texels in this row
+      const float* row = rgba + size_t(j) * dim.x * 4;
+
+      std::array<__m128, 27> acc;
+      acc.fill(_mm_setzero_ps());
+      int i = 0;
+      for (; i + 4 <= dim.x; i += 4)
+      {
+        const __m128 x = _mm_mul_ps(vSinPhi, _mm_loadu_ps(&cosTheta[i]));
+        const __m128 z = _mm_mul_ps(vSinPhi, _mm_loadu_ps(&sinTheta[i]));
+
+        __m128 r = _mm_loadu_ps(row + i * 4 + 0);
+        __m128 g = _mm_loadu_ps(row + i * 4 + 4);
+        __m128 b = _mm_loadu_ps(row + i * 4 + 8);
+        __m128 a = _mm_loadu_ps(row + i * 4 + 12);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+        r = _mm_mul_ps(r, weight);
+        g = _mm_mul_ps(g, weight);
+        b = _mm_mul_ps(b, weight);
+
+        const std::array<__m128, 9> basis =
+        {
+          _mm_set1_ps(SH_C0),
+          _mm_mul_ps(_mm_set1_ps(SH_C1), vy),
+          _mm_mul_ps(_mm_set1_ps(SH_C1), z),
+          _mm_mul_ps(_mm_set1_ps(SH_C1), x),
+          _mm_mul_ps(_mm_set1_ps(SH_C2), _mm_mul_ps(x, vy)),
+          _mm_mul_ps(_mm_set1_ps(SH_C2), _mm_mul_ps(vy, z)),
+          _mm_mul_ps(_mm_set1_ps(SH_C3), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f))),
+          _mm_mul_ps(_mm_set1_ps(SH_C2), _mm_mul_ps(x, z)),
+          _mm_mul_ps(_mm_set1_ps(SH_C4), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(vy, vy))),
+        };
+        for (size_t k = 0; k < 9; k++)
+        {
+          acc[k * 3 + 0] = _mm_add_ps(acc[k * 3 + 0], _mm_mul_ps(basis[k], r));
+          acc[k * 3 + 1] = _mm_add_ps(acc[k * 3 + 1], _mm_mul_ps(basis[k], g));
+          acc[k * 3 + 2] = _mm_add_ps(acc[k * 3 + 2], _mm_mul_ps(basis[k], b));
+        }
+      }
+
+      // rows are summed in float, the totals in double
+      for (size_t k = 0; k < 27; k++)
+      {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, acc[k]);
+        sums[k] += double(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+      }
+
+      for (; i < dim.x; i++)
+      {
+        const float x = sinPhi * cosTheta[i];
+        const float z = sinPhi * sinTheta[i];
+        const float basis[9] =
+        {
+          SH_C0, SH_C1 * y, SH_C1 * z, SH_C1 * x,
+          SH_C2 * x * y, SH_C2 * y * z, SH_C3 * (3 * z * z - 1), SH_C2 * x * z, SH_C4 * (x * x - y * y),
+        };
+        const float w = texelArea * sinPhi;
+        for (size_t k = 0; k < 9; k++)
+        {
+          for (size_t c = 0; c < 3; c++)
+          {
+            sums[k * 3 + c] += double(basis[k]) * row[i * 4 + c] * w;
+          }
+        }
+      }
+    }
+    return sums;
+  }
+}
+
+SH9 ProjectEquirectSH9(const float* rgba, glm::ivec2 dim)
+{
+  // x and z only depend on the column (up to a factor of sin(phi))
+  std::vector<float> cosTheta(dim.x), sinTheta(dim.x);
+  for (int i = 0; i < dim.x; i++)
+  {
+    const float theta = (i + 0.5f) / dim.x * glm::two_pi<float>() - glm::pi<float>();
+    cosTheta[i] = std::cos(theta);
+    sinTheta[i] = std::sin(theta);
+  }
+
+  auto& pool = ThreadPool::Get();
+  const int numJobs = static_cast<int>(std::min<size_t>(pool.NumThreads() * 4, size_t(dim.y)));
+  std::vector<std::future<Sums>> jobs;
+  for (int job = 0; job < numJobs; job++)
+  {
+    const int first = dim.y * job / numJobs;
+    const int last = dim.y * (job + 1) / numJobs;
+    jobs.push_back(pool.Submit([=, &cosTheta, &sinTheta] { return ProjectRows(rgba, dim, first, last, cosTheta, sinTheta); }));
+  }
+
+  Sums total{};
+  for (auto& job : jobs)
+  {
+    const Sums sums = job.get();
+    for (size_t k = 0; k < total.size(); k++)
+    {
+      total[k] += sums[k];
+    }
+  }
+
+  SH9 sh{};
+  for (size_t k = 0; k < 9; k++)
+  {
+    sh[k] = glm::vec4(total[k * 3 + 0], total[k * 3 + 1], total[k * 3 + 2], 0.0f);
+  }
+  return sh;
+}
+
+SH9 RadianceToIrradianceSH9(const SH9& radiance)
+{
+  // cosine lobe band factors (pi, 2pi/3, pi/4), divided by pi
+  constexpr float bandScale[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+  SH9 irradiance{};
+  for (size_t k = 0; k < 9; k++)
+  {
+    irradiance[k] = radiance[k] * bandScale[k];
+  }
+  return irradiance;
+}
+
+glm::vec3 EvaluateSH9(const SH9& sh, glm::vec3 n)
+{
+  const float basis[9] =
+  {
+    SH_C0, SH_C1 * n.y, SH_C1 * n.z, SH_C1 * n.x,
+    SH_C2 * n.x * n.y, SH_C2 * n.y * n.z, SH_C3 * (3 * n.z * n.z - 1), SH_C2 * n.x * n.z, SH_C4 * (n.x * n.x - n.y * n.y),
+  };
+  glm::vec3 result(0);
+  for (size_t k = 0; k < 9; k++)
+  {
+    result += glm::vec3(sh[k]) * basis[k];
+  }
+  return glm::max(result, glm::vec3(0));
+}
\ No newline at end of file
@@ -1,17 +1,33 @@
 module;
 
 #include <string>
+#include <vector>
+#include <future>
+#include <cstddef>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <glm/glm.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 #include <iostream>
+#include <array>
 #include <filesystem>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
 export module GPU.Texture;
 
+import ThreadPool;
+import Utilities;
+import TextureMips;
+export import TextureCompression;
+
 export struct TextureCreateInfo
 {
   std::string path;
@@ -20,12 +36,46 @@ export struct TextureCreateInfo
   bool HDR{};
   int minFilter{};
   int magFilter{};
+  TextureCompression compression{}; // LDR only
+  bool normalMap{}; // mips are renormalized, and the data isn't linearized like colors are
+  bool streamMips{}; // only the mip tail is uploaded up front, see Texture2D::StreamNextLevel
+};
+
+// CPU-side image data, decoded off the GL thread
+export struct TextureData
+{
+  glm::ivec2 dim{};
+  bool HDR{};
+  GLenum compressedFormat{}; // 0 if uncompressed
+  std::vector<std::byte> pixels; // RGBA8 or RGBA32F (HDR), or compressed blocks. Every level back to back
+  std::vector<size_t> levelOffsets; // start of each level in pixels, empty if mips are left to the GPU (HDR)
+
+  bool Valid() const { return !pixels.empty(); }
 };
 
+// decodes an image on the calling thread, returns empty data if the file doesn't exist
+export TextureData LoadTextureData(const TextureCreateInfo& createInfo);
+
+// decodes an image on the shared thread pool
+export std::future<TextureData> LoadTextureDataAsync(const TextureCreateInfo& createInfo);
+
+// a texture whose RGB channels are each copied from the red channel of a separate image
+export struct ChannelPackInfo
+{
+  std::array<std::string, 3> paths; // empty or missing paths use the fallback
+  std::array<uint8_t, 3> fallback{};
+};
+
+// bakes a channel-packed texture (createInfo.path is ignored), returns empty data if none of the images exist
+export TextureData LoadPackedTextureData(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack);
+export std::future<TextureData> LoadPackedTextureDataAsync(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack);
+
 export class Texture2D
 {
 public:
+  Texture2D() = default; // empty, can be filled by moving into it
   Texture2D(const TextureCreateInfo& createInfo);
+  Texture2D(const TextureCreateInfo& createInfo, TextureData data); // upload only
   Texture2D(const Texture2D& rhs) = delete;
   Texture2D& operator=(Texture2D&& rhs) noexcept;
   Texture2D(Texture2D&& rhs) noexcept;
@@ -36,31 +86,401 @@ public:
   uint64_t GetBindlessHandle() const { return bindlessHandle_; }
   bool Valid() const { return id_ != 0; }
 
+  // the bindless handle starts out resident. Making it non-resident waits for the draws already
+  // submitted, see ReleaseRetiredHandles
+  void SetResident(bool resident);
+  bool IsResident() const { return resident_; }
+
   glm::ivec2 GetSize() const { return dim_; }
+  bool HasAlpha() const { return hasAlpha_; } // some texel isn't fully opaque (BC3, or RGBA8 with alpha)
+  size_t GetMemoryUsage() const { return memoryUsage_; } // bytes, all levels
+
+  // mip streaming (CPU-built chains created with streamMips). Storage for every level is allocated,
+  // but only levels up to STREAMING_TAIL_SIZE are uploaded at first. Sampling is clamped to the finest
+  // uploaded level with a sampler's min LOD, since the texture's own parameters are frozen once it has
+  // a bindless handle. Each refinement changes the bindless handle.
+  static constexpr int STREAMING_TAIL_SIZE = 128;
+
+  // uploads the next finer level, returns its size in bytes (0 if nothing was left to upload)
+  size_t StreamNextLevel();
+
+  // makes handles replaced by StreamNextLevel or evicted with SetResident(false) non-resident once
+  // the GPU is done with the draws that were submitted before the switch. Call once per frame
+  static void ReleaseRetiredHandles();
+  bool IsStreaming() const { return streamData_ != nullptr; }
+  int GetBaseLevel() const { return baseLevel_; } // finest level that can be sampled
 
 private:
+  void UploadLevel(const TextureData& data, int level);
+  void UpdateSamplerHandle();
+
   unsigned id_{};
   uint64_t bindlessHandle_{};
+  bool resident_{};
   glm::ivec2 dim_{};
+  bool hasAlpha_{};
+  size_t memoryUsage_{};
+
+  std::unique_ptr<TextureData> streamData_; // levels that haven't been uploaded yet
+  int baseLevel_{};
+  int minFilter_{};
+  int magFilter_{};
+
+  struct RetiredHandle
+  {
+    unsigned texture{};
+    uint64_t handle{};
+    GLsync fence{};
+  };
+  static inline std::deque<RetiredHandle> retiredHandles_;
 };
 
-Texture2D::Texture2D(const TextureCreateInfo& createInfo)
+namespace
+{
+  // bump when the decoded data or mip filtering changes to invalidate cached files
+  constexpr uint32_t TEXTURE_CACHE_VERSION = 1;
+
+  // empty if the file can't be read, which callers treat like a missing texture
+  std::vector<std::byte> ReadFile(const std::string& path)
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+      return {};
+    }
+    const std::streamoff size = file.tellg();
+    if (size <= 0)
+    {
+      return {};
+    }
+    std::vector<std::byte> bytes(static_cast<size_t>(size));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+    {
+      return {};
+    }
+    return bytes;
+  }
+
+  // block compresses every level of the chain in data
+  void CompressTextureData(TextureData& data, TextureCompression compression)
+  {
+    const auto* base = reinterpret_cast<const uint8_t*>(data.pixels.data());
+    data.compressedFormat = GetCompressedFormat(compression, base, data.dim);
+
+    std::vector<std::byte> compressed;
+    std::vector<size_t> compressedOffsets;
+    for (size_t i = 0; i < data.levelOffsets.size(); i++)
+    {
+      const glm::ivec2 levelDim = CalcMipDim(data.dim, static_cast<int>(i));
+      compressedOffsets.push_back(compressed.size());
+      compressed.resize(compressed.size() + GetCompressedSize(data.compressedFormat, levelDim));
+      CompressImage(data.compressedFormat, base + data.levelOffsets[i], levelDim, compressed.data() + compressedOffsets.back());
+    }
+    data.pixels = std::move(compressed);
+    data.levelOffsets = std::move(compressedOffsets);
+  }
+
+  std::string GetCachePath(uint64_t sourceHash, const TextureCreateInfo& createInfo)
+  {
+    const uint32_t params[] =
+    {
+      TEXTURE_CACHE_VERSION,
+      COMPRESSOR_VERSION,
+      (uint32_t)createInfo.compression,
+      createInfo.generateMips,
+      createInfo.sRGB,
+      createInfo.normalMap,
+    };
+    const uint64_t key = hash_fnv1a(params, sizeof(params), sourceHash);
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.ktx2", static_cast<unsigned long long>(key));
+    return "Resources/Cache/Textures/" + std::string(name);
+  }
+
+  bool ReadCache(const std::string& cachePath, TextureData& data)
+  {
+    GLenum format{};
+    if (ReadKTX2(cachePath, format, data.dim, data.pixels, data.levelOffsets))
+    {
+      data.compressedFormat = format == GL_RGBA8 ? 0 : format;
+      return true;
+    }
+    return false;
+  }
+
+  // LDR images are decoded to 8 bits instead of going through stbi_loadf, which is much slower
+  // and 4x the size. stbi_loadf linearizes color channels with a 2.2 gamma, so do the same here
+  // (through a LUT) to keep the stored values identical. sRGB textures are decoded by the GPU
+  // and normal maps aren't colors, so those skip it
+  std::vector<uint8_t> DecodeLDR(const std::vector<std::byte>& file, bool linearize, glm::ivec2& dim)
+  {
+    static const auto ldrToLinear = []
+    {
+      std::array<stbi_uc, 256> lut{};
+      for (int i = 0; i < 256; i++)
+      {
+        lut[i] = static_cast<stbi_uc>(std::pow(i / 255.0f, 2.2f) * 255.0f + 0.5f);
+      }
+      return lut;
+    }();
+
+    int n;
+    stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+      static_cast<int>(file.size()), &dim.x, &dim.y, &n, 4);
+    assert(pixels != nullptr);
+    const size_t numTexels = size_t(dim.x) * dim.y;
+    if (linearize)
+    {
+      for (size_t i = 0; i < numTexels; i++)
+      {
+        for (int c = 0; c < 3; c++) // stbi_loadf leaves alpha linear
+        {
+          pixels[i * 4 + c] = ldrToLinear[pixels[i * 4 + c]];
+        }
+      }
+    }
+    std::vector<uint8_t> result(pixels, pixels + numTexels * 4);
+    stbi_image_free(pixels);
+    return result;
+  }
+
+  // builds the mips and compresses the texture as requested, then stores it in the disk cache
+  void FinishLDRTexture(TextureData& data, const std::vector<uint8_t>& base, const TextureCreateInfo& createInfo,
+    const std::string& cachePath)
+  {
+    if (createInfo.generateMips)
+    {
+      const MipFilterDomain domain = createInfo.normalMap ? MipFilterDomain::NORMAL
+        : createInfo.sRGB ? MipFilterDomain::SRGB : MipFilterDomain::LINEAR;
+      GenerateMipsRGBA8(base.data(), data.dim, domain, data.pixels, data.levelOffsets);
+    }
+    else
+    {
+      const auto* bytes = reinterpret_cast<const std::byte*>(base.data());
+      data.pixels.assign(bytes, bytes + base.size());
+      data.levelOffsets = { 0 };
+    }
+
+    const bool compress = createInfo.compression != TextureCompression::NONE;
+    if (compress)
+    {
+      CompressTextureData(data, createInfo.compression);
+    }
+    if (!cachePath.empty())
+    {
+      WriteKTX2(cachePath, compress ? data.compressedFormat : GL_RGBA8, data.dim, data.pixels, data.levelOffsets);
+    }
+  }
+
+  // sampler with the same state as a material texture, except that LODs finer than minLod are never sampled
+  GLuint GetClampSampler(int minFilter, int magFilter, int minLod)
+  {
+    static std::unordered_map<uint64_t, GLuint> samplers;
+    const uint64_t key = (uint64_t(uint32_t(minFilter)) << 32) | (uint64_t(uint16_t(magFilter)) << 8) | uint8_t(minLod);
+    if (auto it = samplers.find(key); it != samplers.end())
+    {
+      return it->second;
+    }
+
+    GLuint sampler;
+    glCreateSamplers(1, &sampler);
+    GLfloat a;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &a);
+    glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY, a);
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, minFilter);
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, magFilter);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glSamplerParameterf(sampler, GL_TEXTURE_MIN_LOD, static_cast<float>(minLod));
+    samplers[key] = sampler;
+    return sampler;
+  }
+
+  bool IsCached(const TextureCreateInfo& createInfo)
+  {
+    return !createInfo.HDR && (createInfo.compression != TextureCompression::NONE || createInfo.generateMips);
+  }
+
+  // bilinear fetch of the red channel with repeat addressing, uv in [0, 1]
+  float SampleRed(const std::vector<uint8_t>& image, glm::ivec2 dim, glm::vec2 uv)
+  {
+    const glm::vec2 p = uv * glm::vec2(dim) - 0.5f;
+    const glm::ivec2 i0 = glm::ivec2(glm::floor(p));
+    const glm::vec2 f = p - glm::floor(p);
+    auto fetch = [&](int x, int y)
+    {
+      x = ((x % dim.x) + dim.x) % dim.x;
+      y = ((y % dim.y) + dim.y) % dim.y;
+      return static_cast<float>(image[(size_t(y) * dim.x + x) * 4]);
+    };
+    return glm::mix(
+      glm::mix(fetch(i0.x, i0.y), fetch(i0.x + 1, i0.y), f.x),
+      glm::mix(fetch(i0.x, i0.y + 1), fetch(i0.x + 1, i0.y + 1), f.x), f.y);
+  }
+}
+
+TextureData LoadTextureData(const TextureCreateInfo& createInfo)
 {
   assert(!(createInfo.sRGB && createInfo.HDR)); // cannot have both sRGB and HDR
-  stbi_set_flip_vertically_on_load(true);
 
-  std::string tex = createInfo.path;
+  TextureData data;
+  data.HDR = createInfo.HDR;
+
+  const std::string& tex = createInfo.path;
   bool hasTex = std::filesystem::exists(tex) && std::filesystem::is_regular_file(tex);
   if (hasTex == false)
   {
     //std::cout << "Failed to load texture " << path << ", using fallback.\n";
+    return data;
+  }
+
+  const auto file = ReadFile(tex);
+  if (file.empty())
+  {
+    return data;
+  }
+
+  // LDR mip chains and compressed textures are cached on disk, keyed by the contents of the source file
+  std::string cachePath;
+  if (IsCached(createInfo))
+  {
+    cachePath = GetCachePath(hash_fnv1a(file.data(), file.size()), createInfo);
+    if (ReadCache(cachePath, data))
+    {
+      return data;
+    }
+  }
+
+  if (createInfo.HDR)
+  {
+    int n;
+    float* pixels = stbi_loadf_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+      static_cast<int>(file.size()), &data.dim.x, &data.dim.y, &n, 4);
+    assert(pixels != nullptr);
+    const auto* bytes = reinterpret_cast<const std::byte*>(pixels);
+    data.pixels.assign(bytes, bytes + size_t(data.dim.x) * data.dim.y * 4 * sizeof(float));
+    stbi_image_free(pixels);
+    return data;
+  }
+
+  const auto base = DecodeLDR(file, !createInfo.sRGB && !createInfo.normalMap, data.dim);
+  FinishLDRTexture(data, base, createInfo, cachePath);
+  return data;
+}
+
+TextureData LoadPackedTextureData(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack)
+{
+  assert(!createInfo.HDR && !createInfo.sRGB);
+
+  TextureData data;
+  std::array<std::vector<std::byte>, 3> files;
+  uint64_t sourceHash = hash_fnv1a(pack.fallback.data(), pack.fallback.size());
+  bool hasAny = false;
+  for (size_t c = 0; c < 3; c++)
+  {
+    const auto& path = pack.paths[c];
+    if (!path.empty() && std::filesystem::is_regular_file(path))
+    {
+      files[c] = ReadFile(path);
+      hasAny |= !files[c].empty();
+    }
+    // hash the channel index too so the same file in a different slot gives a different key
+    sourceHash = hash_fnv1a(&c, sizeof(c), sourceHash);
+    sourceHash = hash_fnv1a(files[c].data(), files[c].size(), sourceHash);
+  }
+  if (!hasAny)
+  {
+    return data;
+  }
+
+  const std::string cachePath = IsCached(createInfo) ? GetCachePath(sourceHash, createInfo) : "";
+  if (!cachePath.empty() && ReadCache(cachePath, data))
+  {
+    return data;
+  }
+
+  // sources can have different sizes, the result takes the largest and resamples the rest
+  std::array<std::vector<uint8_t>, 3> sources;
+  std::array<glm::ivec2, 3> sourceDims{};
+  for (size_t c = 0; c < 3; c++)
+  {
+    if (!files[c].empty())
+    {
+      sources[c] = DecodeLDR(files[c], true, sourceDims[c]);
+      data.dim = glm::max(data.dim, sourceDims[c]);
+    }
+  }
+
+  std::vector<uint8_t> base(size_t(data.dim.x) * data.dim.y * 4, 255);
+  for (size_t c = 0; c < 3; c++)
+  {
+    for (int y = 0; y < data.dim.y; y++)
+    {
+      for (int x = 0; x < data.dim.x; x++)
+      {
+        uint8_t& texel = base[(size_t(y) * data.dim.x + x) * 4 + c];
+        if (sources[c].empty())
+        {
+          texel = pack.fallback[c];
+        }
+        else if (sourceDims[c] == data.dim)
+        {
+          texel = sources[c][(size_t(y) * data.dim.x + x) * 4];
+        }
+        else
+        {
+          const glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / glm::vec2(data.dim);
+          texel = static_cast<uint8_t>(SampleRed(sources[c], sourceDims[c], uv) + 0.5f);
+        }
+      }
+    }
+  }
+
+  FinishLDRTexture(data, base, createInfo, cachePath);
+  return data;
+}
+
+std::future<TextureData> LoadTextureDataAsync(const TextureCreateInfo& createInfo)
+{
+  // stb's flip flag is global, so set it here rather than from the workers
+  stbi_set_flip_vertically_on_load(true);
+  return ThreadPool::Get().Submit([createInfo] { return LoadTextureData(createInfo); });
+}
+
+std::future<TextureData> LoadPackedTextureDataAsync(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack)
+{
+  stbi_set_flip_vertically_on_load(true);
+  return ThreadPool::Get().Submit([createInfo, pack] { return LoadPackedTextureData(createInfo, pack); });
+}
+
+Texture2D::Texture2D(const TextureCreateInfo& createInfo)
+  : Texture2D(createInfo, (stbi_set_flip_vertically_on_load(true), LoadTextureData(createInfo)))
+{
+}
+
+Texture2D::Texture2D(const TextureCreateInfo& createInfo, TextureData data)
+{
+  if (!data.Valid())
+  {
     return;
-    //tex = tex + "error.png";
   }
 
-  int n;
-  auto pixels = stbi_loadf(tex.c_str(), &dim_.x, &dim_.y, &n, 4);
-  assert(pixels != nullptr);
+  dim_ = data.dim;
+  minFilter_ = createInfo.minFilter;
+  magFilter_ = createInfo.magFilter;
+  if (data.compressedFormat != 0)
+  {
+    hasAlpha_ = data.compressedFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  }
+  else if (!data.HDR)
+  {
+    const auto* rgba = reinterpret_cast<const uint8_t*>(data.pixels.data());
+    for (size_t i = 0; i < size_t(dim_.x) * dim_.y && !hasAlpha_; i++)
+    {
+      hasAlpha_ = rgba[i * 4 + 3] != 255;
+    }
+  }
 
   glCreateTextures(GL_TEXTURE_2D, 1, &id_);
 
@@ -73,53 +493,214 @@ Texture2D::Texture2D(const TextureCreateInfo& createInfo)
   glTextureParameteri(id_, GL_TEXTURE_MAG_FILTER, createInfo.magFilter);
   glTextureParameteri(id_, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTextureParameteri(id_, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  GLuint levels = 1;
-  if (createInfo.generateMips)
+  const GLenum internalFormat = data.compressedFormat != 0 ? data.compressedFormat
+    : createInfo.sRGB ? GL_SRGB8_ALPHA8 : createInfo.HDR ? GL_RGBA16F : GL_RGBA8;
+  if (!data.levelOffsets.empty())
   {
-    levels = (GLuint)glm::ceil(glm::log2((float)glm::min(dim_.x, dim_.y)));
-  }
-  
-  const GLenum internalFormat = createInfo.sRGB ? GL_SRGB8_ALPHA8 : createInfo.HDR ? GL_RGBA16F : GL_RGBA8;
-  glTextureStorage2D(id_, levels, internalFormat, dim_.x, dim_.y);
-  glTextureSubImage2D(
-    id_,
-    0,              // mip level 0
-    0, 0,           // image start layer
-    dim_.x, dim_.y, // x, y size
-    GL_RGBA,
-    GL_FLOAT,
-    pixels);
+    // every level was built on the CPU
+    const int levels = static_cast<int>(data.levelOffsets.size());
+    glTextureStorage2D(id_, levels, internalFormat, dim_.x, dim_.y);
+    memoryUsage_ = data.pixels.size();
 
-  stbi_image_free(pixels);
+    if (createInfo.streamMips)
+    {
+      // the first level that fits in the tail
+      for (glm::ivec2 levelDim = dim_; baseLevel_ + 1 < levels && std::max(levelDim.x, levelDim.y) > STREAMING_TAIL_SIZE;)
+      {
+        levelDim = CalcMipDim(dim_, ++baseLevel_);
+      }
+    }
+    for (int i = baseLevel_; i < levels; i++)
+    {
+      UploadLevel(data, i);
+    }
 
-  // use OpenGL to generate mipmaps for us
-  if (createInfo.generateMips)
+    if (baseLevel_ > 0)
+    {
+      streamData_ = std::make_unique<TextureData>(std::move(data));
+      UpdateSamplerHandle();
+      return;
+    }
+  }
+  else
   {
-    glGenerateTextureMipmap(id_);
+    GLuint levels = 1;
+    if (createInfo.generateMips)
+    {
+      levels = CalcMipLevels(dim_);
+    }
+
+    glTextureStorage2D(id_, levels, internalFormat, dim_.x, dim_.y);
+    glTextureSubImage2D(
+      id_,
+      0,              // mip level 0
+      0, 0,           // image start layer
+      dim_.x, dim_.y, // x, y size
+      GL_RGBA,
+      data.HDR ? GL_FLOAT : GL_UNSIGNED_BYTE,
+      data.pixels.data());
+
+    // use OpenGL to generate mipmaps for us (HDR only)
+    if (createInfo.generateMips)
+    {
+      glGenerateTextureMipmap(id_);
+    }
+
+    const size_t texelSize = createInfo.HDR ? 8 : 4;
+    for (GLuint i = 0; i < levels; i++)
+    {
+      const glm::ivec2 levelDim = CalcMipDim(dim_, i);
+      memoryUsage_ += size_t(levelDim.x) * levelDim.y * texelSize;
+    }
   }
 
   bindlessHandle_ = glGetTextureHandleARB(id_);
   //Wstd::cout << bindlessHandle_ << '\n';
-  glMakeTextureHandleResidentARB(bindlessHandle_);
+  SetResident(true);
 }
 
 Texture2D& Texture2D::operator=(Texture2D&& rhs) noexcept
 {
   if (&rhs == this) return *this;
+  this->~Texture2D();
   return *new (this) Texture2D(std::move(rhs));
 }
 
 Texture2D::Texture2D(Texture2D&& rhs) noexcept
 {
   this->id_ = std::exchange(rhs.id_, 0);
+  this->bindlessHandle_ = std::exchange(rhs.bindlessHandle_, 0);
+  this->resident_ = std::exchange(rhs.resident_, false);
   this->dim_ = rhs.dim_;
+  this->hasAlpha_ = rhs.hasAlpha_;
+  this->memoryUsage_ = rhs.memoryUsage_;
+  this->streamData_ = std::move(rhs.streamData_);
+  this->baseLevel_ = rhs.baseLevel_;
+  this->minFilter_ = rhs.minFilter_;
+  this->magFilter_ = rhs.magFilter_;
 }
 
 Texture2D::~Texture2D()
 {
+  // the texture is going away, so its retired handles can't be waited on any longer
+  std::erase_if(retiredHandles_, [this](const RetiredHandle& retired)
+    {
+      if (retired.texture != id_)
+      {
+        return false;
+      }
+      glMakeTextureHandleNonResidentARB(retired.handle);
+      glDeleteSync(retired.fence);
+      return true;
+    });
+  if (resident_)
+  {
+    glMakeTextureHandleNonResidentARB(bindlessHandle_);
+  }
   glDeleteTextures(1, &id_);
 }
 
+void Texture2D::UploadLevel(const TextureData& data, int level)
+{
+  const int levels = static_cast<int>(data.levelOffsets.size());
+  const glm::ivec2 levelDim = CalcMipDim(dim_, level);
+  const std::byte* levelData = data.pixels.data() + data.levelOffsets[level];
+  if (data.compressedFormat != 0)
+  {
+    const size_t end = level + 1 < levels ? data.levelOffsets[level + 1] : data.pixels.size();
+    glCompressedTextureSubImage2D(id_, level, 0, 0, levelDim.x, levelDim.y, data.compressedFormat,
+      static_cast<GLsizei>(end - data.levelOffsets[level]), levelData);
+  }
+  else
+  {
+    glTextureSubImage2D(id_, level, 0, 0, levelDim.x, levelDim.y, GL_RGBA, GL_UNSIGNED_BYTE, levelData);
+  }
+}
+
+void Texture2D::UpdateSamplerHandle()
+{
+  const uint64_t oldHandle = bindlessHandle_;
+  bindlessHandle_ = glGetTextureSamplerHandleARB(id_, GetClampSampler(minFilter_, magFilter_, baseLevel_));
+  if (resident_)
+  {
+    // draws that were already submitted keep using the old handle, so it stays resident until they are done
+    glMakeTextureHandleResidentARB(bindlessHandle_);
+    retiredHandles_.push_back({ id_, oldHandle, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+  }
+  else if (oldHandle == 0)
+  {
+    SetResident(true);
+  }
+}
+
+size_t Texture2D::StreamNextLevel()
+{
+  if (!streamData_)
+  {
+    return 0;
+  }
+
+  baseLevel_--;
+  UploadLevel(*streamData_, baseLevel_);
+  const size_t levelEnd = baseLevel_ + 1 < static_cast<int>(streamData_->levelOffsets.size())
+    ? streamData_->levelOffsets[baseLevel_ + 1] : streamData_->pixels.size();
+  const size_t size = levelEnd - streamData_->levelOffsets[baseLevel_];
+  UpdateSamplerHandle();
+
+  if (baseLevel_ == 0)
+  {
+    streamData_.reset();
+  }
+  return size;
+}
+
+void Texture2D::ReleaseRetiredHandles()
+{
+  // fences signal in submission order
+  while (!retiredHandles_.empty())
+  {
+    const auto& retired = retiredHandles_.front();
+    const GLenum status = glClientWaitSync(retired.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+      break;
+    }
+    glMakeTextureHandleNonResidentARB(retired.handle);
+    glDeleteSync(retired.fence);
+    retiredHandles_.pop_front();
+  }
+}
+
+void Texture2D::SetResident(bool resident)
+{
+  if (bindlessHandle_ == 0 || resident == resident_)
+  {
+    return;
+  }
+
+  if (resident)
+  {
+    // an eviction still waiting on its fence is called off, the handle never stopped being resident
+    const auto pending = std::find_if(retiredHandles_.begin(), retiredHandles_.end(),
+      [this](const RetiredHandle& retired) { return retired.handle == bindlessHandle_; });
+    if (pending != retiredHandles_.end())
+    {
+      glDeleteSync(pending->fence);
+      retiredHandles_.erase(pending);
+    }
+    else
+    {
+      glMakeTextureHandleResidentARB(bindlessHandle_);
+    }
+  }
+  else
+  {
+    // draws that were already submitted may still sample it, the caller points new ones at a fallback
+    retiredHandles_.push_back({ id_, bindlessHandle_, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+  }
+  resident_ = resident;
+}
+
 void Texture2D::Bind(unsigned slot) const
 {
   glBindTextureUnit(slot, id_);
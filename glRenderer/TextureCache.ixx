@@ -0,0 +1,170 @@
+module;
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+
+export module TextureCache;
+
+import GPU.Texture;
+
+// shares textures between materials that reference the same file
+// entries are keyed by canonical path and decode parameters. The cache only holds
+// weak references, so a texture is freed when the last material using it goes away
+export class TextureCache
+{
+public:
+  // returns the texture for a file, queuing a decode if it isn't loaded yet
+  // (the texture stays empty until it's resolved). Returns null if the file doesn't exist
+  std::shared_ptr<Texture2D> Acquire(const TextureCreateInfo& createInfo);
+
+  // same as above for a channel-packed texture. Returns null if none of the images exist
+  std::shared_ptr<Texture2D> AcquirePacked(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack);
+
+  // waits for outstanding decodes and uploads them (GL thread only)
+  void ResolvePending();
+
+  // uploads the decodes that have finished without waiting for the rest (GL thread only)
+  void PollPending();
+
+  // forgets which paths were missing, so files added since are found. Call when a scene loads
+  void ForgetMissingPaths() { missingPaths_.clear(); }
+
+  size_t NumLoaded() const { return textures_.size(); }
+  size_t NumPending() const { return pending_.size(); }
+
+private:
+  static std::string MakeKey(const std::string& source, const TextureCreateInfo& createInfo);
+
+  // canonical form of a path, empty if the file doesn't exist
+  std::string Canonicalize(const std::string& path);
+
+  // returns the live texture for key, or queues a new one that will be filled from load()
+  template<typename F>
+  std::shared_ptr<Texture2D> FindOrLoad(const std::string& key, const TextureCreateInfo& createInfo, F&& load);
+
+  void UploadPending(bool wait);
+
+  struct PendingTexture
+  {
+    std::shared_ptr<Texture2D> texture;
+    TextureCreateInfo createInfo;
+    std::future<TextureData> data;
+  };
+
+  std::unordered_map<std::string, std::weak_ptr<Texture2D>> textures_;
+  std::unordered_set<std::string> missingPaths_; // skips filesystem checks for paths we know are bad, until ForgetMissingPaths
+  std::vector<PendingTexture> pending_;
+};
+
+std::string TextureCache::MakeKey(const std::string& source, const TextureCreateInfo& createInfo)
+{
+  return source
+    + (createInfo.sRGB ? "|srgb" : "")
+    + (createInfo.HDR ? "|hdr" : "")
+    + (createInfo.generateMips ? "|mips" : "")
+    + (createInfo.normalMap ? "|normal" : "")
+    + "|bc" + std::to_string(static_cast<int>(createInfo.compression));
+}
+
+std::string TextureCache::Canonicalize(const std::string& path)
+{
+  if (path.empty() || missingPaths_.contains(path))
+  {
+    return {};
+  }
+
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(path, ec))
+  {
+    missingPaths_.insert(path);
+    return {};
+  }
+  return std::filesystem::canonical(path, ec).string();
+}
+
+template<typename F>
+std::shared_ptr<Texture2D> TextureCache::FindOrLoad(const std::string& key, const TextureCreateInfo& createInfo, F&& load)
+{
+  if (auto it = textures_.find(key); it != textures_.end())
+  {
+    if (auto texture = it->second.lock())
+    {
+      return texture;
+    }
+  }
+
+  auto texture = std::make_shared<Texture2D>();
+  textures_[key] = texture;
+  pending_.push_back({ texture, createInfo, load() });
+  return texture;
+}
+
+std::shared_ptr<Texture2D> TextureCache::Acquire(const TextureCreateInfo& createInfo)
+{
+  const auto source = Canonicalize(createInfo.path);
+  if (source.empty())
+  {
+    return nullptr;
+  }
+
+  return FindOrLoad(MakeKey(source, createInfo), createInfo,
+    [&] { return LoadTextureDataAsync(createInfo); });
+}
+
+std::shared_ptr<Texture2D> TextureCache::AcquirePacked(const TextureCreateInfo& createInfo, const ChannelPackInfo& pack)
+{
+  std::string source = "pack";
+  bool hasAny = false;
+  for (size_t c = 0; c < pack.paths.size(); c++)
+  {
+    const auto path = Canonicalize(pack.paths[c]);
+    hasAny |= !path.empty();
+    source += "|" + (path.empty() ? std::to_string(pack.fallback[c]) : path);
+  }
+  if (!hasAny)
+  {
+    return nullptr;
+  }
+
+  return FindOrLoad(MakeKey(source, createInfo), createInfo,
+    [&] { return LoadPackedTextureDataAsync(createInfo, pack); });
+}
+
+void TextureCache::ResolvePending()
+{
+  UploadPending(true);
+}
+
+void TextureCache::PollPending()
+{
+  if (!pending_.empty())
+  {
+    UploadPending(false);
+  }
+}
+
+void TextureCache::UploadPending(bool wait)
+{
+  std::erase_if(pending_, [wait](PendingTexture& pending)
+    {
+      // nobody is using it anymore (e.g. the scene was unloaded before the decode finished)
+      if (pending.texture.use_count() == 1)
+      {
+        return true;
+      }
+      if (!wait && pending.data.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      {
+        return false;
+      }
+      *pending.texture = Texture2D(pending.createInfo, pending.data.get());
+      return true;
+    });
+
+  std::erase_if(textures_, [](const auto& p) { return p.second.expired(); });
+}
\ No newline at end of file
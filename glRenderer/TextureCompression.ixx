@@ -0,0 +1,534 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <bit>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <emmintrin.h>
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+
+// S3TC is an extension, so glad doesn't have these
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+export module TextureCompression;
+
+// block compression scheme to use for a texture, picked by what the texture holds
+export enum class TextureCompression
+{
+  NONE,
+  BC1, // color, becomes BC3 if the image has non-opaque alpha
+  BC4, // single channel (red)
+  BC5, // two channels (red, green), for normal maps
+};
+
+// bump when the encoder output changes to invalidate cached files
+export constexpr uint32_t COMPRESSOR_VERSION = 1;
+
+// picks the GL format for an RGBA8 image
+export GLenum GetCompressedFormat(TextureCompression compression, const uint8_t* rgba, glm::ivec2 dim);
+
+// number of bytes the image occupies in the given format
+export size_t GetCompressedSize(GLenum format, glm::ivec2 dim);
+
+// compresses an RGBA8 image into dst, which must hold GetCompressedSize bytes
+export void CompressImage(GLenum format, const uint8_t* rgba, glm::ivec2 dim, std::byte* dst);
+
+// minimal KTX2 container: header and level index only (no DFD/KVD). Supports the
+// formats above and GL_RGBA8. Levels are stored back to back in data, largest first
+export bool WriteKTX2(const std::filesystem::path& path, GLenum format, glm::ivec2 dim,
+  const std::vector<std::byte>& data, const std::vector<size_t>& levelOffsets);
+export bool ReadKTX2(const std::filesystem::path& path, GLenum& format, glm::ivec2& dim,
+  std::vector<std::byte>& data, std::vector<size_t>& levelOffsets);
+
+namespace
+{
+  size_t BlockBytes(GLenum format)
+  {
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return 16;
+    case GL_COMPRESSED_RED_RGTC1: return 8;
+    case GL_COMPRESSED_RG_RGTC2: return 16;
+    default: return 0;
+    }
+  }
+
+  // 4x4 block of pixels in SoA form for SSE
+  struct alignas(16) BlockRGB
+  {
+    float r[16];
+    float g[16];
+    float b[16];
+  };
+
+  glm::vec3 Expand565(uint16_t c)
+  {
+    const int r = (c >> 11) & 31;
+    const int g = (c >> 5) & 63;
+    const int b = c & 31;
+    return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+  }
+
+  uint16_t Quantize565(glm::vec3 c)
+  {
+    c = glm::clamp(c, glm::vec3(0), glm::vec3(255));
+    const int r = static_cast<int>(c.r * (31.0f / 255.0f) + 0.5f);
+    const int g = static_cast<int>(c.g * (63.0f / 255.0f) + 0.5f);
+    const int b = static_cast<int>(c.b * (31.0f / 255.0f) + 0.5f);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+  }
+
+  // finds the closest of the four palette entries for each pixel, returns the squared error
+  float FindColorIndices(const BlockRGB& block, uint16_t c0, uint16_t c1, uint32_t& indices)
+  {
+    const glm::vec3 e0 = Expand565(c0);
+    const glm::vec3 e1 = Expand565(c1);
+    const glm::vec3 palette[4] = { e0, e1, (2.0f * e0 + e1) / 3.0f, (e0 + 2.0f * e1) / 3.0f };
+
+    __m128 totalError = _mm_setzero_ps();
+    indices = 0;
+    for (int i = 0; i < 16; i += 4)
+    {
+      const __m128 r = _mm_load_ps(block.r + i);
+      const __m128 g = _mm_load_ps(block.g + i);
+      const __m128 b = _mm_load_ps(block.b + i);
+
+      __m128 bestError = _mm_set1_ps(FLT_MAX);
+      __m128i bestIndex = _mm_setzero_si128();
+      for (int p = 0; p < 4; p++)
+      {
+        const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p].r));
+        const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p].g));
+        const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p].b));
+        const __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+        const __m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+        bestIndex = _mm_or_si128(_mm_andnot_si128(better, bestIndex), _mm_and_si128(better, _mm_set1_epi32(p)));
+        bestError = _mm_min_ps(error, bestError);
+      }
+      totalError = _mm_add_ps(totalError, bestError);
+
+      alignas(16) int32_t idx[4];
+      _mm_store_si128(reinterpret_cast<__m128i*>(idx), bestIndex);
+      for (int j = 0; j < 4; j++)
+      {
+        indices |= static_cast<uint32_t>(idx[j]) << (2 * (i + j));
+      }
+    }
+
+    alignas(16) float err[4];
+    _mm_store_ps(err, totalError);
+    return err[0] + err[1] + err[2] + err[3];
+  }
+
+  // least squares fit of the endpoints to the current index assignment
+  bool RefitEndpoints(const BlockRGB& block, uint32_t indices, glm::vec3& e0, glm::vec3& e1)
+  {
+    constexpr float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; // weight of e0
+    float aa = 0, ab = 0, bb = 0;
+    glm::vec3 ax{}, bx{};
+    for (int i = 0; i < 16; i++)
+    {
+      const float w = weights[(indices >> (2 * i)) & 3];
+      const glm::vec3 x{ block.r[i], block.g[i], block.b[i] };
+      aa += w * w;
+      ab += w * (1 - w);
+      bb += (1 - w) * (1 - w);
+      ax += w * x;
+      bx += (1 - w) * x;
+    }
+    const float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f)
+    {
+      return false;
+    }
+    e0 = (ax * bb - bx * ab) / det;
+    e1 = (bx * aa - ax * ab) / det;
+    return true;
+  }
+
+  void EncodeColorBlock(const uint8_t pixels[16][4], uint8_t* dst)
+  {
+    BlockRGB block;
+    glm::vec3 mean{};
+    for (int i = 0; i < 16; i++)
+    {
+      block.r[i] = pixels[i][0];
+      block.g[i] = pixels[i][1];
+      block.b[i] = pixels[i][2];
+      mean += glm::vec3(pixels[i][0], pixels[i][1], pixels[i][2]);
+    }
+    mean /= 16.0f;
+
+    // principal axis of the colors through power iteration on the covariance matrix
+    glm::mat3 cov{ 0 };
+    glm::vec3 minColor(255), maxColor(0);
+    for (int i = 0; i < 16; i++)
+    {
+      const glm::vec3 c{ block.r[i], block.g[i], block.b[i] };
+      const glm::vec3 d = c - mean;
+      cov += glm::outerProduct(d, d);
+      minColor = glm::min(minColor, c);
+      maxColor = glm::max(maxColor, c);
+    }
+    glm::vec3 axis = maxColor - minColor;
+    for (int i = 0; i < 4; i++)
+    {
+      axis = cov * axis;
+      const float len = glm::length(axis);
+      if (len < 1e-6f) break;
+      axis /= len;
+    }
+
+    uint16_t c0 = Quantize565(mean);
+    uint16_t c1 = c0;
+    if (glm::length(axis) > 1e-6f)
+    {
+      float tMin = FLT_MAX, tMax = -FLT_MAX;
+      for (int i = 0; i < 16; i++)
+      {
+        const float t = glm::dot(glm::vec3(block.r[i], block.g[i], block.b[i]) - mean, axis);
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+      }
+      c0 = Quantize565(mean + axis * tMax);
+      c1 = Quantize565(mean + axis * tMin);
+    }
+
+    uint32_t indices = 0;
+    float error = FindColorIndices(block, c0, c1, indices);
+
+    for (int iteration = 0; iteration < 2 && c0 != c1; iteration++)
+    {
+      glm::vec3 e0, e1;
+      if (!RefitEndpoints(block, indices, e0, e1))
+      {
+        break;
+      }
+      const uint16_t n0 = Quantize565(e0);
+      const uint16_t n1 = Quantize565(e1);
+      uint32_t newIndices;
+      const float newError = FindColorIndices(block, n0, n1, newIndices);
+      if (newError >= error)
+      {
+        break;
+      }
+      c0 = n0;
+      c1 = n1;
+      indices = newIndices;
+      error = newError;
+    }
+
+    // c0 > c1 selects four color mode, swapping the endpoints swaps indices 0<->1 and 2<->3
+    if (c0 < c1)
+    {
+      std::swap(c0, c1);
+      indices ^= 0x55555555;
+    }
+    else if (c0 == c1)
+    {
+      indices = 0;
+    }
+
+    std::memcpy(dst + 0, &c0, 2);
+    std::memcpy(dst + 2, &c1, 2);
+    std::memcpy(dst + 4, &indices, 4);
+  }
+
+  // BC4 in 8 value mode with the block's min and max as endpoints
+  void EncodeChannelBlock(const uint8_t values[16], uint8_t* dst)
+  {
+    uint8_t lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++)
+    {
+      lo = std::min(lo, values[i]);
+      hi = std::max(hi, values[i]);
+    }
+
+    dst[0] = hi;
+    dst[1] = lo;
+    uint64_t bits = 0;
+    if (hi != lo)
+    {
+      // t = round((v - lo) / (hi - lo) * 7), palette index 0 is hi, 1 is lo, 2-7 go from hi to lo
+      const __m128 scale = _mm_set1_ps(7.0f / (hi - lo));
+      const __m128 offset = _mm_set1_ps(lo);
+      for (int i = 0; i < 16; i += 4)
+      {
+        const __m128 v = _mm_setr_ps(values[i], values[i + 1], values[i + 2], values[i + 3]);
+        alignas(16) int32_t t[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(t), _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(v, offset), scale)));
+        for (int j = 0; j < 4; j++)
+        {
+          const uint64_t index = t[j] == 7 ? 0 : t[j] == 0 ? 1 : 8 - t[j];
+          bits |= index << (3 * (i + j));
+        }
+      }
+    }
+    std::memcpy(dst + 2, &bits, 6);
+  }
+
+  void EncodeBlock(GLenum format, const uint8_t pixels[16][4], uint8_t* dst)
+  {
+    uint8_t channel[16];
+    auto extract = [&](int c)
+    {
+      for (int i = 0; i < 16; i++) channel[i] = pixels[i][c];
+    };
+
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+      EncodeColorBlock(pixels, dst);
+      break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      extract(3);
+      EncodeChannelBlock(channel, dst);
+      EncodeColorBlock(pixels, dst + 8);
+      break;
+    case GL_COMPRESSED_RED_RGTC1:
+      extract(0);
+      EncodeChannelBlock(channel, dst);
+      break;
+    case GL_COMPRESSED_RG_RGTC2:
+      extract(0);
+      EncodeChannelBlock(channel, dst);
+      extract(1);
+      EncodeChannelBlock(channel, dst + 8);
+      break;
+    }
+  }
+
+  // https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+  constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+  struct KTX2Header
+  {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+  };
+
+  struct KTX2Level
+  {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+  };
+
+  uint32_t ToVkFormat(GLenum format)
+  {
+    switch (format)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return 131; // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return 137; // VK_FORMAT_BC3_UNORM_BLOCK
+    case GL_COMPRESSED_RED_RGTC1: return 139; // VK_FORMAT_BC4_UNORM_BLOCK
+    case GL_COMPRESSED_RG_RGTC2: return 141; // VK_FORMAT_BC5_UNORM_BLOCK
+    case GL_RGBA8: return 37; // VK_FORMAT_R8G8B8A8_UNORM
+    default: return 0;
+    }
+  }
+
+  GLenum FromVkFormat(uint32_t vkFormat)
+  {
+    switch (vkFormat)
+    {
+    case 131: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case 137: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case 139: return GL_COMPRESSED_RED_RGTC1;
+    case 141: return GL_COMPRESSED_RG_RGTC2;
+    case 37: return GL_RGBA8;
+    default: return 0;
+    }
+  }
+}
+
+GLenum GetCompressedFormat(TextureCompression compression, const uint8_t* rgba, glm::ivec2 dim)
+{
+  switch (compression)
+  {
+  case TextureCompression::BC1:
+  {
+    const size_t numTexels = size_t(dim.x) * dim.y;
+    for (size_t i = 0; i < numTexels; i++)
+    {
+      if (rgba[i * 4 + 3] != 255)
+      {
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+      }
+    }
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  }
+  case TextureCompression::BC4: return GL_COMPRESSED_RED_RGTC1;
+  case TextureCompression::BC5: return GL_COMPRESSED_RG_RGTC2;
+  default: return 0;
+  }
+}
+
+size_t GetCompressedSize(GLenum format, glm::ivec2 dim)
+{
+  return size_t((dim.x + 3) / 4) * ((dim.y + 3) / 4) * BlockBytes(format);
+}
+
+void CompressImage(GLenum format, const uint8_t* rgba, glm::ivec2 dim, std::byte* dst)
+{
+  const size_t blockBytes = BlockBytes(format);
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  for (int by = 0; by < dim.y; by += 4)
+  {
+    for (int bx = 0; bx < dim.x; bx += 4)
+    {
+      // blocks hanging off the edge repeat the last row/column
+      uint8_t pixels[16][4];
+      for (int y = 0; y < 4; y++)
+      {
+        const int sy = std::min(by + y, dim.y - 1);
+        for (int x = 0; x < 4; x++)
+        {
+          const int sx = std::min(bx + x, dim.x - 1);
+          std::memcpy(pixels[y * 4 + x], rgba + (size_t(sy) * dim.x + sx) * 4, 4);
+        }
+      }
+      EncodeBlock(format, pixels, out);
+      out += blockBytes;
+    }
+  }
+}
+
+bool WriteKTX2(const std::filesystem::path& path, GLenum format, glm::ivec2 dim,
+  const std::vector<std::byte>& data, const std::vector<size_t>& levelOffsets)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(path.parent_path(), ec);
+
+  // write to a temporary file first so other loads never see a partial file
+  auto tempPath = path;
+  tempPath += ".tmp";
+  {
+    std::ofstream file(tempPath, std::ios::binary);
+    if (!file)
+    {
+      return false;
+    }
+
+    const uint32_t levelCount = static_cast<uint32_t>(levelOffsets.size());
+    KTX2Header header{};
+    std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = ToVkFormat(format);
+    header.typeSize = 1;
+    header.pixelWidth = dim.x;
+    header.pixelHeight = dim.y;
+    header.faceCount = 1;
+    header.levelCount = levelCount;
+
+    // the spec stores the smallest level first
+    const size_t dataStart = sizeof(KTX2Header) + sizeof(KTX2Level) * levelCount;
+    std::vector<KTX2Level> levels(levelCount);
+    size_t offset = dataStart;
+    for (size_t i = levelCount; i-- > 0;)
+    {
+      const size_t end = i + 1 < levelCount ? levelOffsets[i + 1] : data.size();
+      levels[i].byteOffset = offset;
+      levels[i].byteLength = end - levelOffsets[i];
+      levels[i].uncompressedByteLength = levels[i].byteLength;
+      offset += levels[i].byteLength;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(levels.data()), sizeof(KTX2Level) * levelCount);
+    for (size_t i = levelCount; i-- > 0;)
+    {
+      file.write(reinterpret_cast<const char*>(data.data() + levelOffsets[i]), levels[i].byteLength);
+    }
+    if (!file)
+    {
+      return false;
+    }
+  }
+  std::filesystem::rename(tempPath, path, ec);
+  return !ec;
+}
+
+bool ReadKTX2(const std::filesystem::path& path, GLenum& format, glm::ivec2& dim,
+  std::vector<std::byte>& data, std::vector<size_t>& levelOffsets)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    return false;
+  }
+
+  KTX2Header header{};
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+  {
+    return false;
+  }
+  format = FromVkFormat(header.vkFormat);
+  if (format == 0 || header.levelCount == 0)
+  {
+    return false;
+  }
+  dim = { header.pixelWidth, header.pixelHeight };
+  if (dim.x <= 0 || dim.y <= 0 || header.levelCount > std::bit_width(uint32_t(std::max(dim.x, dim.y))))
+  {
+    return false;
+  }
+
+  std::vector<KTX2Level> levels(header.levelCount);
+  file.read(reinterpret_cast<char*>(levels.data()), sizeof(KTX2Level) * levels.size());
+  std::error_code ec;
+  const uint64_t fileSize = std::filesystem::file_size(path, ec);
+  if (!file || ec)
+  {
+    return false;
+  }
+
+  // a truncated or corrupt cache file must not make the upload read past a level
+  for (uint32_t i = 0; i < header.levelCount; i++)
+  {
+    const glm::ivec2 levelDim = glm::max(dim >> int(i), 1);
+    const size_t expected = BlockBytes(format) ? GetCompressedSize(format, levelDim) : size_t(levelDim.x) * levelDim.y * 4;
+    if (levels[i].byteLength != expected || levels[i].byteOffset > fileSize || levels[i].byteLength > fileSize - levels[i].byteOffset)
+    {
+      return false;
+    }
+  }
+
+  data.clear();
+  levelOffsets.clear();
+  for (const auto& level : levels)
+  {
+    levelOffsets.push_back(data.size());
+    data.resize(data.size() + level.byteLength);
+    file.seekg(level.byteOffset);
+    file.read(reinterpret_cast<char*>(data.data() + levelOffsets.back()), level.byteLength);
+  }
+  return static_cast<bool>(file);
+}
\ No newline at end of file
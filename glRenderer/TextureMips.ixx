@@ -0,0 +1,231 @@
+module;
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <xmmintrin.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+export module TextureMips;
+
+// how texel values should be treated while filtering
+export enum class MipFilterDomain
+{
+  LINEAR, // plain values
+  SRGB,   // sRGB encoded color, filtered in linear space
+  NORMAL, // tangent space normals in [0, 1], renormalized after filtering
+};
+
+// number of levels in a full chain down to 1x1
+export int CalcMipLevels(glm::ivec2 dim)
+{
+  return static_cast<int>(std::floor(std::log2(static_cast<float>(std::max(dim.x, dim.y))))) + 1;
+}
+
+export glm::ivec2 CalcMipDim(glm::ivec2 dim, int level)
+{
+  return glm::max(dim >> level, glm::ivec2(1));
+}
+
+// builds the full mip chain of an RGBA8 image with a Kaiser-windowed sinc filter (textures are
+// assumed to repeat). Every level, including the source, is written back to back into out
+export void GenerateMipsRGBA8(const uint8_t* src, glm::ivec2 dim, MipFilterDomain domain,
+  std::vector<std::byte>& out, std::vector<size_t>& levelOffsets);
+
+namespace
+{
+  constexpr float FILTER_RADIUS = 2.0f; // in destination texels
+  constexpr float KAISER_ALPHA = 4.0f;
+
+  float BesselI0(float x)
+  {
+    float sum = 1, term = 1;
+    for (int k = 1; k < 16; k++)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  float Sinc(float x)
+  {
+    if (std::abs(x) < 1e-5f) return 1.0f;
+    x *= glm::pi<float>();
+    return std::sin(x) / x;
+  }
+
+  float Kaiser(float x)
+  {
+    const float t = x / FILTER_RADIUS;
+    if (t * t >= 1.0f) return 0.0f;
+    return BesselI0(KAISER_ALPHA * std::sqrt(1.0f - t * t)) / BesselI0(KAISER_ALPHA);
+  }
+
+  // taps of one destination texel along an axis
+  struct FilterTaps
+  {
+    std::vector<int> indices;
+    std::vector<float> weights;
+  };
+
+  std::vector<FilterTaps> BuildFilter(int srcSize, int dstSize)
+  {
+    const float scale = static_cast<float>(srcSize) / dstSize;
+    std::vector<FilterTaps> filter(dstSize);
+    for (int x = 0; x < dstSize; x++)
+    {
+      const float center = (x + 0.5f) * scale;
+      const int first = static_cast<int>(std::floor(center - FILTER_RADIUS * scale));
+      const int last = static_cast<int>(std::ceil(center + FILTER_RADIUS * scale));
+      float total = 0;
+      for (int i = first; i <= last; i++)
+      {
+        const float d = (i + 0.5f - center) / scale;
+        const float w = Sinc(d) * Kaiser(d);
+        if (w == 0) continue;
+        filter[x].indices.push_back(((i % srcSize) + srcSize) % srcSize);
+        filter[x].weights.push_back(w);
+        total += w;
+      }
+      for (auto& w : filter[x].weights)
+      {
+        w /= total;
+      }
+    }
+    return filter;
+  }
+
+  // separable downsample, one RGBA texel per SSE register
+  void Downsample(const std::vector<glm::vec4>& src, glm::ivec2 srcDim, std::vector<glm::vec4>& dst, glm::ivec2 dstDim)
+  {
+    const auto filterX = BuildFilter(srcDim.x, dstDim.x);
+    const auto filterY = BuildFilter(srcDim.y, dstDim.y);
+
+    std::vector<glm::vec4> temp(size_t(dstDim.x) * srcDim.y);
+    for (int y = 0; y < srcDim.y; y++)
+    {
+      const glm::vec4* row = src.data() + size_t(y) * srcDim.x;
+      for (int x = 0; x < dstDim.x; x++)
+      {
+        const auto& taps = filterX[x];
+        __m128 sum = _mm_setzero_ps();
+        for (size_t t = 0; t < taps.indices.size(); t++)
+        {
+          sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(taps.weights[t]), _mm_loadu_ps(&row[taps.indices[t]].x)));
+        }
+        _mm_storeu_ps(&temp[size_t(y) * dstDim.x + x].x, sum);
+      }
+    }
+
+    dst.resize(size_t(dstDim.x) * dstDim.y);
+    for (int y = 0; y < dstDim.y; y++)
+    {
+      const auto& taps = filterY[y];
+      for (int x = 0; x < dstDim.x; x++)
+      {
+        __m128 sum = _mm_setzero_ps();
+        for (size_t t = 0; t < taps.indices.size(); t++)
+        {
+          const glm::vec4& texel = temp[size_t(taps.indices[t]) * dstDim.x + x];
+          sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(taps.weights[t]), _mm_loadu_ps(&texel.x)));
+        }
+        _mm_storeu_ps(&dst[size_t(y) * dstDim.x + x].x, sum);
+      }
+    }
+  }
+
+  float SRGBToLinear(float c)
+  {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+
+  float LinearToSRGB(float c)
+  {
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+  }
+
+  void Decode(const uint8_t* src, size_t numTexels, MipFilterDomain domain, std::vector<glm::vec4>& dst)
+  {
+    static const auto srgbLut = []
+    {
+      std::array<float, 256> lut{};
+      for (int i = 0; i < 256; i++)
+      {
+        lut[i] = SRGBToLinear(i / 255.0f);
+      }
+      return lut;
+    }();
+
+    dst.resize(numTexels);
+    for (size_t i = 0; i < numTexels; i++)
+    {
+      const uint8_t* t = src + i * 4;
+      glm::vec4 v = glm::vec4(t[0], t[1], t[2], t[3]) / 255.0f;
+      if (domain == MipFilterDomain::SRGB)
+      {
+        v = { srgbLut[t[0]], srgbLut[t[1]], srgbLut[t[2]], v.a };
+      }
+      else if (domain == MipFilterDomain::NORMAL)
+      {
+        v = glm::vec4(glm::vec3(v) * 2.0f - 1.0f, v.a);
+      }
+      dst[i] = v;
+    }
+  }
+
+  void Encode(std::vector<glm::vec4>& src, MipFilterDomain domain, std::byte* dst)
+  {
+    for (size_t i = 0; i < src.size(); i++)
+    {
+      glm::vec4 v = src[i];
+      if (domain == MipFilterDomain::SRGB)
+      {
+        v = { LinearToSRGB(glm::max(v.r, 0.0f)), LinearToSRGB(glm::max(v.g, 0.0f)), LinearToSRGB(glm::max(v.b, 0.0f)), v.a };
+      }
+      else if (domain == MipFilterDomain::NORMAL)
+      {
+        // averaging shortens normals, keep the filtered level normalized for the next one too
+        glm::vec3 n = glm::vec3(v);
+        const float len = glm::length(n);
+        n = len > 1e-6f ? n / len : glm::vec3(0, 0, 1);
+        src[i] = glm::vec4(n, v.a);
+        v = glm::vec4(n * 0.5f + 0.5f, v.a);
+      }
+      v = glm::clamp(v, glm::vec4(0), glm::vec4(1));
+      for (int c = 0; c < 4; c++)
+      {
+        dst[i * 4 + c] = static_cast<std::byte>(v[c] * 255.0f + 0.5f);
+      }
+    }
+  }
+}
+
+void GenerateMipsRGBA8(const uint8_t* src, glm::ivec2 dim, MipFilterDomain domain,
+  std::vector<std::byte>& out, std::vector<size_t>& levelOffsets)
+{
+  const int levels = CalcMipLevels(dim);
+  size_t totalSize = 0;
+  for (int i = 0; i < levels; i++)
+  {
+    const glm::ivec2 levelDim = CalcMipDim(dim, i);
+    levelOffsets.push_back(totalSize);
+    totalSize += size_t(levelDim.x) * levelDim.y * 4;
+  }
+  out.resize(totalSize);
+  std::copy_n(reinterpret_cast<const std::byte*>(src), size_t(dim.x) * dim.y * 4, out.data());
+
+  // each level is filtered from the float version of the previous one to avoid requantizing
+  std::vector<glm::vec4> current, next;
+  Decode(src, size_t(dim.x) * dim.y, domain, current);
+  for (int i = 1; i < levels; i++)
+  {
+    Downsample(current, CalcMipDim(dim, i - 1), next, CalcMipDim(dim, i));
+    Encode(next, domain, out.data() + levelOffsets[i]);
+    std::swap(current, next);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+module;
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+
+export module ThreadPool;
+
+// fixed-size pool of worker threads for CPU-side work (image decoding, etc.)
+// jobs must not touch the GL context, which lives on the main thread
+export class ThreadPool
+{
+public:
+  ThreadPool(size_t numThreads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // queues a job and returns a future for its result
+  template<typename F>
+  auto Submit(F&& func) -> std::future<std::invoke_result_t<std::decay_t<F>>>;
+
+  size_t NumThreads() const { return workers_.size(); }
+
+  // shared pool, leaves one hardware thread for the main (GL) thread
+  static ThreadPool& Get()
+  {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+  }
+
+private:
+  void WorkerLoop(std::stop_token stop);
+
+  std::vector<std::jthread> workers_;
+  std::queue<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable_any cv_;
+};
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+  numThreads = std::max(size_t(1), numThreads);
+  for (size_t i = 0; i < numThreads; i++)
+  {
+    workers_.emplace_back([this](std::stop_token stop) { WorkerLoop(stop); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  for (auto& worker : workers_)
+  {
+    worker.request_stop();
+  }
+  cv_.notify_all();
+  // join before the members the workers wait on are destroyed
+  for (auto& worker : workers_)
+  {
+    worker.join();
+  }
+}
+
+template<typename F>
+auto ThreadPool::Submit(F&& func) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+{
+  using R = std::invoke_result_t<std::decay_t<F>>;
+
+  // packaged_task is move-only, std::function needs something copyable
+  auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+  std::future<R> future = task->get_future();
+  {
+    std::lock_guard lk(mutex_);
+    jobs_.emplace([task] { (*task)(); });
+  }
+  cv_.notify_one();
+  return future;
+}
+
+void ThreadPool::WorkerLoop(std::stop_token stop)
+{
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock lk(mutex_);
+      if (!cv_.wait(lk, stop, [this] { return !jobs_.empty(); }))
+      {
+        return; // stop requested
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop();
+    }
+    job();
+  }
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 module;
 
 #include <chrono>
+#include <cstdint>
+#include <cstddef>
 
 export module Utilities;
 
@@ -65,4 +67,16 @@ void hash_combine(std::size_t& seed, const T& v, Rest... rest)
   std::hash<T> hasher;
   seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
   hash_combine(seed, rest...);
+}
+
+// FNV-1a, for hashes that must stay the same between runs (e.g. disk cache keys)
+export uint64_t hash_fnv1a(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++)
+  {
+    seed ^= bytes[i];
+    seed *= 1099511628211ull;
+  }
+  return seed;
 }
\ No newline at end of file
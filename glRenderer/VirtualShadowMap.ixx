@@ -0,0 +1,269 @@
+module;
+
+#include <utility>
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+export module VirtualShadowMap;
+
+// page bookkeeping of a virtual shadow map: a VIRTUAL_SIZE^2 depth map (with a mip chain down to a
+// single page) of which only the pages the view needs are backed by a page of a physical pool.
+// Pages are requested as one bit per virtual page (see vsm_mark_pages.cs), are kept across frames
+// until evicted for newer requests, and only need redrawing when first mapped or invalidated.
+// A page only shows up in the page table once it has been drawn. The coarsest PINNED_LEVELS are
+// always mapped, so pixels whose own pages aren't have something to fall back to
+export class VirtualShadowPages
+{
+public:
+  static constexpr int VIRTUAL_SIZE = 16384;
+  static constexpr int PAGE_SIZE = 128;
+  static constexpr int NUM_LEVELS = 8; // the last level is a single page
+  static constexpr int PINNED_LEVELS = 3; // 21 pages
+  static constexpr int POOL_SIZE = 4096; // physical texels per side
+  static constexpr int POOL_PAGES_PER_SIDE = POOL_SIZE / PAGE_SIZE;
+  static constexpr int NUM_PHYSICAL_PAGES = POOL_PAGES_PER_SIDE * POOL_PAGES_PER_SIDE;
+
+  struct PageUpdate
+  {
+    int level{};
+    glm::ivec2 page{}; // within its level
+    glm::ivec2 physicalOrigin{}; // texels
+  };
+
+  VirtualShadowPages();
+
+  static constexpr int PagesPerSide(int level) { return (VIRTUAL_SIZE / PAGE_SIZE) >> level; }
+  static int LevelOffset(int level); // index of the level's first page, pages are row major within a level
+  static int NumVirtualPages() { return LevelOffset(NUM_LEVELS); }
+  static int NumRequestWords() { return (NumVirtualPages() + 31) / 32; }
+
+  // maps every requested page plus the pinned levels, coarse levels first, evicting the pages that were
+  // requested the longest ago when the pool is full. Pages requested now are never evicted, those that
+  // don't fit stay unmapped
+  void Request(std::span<const uint32_t> requestBits);
+
+  // marks mapped pages overlapping the light space rect ([0, 1]^2 covers the map) for a redraw. Their
+  // old depth is still used until then
+  void InvalidateRect(glm::vec2 uvMin, glm::vec2 uvMax);
+
+  // unmaps everything, for when the map's projection changes
+  void Clear();
+
+  // at most budget pages to draw now. Pages never drawn come first, coarse levels before fine ones as
+  // they cover more, then stale pages that are still requested. They count as drawn afterwards
+  std::vector<PageUpdate> TakeUpdates(int budget);
+
+  // physical page of each virtual page (x + y * POOL_PAGES_PER_SIDE), -1 if it has none yet
+  const std::vector<int32_t>& GetPageTable() const { return pageTable_; }
+  uint64_t PageTableVersion() const { return pageTableVersion_; }
+  int NumMapped() const { return NUM_PHYSICAL_PAGES - static_cast<int>(freePages_.size()); }
+
+private:
+  struct PhysicalPage
+  {
+    int32_t virtualPage = -1;
+    uint64_t lastRequested{};
+    bool drawn = false;
+    bool stale = true;
+  };
+
+  void Unmap(int32_t physical);
+
+  std::vector<int32_t> virtualToPhysical_; // mapped, drawn or not
+  std::vector<int32_t> pageTable_;
+  std::vector<PhysicalPage> physicalPages_;
+  std::vector<int32_t> freePages_;
+  uint64_t requestCount_{}; // stamps lastRequested
+  uint64_t pageTableVersion_{};
+};
+
+namespace
+{
+  // level and position of a virtual page
+  std::pair<int, glm::ivec2> LocatePage(int32_t virtualPage)
+  {
+    int level = 0;
+    while (level + 1 < VirtualShadowPages::NUM_LEVELS && virtualPage >= VirtualShadowPages::LevelOffset(level + 1))
+    {
+      level++;
+    }
+    const int local = virtualPage - VirtualShadowPages::LevelOffset(level);
+    const int perSide = VirtualShadowPages::PagesPerSide(level);
+    return { level, { local % perSide, local / perSide } };
+  }
+}
+
+VirtualShadowPages::VirtualShadowPages()
+  : virtualToPhysical_(NumVirtualPages(), -1),
+    pageTable_(NumVirtualPages(), -1),
+    physicalPages_(NUM_PHYSICAL_PAGES)
+{
+  Clear();
+}
+
+int VirtualShadowPages::LevelOffset(int level)
+{
+  int offset = 0;
+  for (int l = 0; l < level; l++)
+  {
+    offset += PagesPerSide(l) * PagesPerSide(l);
+  }
+  return offset;
+}
+
+void VirtualShadowPages::Unmap(int32_t physical)
+{
+  auto& page = physicalPages_[physical];
+  if (page.virtualPage >= 0)
+  {
+    virtualToPhysical_[page.virtualPage] = -1;
+    if (pageTable_[page.virtualPage] >= 0)
+    {
+      pageTable_[page.virtualPage] = -1;
+      pageTableVersion_++;
+    }
+  }
+  page = {};
+  freePages_.push_back(physical);
+}
+
+void VirtualShadowPages::Request(std::span<const uint32_t> requestBits)
+{
+  requestCount_++;
+  // coarser levels have higher indices. Going from the top means a full pool runs out on fine pages,
+  // never on the coarse ones they fall back to
+  const int32_t firstPinned = LevelOffset(NUM_LEVELS - PINNED_LEVELS);
+  std::vector<int32_t> unmapped;
+  for (int32_t v = NumVirtualPages() - 1; v >= 0; v--)
+  {
+    const bool requested = v >= firstPinned || (size_t(v / 32) < requestBits.size() && (requestBits[v / 32] >> (v % 32) & 1));
+    if (!requested)
+    {
+      continue;
+    }
+    if (virtualToPhysical_[v] >= 0)
+    {
+      physicalPages_[virtualToPhysical_[v]].lastRequested = requestCount_;
+    }
+    else
+    {
+      unmapped.push_back(v);
+    }
+  }
+
+  // eviction candidates, least recently requested last so they are popped first
+  std::vector<int32_t> evictable;
+  if (unmapped.size() > freePages_.size())
+  {
+    for (int32_t p = 0; p < NUM_PHYSICAL_PAGES; p++)
+    {
+      if (physicalPages_[p].virtualPage >= 0 && physicalPages_[p].lastRequested < requestCount_)
+      {
+        evictable.push_back(p);
+      }
+    }
+    std::sort(evictable.begin(), evictable.end(),
+      [this](int32_t a, int32_t b) { return physicalPages_[a].lastRequested > physicalPages_[b].lastRequested; });
+  }
+
+  for (int32_t v : unmapped)
+  {
+    if (freePages_.empty())
+    {
+      if (evictable.empty())
+      {
+        break;
+      }
+      Unmap(evictable.back());
+      evictable.pop_back();
+    }
+    const int32_t p = freePages_.back();
+    freePages_.pop_back();
+    physicalPages_[p] = { .virtualPage = v, .lastRequested = requestCount_ };
+    virtualToPhysical_[v] = p;
+  }
+}
+
+void VirtualShadowPages::InvalidateRect(glm::vec2 uvMin, glm::vec2 uvMax)
+{
+  uvMin = glm::clamp(uvMin, glm::vec2(0), glm::vec2(1));
+  uvMax = glm::clamp(uvMax, glm::vec2(0), glm::vec2(1));
+  if (uvMin.x > uvMax.x || uvMin.y > uvMax.y)
+  {
+    return;
+  }
+  for (int level = 0; level < NUM_LEVELS; level++)
+  {
+    const int perSide = PagesPerSide(level);
+    const glm::ivec2 first = glm::min(glm::ivec2(uvMin * float(perSide)), perSide - 1);
+    const glm::ivec2 last = glm::min(glm::ivec2(uvMax * float(perSide)), perSide - 1);
+    for (int y = first.y; y <= last.y; y++)
+    {
+      for (int x = first.x; x <= last.x; x++)
+      {
+        const int32_t p = virtualToPhysical_[LevelOffset(level) + x + y * perSide];
+        if (p >= 0)
+        {
+          physicalPages_[p].stale = true;
+        }
+      }
+    }
+  }
+}
+
+void VirtualShadowPages::Clear()
+{
+  std::fill(virtualToPhysical_.begin(), virtualToPhysical_.end(), -1);
+  std::fill(pageTable_.begin(), pageTable_.end(), -1);
+  std::fill(physicalPages_.begin(), physicalPages_.end(), PhysicalPage{});
+  freePages_.clear();
+  for (int32_t p = NUM_PHYSICAL_PAGES - 1; p >= 0; p--)
+  {
+    freePages_.push_back(p);
+  }
+  pageTableVersion_++;
+}
+
+std::vector<VirtualShadowPages::PageUpdate> VirtualShadowPages::TakeUpdates(int budget)
+{
+  std::vector<int32_t> pending;
+  for (int32_t p = 0; p < NUM_PHYSICAL_PAGES; p++)
+  {
+    const auto& page = physicalPages_[p];
+    if (page.virtualPage >= 0 && page.stale && (!page.drawn || page.lastRequested == requestCount_))
+    {
+      pending.push_back(p);
+    }
+  }
+  const size_t count = std::min(pending.size(), size_t(std::max(budget, 0)));
+  std::partial_sort(pending.begin(), pending.begin() + count, pending.end(), [this](int32_t a, int32_t b)
+    {
+      const auto& pa = physicalPages_[a];
+      const auto& pb = physicalPages_[b];
+      if (pa.drawn != pb.drawn)
+      {
+        return !pa.drawn;
+      }
+      return pa.virtualPage > pb.virtualPage; // coarser levels have higher indices
+    });
+  pending.resize(count);
+
+  std::vector<PageUpdate> updates;
+  for (int32_t p : pending)
+  {
+    auto& page = physicalPages_[p];
+    const auto [level, position] = LocatePage(page.virtualPage);
+    updates.push_back({ level, position, glm::ivec2(p % POOL_PAGES_PER_SIDE, p / POOL_PAGES_PER_SIDE) * PAGE_SIZE });
+    if (!page.drawn)
+    {
+      pageTable_[page.virtualPage] = p;
+      pageTableVersion_++;
+    }
+    page.drawn = true;
+    page.stale = false;
+  }
+  return updates;
+}
\ No newline at end of file
@@ -21,7 +21,6 @@ int main()
 
 // TODO list (unordered)
 // PCF
-// tiled/clustered shading
 // complex SSR (for very shiny surfaces, fallback to IBL if no surface hit)
 // fix normal mapping (again)
 // more flexible model loader (assimp or similar)
@@ -42,4 +41,5 @@ int main()
 // PBR
 // image-based lighting
 // SSAO
-// FXAA
\ No newline at end of file
+// FXAA
+// clustered shading
\ No newline at end of file